@@ -0,0 +1,126 @@
+// Helpers shared by the benchmarks
+// Every benchmark builds the whole program without its main and works in a scratch copy of the Server files,
+// so it never touches the real ones. Build and run from the repository root, e.g.
+//      gcc -O2 bench/issued_books.c -o bench/issued_books -pthread && ./bench/issued_books
+#define LIBRARYMAN_NO_MAIN
+#include "../libraryman.c"
+#include <ftw.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+
+static char SCRATCH[] = "/tmp/libraryman-bench-XXXXXX";
+
+// Returns the wall clock time in seconds
+double benchNow()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// Returns the peak resident set size of the process in KiB
+long peakRSS()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_maxrss;
+}
+
+int removeScratchEntry(const char *path, const struct stat *st, int flag, struct FTW *ftw)
+{
+	return remove(path);
+}
+
+void leaveScratch()
+{
+	if (chdir("/") == 0)
+	{
+		nftw(SCRATCH, removeScratchEntry, 16, FTW_DEPTH | FTW_PHYS);
+	}
+}
+
+// Moves into a fresh scratch directory with empty Server files and a Local dir, removed again at exit
+// Returns -1 if the directory can not be made
+int enterScratch()
+{
+	if (mkdtemp(SCRATCH) == NULL || chdir(SCRATCH) != 0 || mkdir("Server", 0755) != 0 || mkdir("Local", 0755) != 0)
+	{
+		perror("scratch directory");
+		return -1;
+	}
+	atexit(leaveScratch);
+	char *files[] = {"Server/bookStore.txt", "Server/tokenStore.txt", "Server/adminTokenStore.txt", "Server/bookMarket.txt", "Server/issuedBooks.txt"};
+	for (int i = 0; i < 5; i++)
+	{
+		FILE *fp = fopen(files[i], "w");
+		if (fp == NULL)
+		{
+			return -1;
+		}
+		fclose(fp);
+	}
+	return 0;
+}
+
+// Writes n generated books to Server/bookStore.txt, ISS000000 onwards, with titles of three words out of a
+// vocabulary of 20 and a number below 400, and 5000 authors
+// Returns -1 if the file does not open
+int writeBookStore(int n)
+{
+	static char *words[] = {"river", "magic", "garden", "ocean", "king", "shadow", "winter", "silver", "history", "python",
+							"quantum", "night", "empire", "secret", "island", "storm", "golden", "letters", "forest", "war"};
+	FILE *fp = fopen("Server/bookStore.txt", "w");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	unsigned int seed = 1;
+	for (int i = 0; i < n; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		unsigned int a = seed >> 8;
+		seed = seed * 1103515245 + 12345;
+		unsigned int b = seed >> 8;
+		fprintf(fp, "ISS%06d\n%s %s %s %u\nAuthor %u\n3\n0\n", i, words[a % 20], words[(a / 20) % 20], words[b % 20], b % 400, (a / 400) % 5000);
+	}
+	return fclose(fp);
+}
+
+// Puts a word of two or three syllables in word, drawn with seed, out of some 30k such words
+void makeWord(char *word, unsigned int *seed)
+{
+	static char *syllables[] = {"ka", "ri", "mon", "sel", "tor", "va", "len", "dru", "pha", "gos", "nim", "bel", "cor", "thu",
+								"wen", "lo", "zar", "fi", "dam", "quel", "ost", "ren", "bai", "mur", "sti", "gal", "hev", "pon",
+								"dri", "cas", "lum", "ek"};
+	*seed = *seed * 1103515245 + 12345;
+	unsigned int r = *seed >> 8;
+	int n = 2 + (r & 1);
+	word[0] = '\0';
+	for (int i = 0; i < n; i++)
+	{
+		strcat(word, syllables[(r >> (5 * i + 1)) & 31]);
+	}
+}
+
+// Writes n generated books to Server/bookStore.txt like writeBookStore, but with titles of three made up words and
+// authors of two, so that almost every title names one book and a search can tell whether it found the right one
+// Returns -1 if the file does not open
+int writeDistinctBookStore(int n)
+{
+	FILE *fp = fopen("Server/bookStore.txt", "w");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	unsigned int seed = 1;
+	char words[5][20];
+	for (int i = 0; i < n; i++)
+	{
+		for (int w = 0; w < 5; w++)
+		{
+			makeWord(words[w], &seed);
+		}
+		fprintf(fp, "ISS%06d\n%s %s %s\n%s %s\n3\n0\n", i, words[0], words[1], words[2], words[3], words[4]);
+	}
+	return fclose(fp);
+}
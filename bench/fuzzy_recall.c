@@ -0,0 +1,139 @@
+// Recall and latency of searchBooksFuzzy on 50k books over a range of trigram candidate limits
+// Every query is the title of one book with a typo in each of its words, recall@n being the share of queries
+// that find their book within the first n hits
+#include "bench.h"
+
+#define BOOKS 50000
+#define QUERIES 200
+
+// searchBooksFuzzy with the number of trigram candidates passed in instead of FUZZY_CANDIDATES
+// Puts the ids of up to k hits in ids, best first
+// Returns the number of hits
+int fuzzySearch(char *query, int limit, int k, char ids[][50])
+{
+	char words[FUZZY_MAX_WORDS][50];
+	int nwords = splitWords(query, words, FUZZY_MAX_WORDS);
+	struct catalogVersion *version = openSnapshot(SNAPSHOT_TRIGRAMS);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	struct shardSearch search;
+	memset(&search, 0, sizeof(search));
+	search.version = version;
+	search.words = words;
+	search.nwords = nwords;
+	search.ncandidates = fuzzyCandidates(&search, limit, &search.candidates);
+	search.k = k;
+	runShards(distanceShard, &search);
+	free(search.candidates);
+	struct rankedBook *heap;
+	int size = mergeShardHits(&search, k, &heap);
+	for (int i = 0; i < size; i++)
+	{
+		struct bookClass book;
+		readCompactBook(version, heap[i].record, &book);
+		strcpy(ids[i], book.id);
+	}
+	free(heap);
+	closeSnapshot();
+	return size;
+}
+
+// Puts one typo in every word of text longer than three letters: a swap of two neighbouring letters,
+// a changed letter or a dropped letter
+void addTypos(char *text, unsigned int *seed)
+{
+	char out[50];
+	int len = 0;
+	char *word = text;
+	while (*word != '\0')
+	{
+		int wlen = strcspn(word, " ");
+		*seed = *seed * 1103515245 + 12345;
+		int at = wlen > 3 ? 1 + (*seed >> 8) % (wlen - 2) : -1;
+		int kind = (*seed >> 20) % 3;
+		for (int i = 0; i < wlen; i++)
+		{
+			if (i == at && kind == 0)
+			{
+				out[len++] = word[i + 1];
+				out[len++] = word[i];
+				i++;
+			}
+			else if (i == at && kind == 1)
+			{
+				out[len++] = word[i] == 'x' ? 'y' : 'x';
+			}
+			else if (i != at)
+			{
+				out[len++] = word[i];
+			}
+		}
+		word += wlen;
+		if (*word == ' ')
+		{
+			out[len++] = *word++;
+		}
+	}
+	out[len] = '\0';
+	strcpy(text, out);
+}
+
+int main()
+{
+	if (enterScratch() != 0 || writeDistinctBookStore(BOOKS) != 0)
+	{
+		return 1;
+	}
+	// The targets are picked out of Server/bookStore.txt before the first search turns it into the catalog
+	char targets[QUERIES][50];
+	char queries[QUERIES][50];
+	FILE *fp = fopen("Server/bookStore.txt", "r");
+	char line[50];
+	int q = 0;
+	unsigned int seed = 7;
+	for (int i = 0; q < QUERIES && fgets(line, 50, fp); i++)
+	{
+		line[strlen(line) - 1] = '\0';
+		if (i % 5 == 0)
+		{
+			strcpy(targets[q], line);
+		}
+		else if (i % 5 == 1 && (i / 5) % (BOOKS / QUERIES) == 0)
+		{
+			strcpy(queries[q], line);
+			addTypos(queries[q], &seed);
+			q++;
+		}
+	}
+	fclose(fp);
+	printf("%d queries with typos on %d books, e.g. \"%s\" for %s\n", QUERIES, BOOKS, queries[1], targets[1]);
+
+	// The first search builds the trigram index, only the ones after it are timed
+	char ids[10][50];
+	fuzzySearch(queries[0], FUZZY_CANDIDATES, 10, ids);
+	int limits[] = {32, 128, 512, 2048, BOOKS};
+	for (int l = 0; l < 5; l++)
+	{
+		int top1 = 0;
+		int top10 = 0;
+		double start = benchNow();
+		for (int i = 0; i < QUERIES; i++)
+		{
+			int n = fuzzySearch(queries[i], limits[l], 10, ids);
+			for (int h = 0; h < n; h++)
+			{
+				if (strcmp(ids[h], targets[i]) == 0)
+				{
+					top1 += h == 0;
+					top10++;
+					break;
+				}
+			}
+		}
+		printf("%5d candidates%s: recall@1 %5.1f%%, recall@10 %5.1f%%, %7.3f ms per search\n", limits[l], limits[l] == FUZZY_CANDIDATES ? " (default)" : "          ",
+			   100.0 * top1 / QUERIES, 100.0 * top10 / QUERIES, (benchNow() - start) * 1e3 / QUERIES);
+	}
+	return 0;
+}
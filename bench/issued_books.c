@@ -0,0 +1,94 @@
+// Fetching the loans of one user at 100k active borrowers: the scan of Server/issuedBooks.txt that
+// getIssuedBookInfo used to do against the per user shards it reads now
+#include "bench.h"
+
+#define BORROWERS 100000
+#define LOANS 2
+#define LOOKUPS 50
+
+// The old getIssuedBookInfo: every line of Server/issuedBooks.txt is compared against the token until its block turns up
+// Returns the number of loans of the user
+int scanIssuedBooks(char *token)
+{
+	FILE *fp = fopen("Server/issuedBooks.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	int tokenline = 1;
+	int size = 0;
+	char line[50];
+	while (fgets(line, 50, fp))
+	{
+		if (tokenline == 1)
+		{
+			line[strlen(line) - 1] = '\0';
+			if (strcmp(token, line) == 0)
+			{
+				// id, title, author and issue time of every loan until the blank line closing the block
+				while (fgets(line, 50, fp) && line[0] != '\n')
+				{
+					for (int i = 0; i < 3 && fgets(line, 50, fp); i++)
+					{
+					}
+					size++;
+				}
+				break;
+			}
+		}
+		tokenline = line[0] == '\n';
+	}
+	fclose(fp);
+	return size;
+}
+
+int main()
+{
+	if (enterScratch() != 0)
+	{
+		return 1;
+	}
+	FILE *fp = fopen("Server/issuedBooks.txt", "w");
+	for (int u = 0; u < BORROWERS; u++)
+	{
+		fprintf(fp, "TOK%07d\n", u);
+		for (int k = 0; k < LOANS; k++)
+		{
+			fprintf(fp, "ISS%06d\nSome Title\nSome Author\n1700000000\n", (u * 7 + k) % 20000);
+		}
+		fprintf(fp, "\n");
+	}
+	fclose(fp);
+	printf("%d borrowers with %d loans each\n", BORROWERS, LOANS);
+
+	char token[20];
+	long loans = 0;
+	double start = benchNow();
+	for (int i = 0; i < LOOKUPS; i++)
+	{
+		sprintf(token, "TOK%07d", (i * 1999) % BORROWERS);
+		loans += scanIssuedBooks(token);
+	}
+	printf("issuedBooks.txt scan: %8.3f ms per lookup (%ld loans)\n", (benchNow() - start) * 1e3 / LOOKUPS, loans);
+
+	start = benchNow();
+	if (splitIssuedBooks() != 0)
+	{
+		printf("split failed\n");
+		return 1;
+	}
+	printf("one time split:       %8.1f ms\n", (benchNow() - start) * 1e3);
+
+	loans = 0;
+	start = benchNow();
+	for (int i = 0; i < LOOKUPS; i++)
+	{
+		sprintf(token, "TOK%07d", (i * 1999) % BORROWERS);
+		struct resultSet books;
+		initResultSet(&books);
+		loans += getIssuedBookInfo(token, &books);
+		freeResultSet(&books);
+	}
+	printf("per user shard:       %8.3f ms per lookup (%ld loans)\n", (benchNow() - start) * 1e3 / LOOKUPS, loans);
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Returning 1000 loans of 200 users in shuffled drop box order: a returnBook call per loan against one returnBooks batch
+#include "bench.h"
+
+#define BOOKS 20000
+#define USERS 200
+#define LOANS 5
+#define PAIRS (USERS * LOANS)
+#define ROUNDS 5
+
+static char TOKENS[PAIRS][20];
+static char IDS[PAIRS][20];
+
+// Issues every loan of every user, one issueBooks batch per user
+// Returns -1 if a loan is turned away
+int issueLoans()
+{
+	for (int u = 0; u < USERS; u++)
+	{
+		char *ids[LOANS];
+		int statuses[LOANS];
+		for (int k = 0; k < LOANS; k++)
+		{
+			ids[k] = IDS[u * LOANS + k];
+		}
+		if (issueBooks(TOKENS[u * LOANS], ids, LOANS, 1700000000, statuses) != LOANS)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Puts the pairs in a fixed shuffled order, as a drop box would hand them in
+void shufflePairs(char **tokens, char **ids)
+{
+	int order[PAIRS];
+	for (int i = 0; i < PAIRS; i++)
+	{
+		order[i] = i;
+	}
+	unsigned int seed = 3;
+	for (int i = PAIRS - 1; i > 0; i--)
+	{
+		seed = seed * 1103515245 + 12345;
+		int j = (seed >> 8) % (i + 1);
+		int t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+	for (int i = 0; i < PAIRS; i++)
+	{
+		tokens[i] = TOKENS[order[i]];
+		ids[i] = IDS[order[i]];
+	}
+}
+
+// Returns the number of copies of the loaned books still issued
+int issuedCopies()
+{
+	int issued = 0;
+	for (int i = 0; i < PAIRS; i++)
+	{
+		struct bookClass book;
+		if (getBookByID(IDS[i], &book) == 0)
+		{
+			issued += book.issued;
+		}
+	}
+	return issued;
+}
+
+int main()
+{
+	if (enterScratch() != 0 || writeBookStore(BOOKS) != 0)
+	{
+		return 1;
+	}
+	for (int i = 0; i < PAIRS; i++)
+	{
+		sprintf(TOKENS[i], "TOK%07d", i / LOANS);
+		sprintf(IDS[i], "ISS%06d", (i * 7) % BOOKS);
+	}
+	char *tokens[PAIRS];
+	char *ids[PAIRS];
+	shufflePairs(tokens, ids);
+	printf("%d returns from %d users, %d rounds each\n", PAIRS, USERS, ROUNDS);
+
+	double loop = 0;
+	double batch = 0;
+	for (int r = 0; r < ROUNDS; r++)
+	{
+		if (issueLoans() != 0)
+		{
+			printf("issue failed\n");
+			return 1;
+		}
+		double start = benchNow();
+		int returned = 0;
+		for (int i = 0; i < PAIRS; i++)
+		{
+			returned += returnBook(tokens[i], ids[i]) == 0;
+		}
+		loop += benchNow() - start;
+		if (returned != PAIRS || issuedCopies() != 0)
+		{
+			printf("returnBook loop returned %d, %d copies still issued\n", returned, issuedCopies());
+			return 1;
+		}
+
+		if (issueLoans() != 0)
+		{
+			printf("issue failed\n");
+			return 1;
+		}
+		int statuses[PAIRS];
+		start = benchNow();
+		returned = returnBooks(tokens, ids, PAIRS, statuses);
+		batch += benchNow() - start;
+		if (returned != PAIRS || issuedCopies() != 0)
+		{
+			printf("returnBooks returned %d, %d copies still issued\n", returned, issuedCopies());
+			return 1;
+		}
+	}
+	printf("returnBook loop:   %8.2f ms per %d returns, %6.0f returns/s\n", loop * 1e3 / ROUNDS, PAIRS, PAIRS * ROUNDS / loop);
+	printf("returnBooks batch: %8.2f ms per %d returns, %6.0f returns/s\n", batch * 1e3 / ROUNDS, PAIRS, PAIRS * ROUNDS / batch);
+	return 0;
+}
@@ -0,0 +1,93 @@
+// Heap use over 10k searches on 50k books: results taken in arena backed result sets against the same
+// results copied into one malloc per bookList node the way searchBooks used to hand them out
+#include "bench.h"
+#include <malloc.h>
+#include <sys/wait.h>
+
+#define BOOKS 50000
+#define SEARCHES 10000
+
+// Returns the bytes of heap in use, mmapped chunks included
+size_t heapInUse()
+{
+	struct mallinfo2 info = mallinfo2();
+	return info.uordblks + info.hblkhd;
+}
+
+// Runs the searches, holding the results either in the result set or in a malloc per node list
+// Prints the heap in use between searches every 2000 searches, then the most heap the results of one search
+// took and the peak RSS
+void runSearches(int nodes)
+{
+	char *queries[] = {"river", "magic garden", "Author 12", "ISS0001", "ocean king"};
+	long hits = 0;
+	size_t peak = 0;
+	size_t held = 0;
+	double start = benchNow();
+	for (int i = 0; i < SEARCHES; i++)
+	{
+		struct resultSet books;
+		initResultSet(&books);
+		int n = searchBooks(queries[i % 5], &books);
+		if (nodes)
+		{
+			struct bookList *head = (struct bookList *)malloc(sizeof(struct bookList));
+			struct bookList *booklist = head;
+			for (struct bookList *result = (struct bookList *)books.head; result != NULL; result = result->next)
+			{
+				booklist->book = result->book;
+				booklist->next = (struct bookList *)malloc(sizeof(struct bookList));
+				booklist = booklist->next;
+			}
+			freeResultSet(&books);
+			held = heapInUse();
+			while (head != NULL)
+			{
+				struct bookList *next = head == booklist ? NULL : head->next;
+				free(head);
+				head = next;
+			}
+		}
+		else
+		{
+			held = heapInUse();
+			freeResultSet(&books);
+		}
+		hits += n;
+		size_t idle = heapInUse();
+		if (held - idle > peak)
+		{
+			peak = held - idle;
+		}
+		if ((i + 1) % 2000 == 0)
+		{
+			printf("  %5d searches: %8zu bytes in use between searches\n", i + 1, idle);
+		}
+	}
+	printf("  %.1f us per search, %ld hits, results of one search took up to %zu KiB, peak RSS %ld KiB\n", (benchNow() - start) * 1e6 / SEARCHES, hits, peak / 1024, peakRSS());
+}
+
+int main()
+{
+	if (enterScratch() != 0 || writeBookStore(BOOKS) != 0)
+	{
+		return 1;
+	}
+	printf("%d searches on %d books\n", SEARCHES, BOOKS);
+	// Each layout runs in a child of its own so that the peak RSS is its own
+	char *names[] = {"arena backed result sets", "malloc per node"};
+	for (int nodes = 0; nodes < 2; nodes++)
+	{
+		fflush(stdout);
+		pid_t pid = fork();
+		if (pid == 0)
+		{
+			printf("%s\n", names[nodes]);
+			runSearches(nodes);
+			fflush(stdout);
+			_exit(0);
+		}
+		waitpid(pid, NULL, 0);
+	}
+	return 0;
+}
@@ -0,0 +1,121 @@
+// Catalog reads per second at 1, 2, 4 and 8 reader threads on 50k books, alone and with one writer thread
+// issuing and returning a book the whole time
+// Readers go through the published catalog snapshot without a lock, so their throughput should grow with the
+// reader count whether the writer runs or not
+#include "bench.h"
+
+#define BOOKS 50000
+#define SECONDS 2
+#define MAX_READERS 8
+
+static volatile int STOP;
+static long READS[MAX_READERS];
+static long WRITES;
+static int TORN;
+static int GARDEN;
+
+// Alternates getBookByID on the book the writer works on with a search matching a fixed set of books
+// Counts a read as torn if the book shows more than one copy issued or the search finds another number of books
+void *readCatalog(void *arg)
+{
+	long reader = (long)arg;
+	long n = 0;
+	while (!STOP)
+	{
+		if (n % 2 == 0)
+		{
+			struct bookClass book;
+			if (getBookByID("ISS000123", &book) != 0 || book.issued < 0 || book.issued > 1)
+			{
+				__sync_fetch_and_add(&TORN, 1);
+			}
+		}
+		else
+		{
+			struct resultSet books;
+			initResultSet(&books);
+			if (searchBooks("ISS00012", &books) != GARDEN)
+			{
+				__sync_fetch_and_add(&TORN, 1);
+			}
+			freeResultSet(&books);
+		}
+		n++;
+	}
+	READS[reader] = n;
+	return NULL;
+}
+
+// Issues ISS000123 and returns it again until told to stop
+void *issueAndReturn(void *arg)
+{
+	struct bookInfo book = {"ISS000123", "", ""};
+	long n = 0;
+	while (!STOP)
+	{
+		issueBook("TOK0000001", book, 1700000000);
+		returnBook("TOK0000001", "ISS000123");
+		n += 2;
+	}
+	WRITES = n;
+	return NULL;
+}
+
+int main()
+{
+	if (enterScratch() != 0 || writeBookStore(BOOKS) != 0)
+	{
+		return 1;
+	}
+	// The first search builds the catalog, only the reads after it are counted
+	struct resultSet books;
+	initResultSet(&books);
+	GARDEN = searchBooks("ISS00012", &books);
+	freeResultSet(&books);
+	printf("%d books, %d s per run\n", BOOKS, SECONDS);
+
+	double single = 0;
+	for (int readers = 1; readers <= MAX_READERS; readers *= 2)
+	{
+		for (int writer = 0; writer < 2; writer++)
+		{
+			STOP = 0;
+			TORN = 0;
+			WRITES = 0;
+			pthread_t threads[MAX_READERS];
+			pthread_t writerThread;
+			for (long i = 0; i < readers; i++)
+			{
+				pthread_create(&threads[i], NULL, readCatalog, (void *)i);
+			}
+			if (writer)
+			{
+				pthread_create(&writerThread, NULL, issueAndReturn, NULL);
+			}
+			usleep(SECONDS * 1000000);
+			STOP = 1;
+			long reads = 0;
+			for (int i = 0; i < readers; i++)
+			{
+				pthread_join(threads[i], NULL);
+				reads += READS[i];
+			}
+			if (writer)
+			{
+				pthread_join(writerThread, NULL);
+			}
+			double rate = (double)reads / SECONDS;
+			if (readers == 1 && !writer)
+			{
+				single = rate;
+			}
+			printf("%d reader%s %-12s %10.0f reads/s (%4.2fx one idle reader), %d torn", readers, readers == 1 ? " " : "s", writer ? "with writer" : "alone", rate, rate / single, TORN);
+			if (writer)
+			{
+				printf(", %ld writes", WRITES);
+			}
+			printf("\n");
+		}
+	}
+	return 0;
+}
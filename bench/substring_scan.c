@@ -0,0 +1,130 @@
+// Short query search over 200k books: the fgets and strncmp loop searchBooks used to run over
+// Server/bookStore.txt against the scan of the contiguous text column, and every substring kernel on its own
+#include "bench.h"
+
+#define BOOKS 200000
+#define ROUNDS 20
+
+// The old searchBooks: every line of every block is compared against the query at each offset with strncmp
+// Only the number of matching books is kept, a match restarted the read of the file at its block
+// Returns the number of books matching
+int scanBookStore(char *book)
+{
+	FILE *fp = fopen("Server/bookStore.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	int size = 0;
+	int blen = strlen(book);
+	char line[50];
+	while (fgets(line, 50, fp))
+	{
+		int found = 0;
+		for (int i = 0; i < 5; i++)
+		{
+			int llen = strlen(line);
+			for (int j = 0; !found && j < llen - blen; j++)
+			{
+				found = strncmp(book, &line[j], blen) == 0;
+			}
+			if (i < 4 && !fgets(line, 50, fp))
+			{
+				break;
+			}
+		}
+		size += found;
+	}
+	fclose(fp);
+	return size;
+}
+
+// Counts the hits of needle in data with one kernel, carrying on after every hit
+long countHits(long (*kernel)(char *, long, char *, int, long), char *data, long size, char *needle)
+{
+	long hits = 0;
+	long pos = 0;
+	while ((pos = kernel(data, size, needle, strlen(needle), pos)) != -1)
+	{
+		hits++;
+		pos++;
+	}
+	return hits;
+}
+
+int main()
+{
+	if (enterScratch() != 0 || writeBookStore(BOOKS) != 0)
+	{
+		return 1;
+	}
+	printf("%d books\n", BOOKS);
+	char *queries[] = {"Qz", "7x", "99", "er"};
+
+	// The titles of the whole store back to back, as the text column holds them
+	FILE *fp = fopen("Server/bookStore.txt", "r");
+	long size = 0;
+	long cap = 1 << 20;
+	char *column = (char *)malloc(cap);
+	char line[50];
+	for (int i = 0; fgets(line, 50, fp); i++)
+	{
+		if (i % 5 == 1)
+		{
+			int len = strlen(line) - 1;
+			if (size + len + 1 > cap)
+			{
+				cap *= 2;
+				column = (char *)realloc(column, cap);
+			}
+			memcpy(column + size, line, len);
+			size += len;
+			column[size++] = '\n';
+		}
+	}
+	fclose(fp);
+
+	for (int q = 0; q < 4; q++)
+	{
+		printf("query \"%s\"\n", queries[q]);
+		double start = benchNow();
+		int old = scanBookStore(queries[q]);
+		printf("  fgets and strncmp loop: %8.2f ms (%d books)\n", (benchNow() - start) * 1e3, old);
+
+		struct resultSet books;
+		initResultSet(&books);
+		// The first search builds the column, only the ones after it are timed
+		searchBooks(queries[q], &books);
+		freeResultSet(&books);
+		start = benchNow();
+		int found = 0;
+		for (int r = 0; r < ROUNDS; r++)
+		{
+			initResultSet(&books);
+			found = searchBooks(queries[q], &books);
+			freeResultSet(&books);
+		}
+		printf("  searchBooks:            %8.2f ms (%d books)\n", (benchNow() - start) * 1e3 / ROUNDS, found);
+
+		char *names[] = {"scalar", "sse2", "avx2"};
+		long (*kernels[])(char *, long, char *, int, long) = {findSubstringScalar, findSubstringSSE2, findSubstringAVX2};
+		for (int k = 0; k < 3; k++)
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			if (k == 2 && !__builtin_cpu_supports("avx2"))
+			{
+				continue;
+			}
+#endif
+			start = benchNow();
+			long hits = 0;
+			for (int r = 0; r < ROUNDS; r++)
+			{
+				hits = countHits(kernels[k], column, size, queries[q]);
+			}
+			printf("  %-6s kernel on titles: %6.2f ms (%ld hits in %ld bytes)\n", names[k], (benchNow() - start) * 1e3 / ROUNDS, hits, size);
+		}
+	}
+	free(column);
+	return 0;
+}
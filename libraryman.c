@@ -7,6 +7,15 @@
 //
 // # Server APIs section contains function declarations
 //      which will interact with files from mock Server i.e. ./Server dir in this case.
+// # Server Storage section contains the binary catalog and the persistent hash indexes
+//      that the Server APIs use instead of scanning the text files line by line.
+//      Server/bookStore.txt is converted into Server/bookStore.dat on first use.
+//      Batches of record and index reads and journal appends go through an io_uring per thread,
+//      or through a pool of pread and pwrite threads on kernels or headers without io_uring.
+// # Server Daemon section contains a long running server for the Server APIs.
+//      ./libraryman --daemon loads the catalog and the usernames once and answers on Server/libraryman.sock,
+//      every CLI started while it runs forwards its Server API calls to it.
+//      Build with: gcc libraryman.c -o libraryman -pthread
 // # Local Database Interactor section contains function declaration
 //      which will interact with files from mock Local Database i.e. ./Database dir
 // # Business Logic Layer section contains model functions
@@ -15,15 +24,61 @@
 // ##########################################################################################################################
 
 /* Code */
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#endif
+#endif
+// The io_uring backend needs the file position support, IORING_OP_READ and IORING_OP_WRITE of the 5.6 headers,
+// every other build only has the pool of pread and pwrite threads
+#if defined(__linux__) && defined(IORING_FEAT_RW_CUR_POS)
+#define LIBRARYMAN_IO_URING
+#endif
 
 typedef unsigned long long int64;
 static void (*SCREEN)();
 static char USERNAME[20] = "\0";
+static struct trigramIndex TRIGRAMS;
+static struct textColumn BOOKTEXT;
+static struct textColumn USERTEXT;
+// Guards USERTEXT, which searchUsers reloads in place when Server/tokenStore.txt changes
+static pthread_mutex_t USERTEXT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static struct compactCatalog BOOKS;
+// Guards BOOKS, TRIGRAMS, BOOKTEXT and PREFIXES, which only writers and refreshCatalog touch, readers go through CATALOG_VERSION
+static pthread_mutex_t CATALOG_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static struct catalogVersion *_Atomic CATALOG_VERSION;
+static struct searchWeights SEARCH_WEIGHTS;
+static long (*FIND_SUBSTRING)(char *data, long size, char *needle, int nlen, long from);
+static pthread_once_t FIND_SUBSTRING_ONCE = PTHREAD_ONCE_INIT;
+// Set when a daemon answers on DAEMON_SOCKET, the Server APIs then forward their calls to it
+static int DAEMON_CLIENT = 0;
 
 struct bookClass
 {
@@ -35,10 +90,11 @@ struct bookClass
 	int issued;
 };
 
+// Result lists keep next as their first member so that a result set can link any of them
 struct bookList
 {
-	struct bookClass book;
 	struct bookList *next;
+	struct bookClass book;
 };
 
 struct bookInfo
@@ -50,9 +106,9 @@ struct bookInfo
 
 struct bookInfoList
 {
+	struct bookInfoList *next;
 	struct bookInfo book;
 	time_t time;
-	struct bookInfoList *next;
 };
 
 struct txtFile
@@ -63,8 +119,8 @@ struct txtFile
 
 struct users
 {
-	char username[20];
 	struct users *next;
+	char username[20];
 };
 
 struct bookVendors
@@ -77,8 +133,389 @@ struct bookVendors
 
 struct bookVendorList
 {
-	struct bookVendors book;
 	struct bookVendorList *next;
+	struct bookVendors book;
+};
+
+// Bump allocator behind a result set, blocks double in size so most queries need a single allocation
+struct arenaBlock
+{
+	struct arenaBlock *prev;
+	size_t used;
+	size_t capacity;
+	_Alignas(16) char data[];
+};
+
+struct resultNode
+{
+	struct resultNode *next;
+};
+
+// Results of a query: bookList, bookInfoList, users or bookVendorList nodes allocated from one arena
+// Every node is released at once by freeResultSet
+struct resultSet
+{
+	struct arenaBlock *arena;
+	struct resultNode *head;
+	struct resultNode *tail;
+	int size;
+};
+
+// Binary book catalog stored in Server/bookStore.dat
+// A header block is followed by fixed width records so that record n lives at (n + 1) * sizeof(struct bookRecord)
+// Records are 256 bytes and never straddle a page
+// quantity and issued sit at fixed offsets inside a record so that they can be updated in place
+struct bookRecord
+{
+	char id[50];
+	char bookTitle[100];
+	char author[98];
+	int quantity;
+	int issued;
+};
+_Static_assert(sizeof(struct bookRecord) == 256, "book records must stay 256 bytes wide");
+
+struct catalogHeader
+{
+	char magic[8];
+	int count;
+	char reserved[244];
+};
+
+// Persistent open addressing hash index, maps a 32 bit key hash to a value
+// Values are stored incremented by one so that a zeroed slot is empty
+struct indexHeader
+{
+	char magic[8];
+	unsigned int capacity;
+	unsigned int count;
+	long stamp;
+};
+
+struct indexSlot
+{
+	unsigned int hash;
+	unsigned int value;
+};
+
+struct hashIndex
+{
+	int fd;
+	unsigned int capacity;
+	unsigned int count;
+	long stamp;
+	char path[100];
+};
+
+struct hashProbe
+{
+	unsigned int hash;
+	unsigned int slot;
+	unsigned int steps;
+	unsigned int windowStart;
+	unsigned int windowSize;
+	struct indexSlot window[8];
+};
+
+struct catalog
+{
+	int fd;
+	int count;
+	struct hashIndex index;
+};
+
+// Points awarded for a query matching a field exactly, at its start or anywhere in it
+// Each array is indexed by BOOK_FIELD_ID, BOOK_FIELD_TITLE and BOOK_FIELD_AUTHOR
+struct searchWeights
+{
+	int exact[3];
+	int prefix[3];
+	int substring[3];
+};
+
+// Default weights, an exact issue number outranks an exact title which outranks an exact author
+static struct searchWeights SEARCH_WEIGHTS = {
+	.exact = {100, 80, 60},
+	.prefix = {40, 30, 20},
+	.substring = {10, 8, 5},
+};
+
+// Strings of one field of the compact catalog sorted case insensitively, so the strings starting with a prefix are a contiguous range
+struct prefixEntry
+{
+	unsigned int text;
+	unsigned int record;
+};
+
+struct prefixIndex
+{
+	struct prefixEntry *entries;
+	int count;
+	int capacity;
+};
+static struct prefixIndex PREFIXES[3];
+
+// A completion returned by the autocomplete API, linked into a result set
+struct completionList
+{
+	struct completionList *next;
+	char text[100];
+};
+
+// A (user, book) pair of a return batch and its position in the batch
+struct returnPair
+{
+	char *token;
+	char *id;
+	int position;
+};
+
+// In memory set of strings owned by the caller, for checking a whole batch against a file read once
+// keys holds the strings in the order they were added and slots their positions incremented by one so that a zeroed slot is empty
+struct keySet
+{
+	char **keys;
+	int count;
+	int capacity;
+	unsigned int *slots;
+	unsigned int slotCount;
+};
+
+// A row of a vendor shipment: buy quantity copies of the market book id under the Issue No issueID
+struct purchaseList
+{
+	struct purchaseList *next;
+	char id[50];
+	char issueID[50];
+	int quantity;
+	int status;
+};
+
+struct rankedBook
+{
+	int score;
+	unsigned int record;
+};
+
+// Walks the catalog in record order, reading records from storage a few at a time
+// Records are only ever appended, so a record number is a stable position to resume from
+struct bookCursor
+{
+	struct catalog cat;
+	int next;
+	int buffered;
+	int used;
+	struct bookRecord buffer[16];
+};
+
+// Write-ahead journal entry, appended to Server/journal.log before an issue, return or purchase touches the Server files
+// issued holds the issued count of the book after the operation so that replaying an entry twice is harmless
+struct journalEntry
+{
+	unsigned int magic;
+	unsigned int checksum;
+	int type;
+	int issued;
+	long time;
+	char token[24];
+	struct bookRecord book;
+};
+
+struct journal
+{
+	int fd;
+	off_t end;
+};
+
+// Library wide min-heap of loan due times stored in Server/dueHeap.dat, entry i lives at (i + 1) * sizeof(struct dueEntry)
+// Returns leave their entries behind, a reader checks every entry against the shard of its user
+// dirty is set while the heap is being rewritten, a heap found dirty is rebuilt from the shards
+// pending counts the issues that are between their shard and the heap, the journal recovery rebuilds a heap
+// that still has some as their writer died; generation changes with every rebuild, which drops pending to 0
+struct dueHeapHeader
+{
+	char magic[8];
+	int count;
+	int dirty;
+	int pending;
+	int generation;
+	char reserved[72];
+};
+
+struct dueEntry
+{
+	long due;
+	long time;
+	char token[24];
+	char id[50];
+	char reserved[6];
+};
+_Static_assert(sizeof(struct dueEntry) == sizeof(struct dueHeapHeader), "due entries must be as wide as the heap header");
+
+// Per user inbox stored in Server/inbox/<token>.dat, fixed width notifications after a header like the catalog
+// Notifications before unread were already shown, the rest are waiting to be
+struct inboxHeader
+{
+	char magic[8];
+	int count;
+	int unread;
+	char reserved[160];
+};
+
+// A due soon or overdue event about one loan
+struct notification
+{
+	int type;
+	int reserved;
+	long due;
+	long time;
+	char id[50];
+	char bookTitle[50];
+	char author[50];
+	char padding[2];
+};
+_Static_assert(sizeof(struct notification) == sizeof(struct inboxHeader), "notifications must be as wide as the inbox header");
+
+struct notificationList
+{
+	struct notificationList *next;
+	struct notification note;
+};
+
+// An overdue loan returned by the overdue API, linked into a result set
+struct loanList
+{
+	struct loanList *next;
+	char token[24];
+	char username[50];
+	struct bookInfo book;
+	time_t time;
+	time_t due;
+};
+
+// In memory trigram inverted index over the id, title and author of every catalog record
+// Trigrams are case folded and each posting list holds record numbers in ascending order
+struct postingList
+{
+	unsigned int *records;
+	int size;
+	int capacity;
+};
+
+struct trigramIndex
+{
+	int indexed;
+	unsigned int capacity;
+	unsigned int used;
+	unsigned int *keys;
+	struct postingList *lists;
+};
+
+// Deduplicated strings referenced by 32 bit offsets into data
+// slots is an open addressing table of interned offsets incremented by one so that a zeroed slot is empty
+struct stringPool
+{
+	char *data;
+	unsigned int size;
+	unsigned int capacity;
+	unsigned int *slots;
+	unsigned int slotCount;
+	unsigned int used;
+};
+
+// In memory copy of a catalog record, 16 bytes against the 458 of a struct bookClass
+// Counts that do not fit in 16 bits are stored as COMPACT_COUNT_MAX and read from the record instead
+struct compactBook
+{
+	unsigned int id;
+	unsigned int bookTitle;
+	unsigned int author;
+	unsigned short quantity;
+	unsigned short issued;
+};
+
+// Every record of the catalog in record order, with titles and authors interned in pool
+// stamp is the fileStamp of the catalog the counts were last read from
+struct compactCatalog
+{
+	struct compactBook *books;
+	int count;
+	int capacity;
+	long stamp;
+	struct stringPool pool;
+};
+
+// Growable buffer a daemon request or reply is packed into, read back from offset
+struct message
+{
+	char *data;
+	unsigned int size;
+	unsigned int capacity;
+	unsigned int offset;
+	int failed;
+};
+
+struct requestHeader
+{
+	unsigned int magic;
+	int op;
+	unsigned int length;
+};
+
+struct replyHeader
+{
+	int ret;
+	unsigned int length;
+};
+
+// Strings packed back to back into one buffer for brute force scans
+// Entry i spans data[offsets[i]] up to data[offsets[i + 1]] and its fields are separated by NUL bytes,
+// which no query can contain, so a match never runs from one field into the next
+struct textColumn
+{
+	char *data;
+	unsigned int size;
+	unsigned int capacity;
+	unsigned int *offsets;
+	int count;
+	int slots;
+	long stamp;
+};
+
+// The text side of a catalog version: copies of the string pool and of the indexes over it, which only change when records are appended
+// parts says which of the trigram index, the text column and the prefix indexes were asked for, the others are left empty
+// ids is an open addressing table of record numbers incremented by one, keyed by the hash of the Issue No
+struct catalogText
+{
+	int generation;
+	int parts;
+	char *pool;
+	struct trigramIndex trigrams;
+	unsigned int *postings;
+	struct textColumn column;
+	struct prefixIndex prefixes[3];
+	unsigned int *ids;
+	unsigned int idSlots;
+};
+
+// An immutable copy of the compact catalog, published through CATALOG_VERSION for readers that take no lock
+// Rows are kept in chunks of SNAPSHOT_CHUNK, so a version made for a changed count copies one chunk and shares the rest
+// and its text with the version before it
+struct catalogVersion
+{
+	struct compactBook **chunks;
+	int count;
+	long stamp;
+	struct catalogText *text;
+};
+
+// Part of an old version waiting for every reader that entered at or before epoch to leave
+struct retiredPiece
+{
+	struct retiredPiece *next;
+	unsigned long epoch;
+	void *data;
+	void (*release)(void *data);
 };
 // ##########################################################################################################################
 
@@ -90,15 +527,19 @@ struct bookVendorList
 // Returns -1 if the file does not open
 int verifyCredentials(char *username, int64 hash, char *token);
 int verifyCredentialsForAdmin(char *username, int64 hash, char *token);
+int verifyStoredCredentials(char *path, char *indexPath, char *username, int64 hash, char *token);
 // Registers new user by creating a login token for the user
 // Returns 0 if token is created successfully
 // Returns 1 if username already exists
 // Returns -1 if the file does not open
 int createNewToken(char *username, int64 hash);
 // Removes a user by permanently deleting the login token from server
+// Returns -1 if the file does not open
+// Returns 0 if the user is removed
+// Returns 1 if there is no such user
 int deleteTokenPermanently(char *username);
 // Returns all users in userlist
-int viewUsers(struct users *userlist);
+int viewUsers(struct resultSet *userlist);
 // Verifies requested token and puts username in the username argument
 // Returns 0 if the token is verified
 // Returns 1 if the token is not verified
@@ -107,25 +548,786 @@ int verifyToken(char *token, char *username);
 // Public API for searching through the book store
 // Returns -1 if the file does not open
 // Returns the number of books that matched
-int searchBooks(char *book, struct bookList *books);
+int searchBooks(char *book, struct resultSet *books);
+// Public API for ranked search, puts the k best matches in books, best first
+// Books are scored with weights, or SEARCH_WEIGHTS if weights is NULL, and equal scores keep catalog order
+// An empty query matches no book
+// Returns -1 if the file does not open
+// Returns the number of books returned, at most k
+int searchBooksRanked(char *book, int k, struct searchWeights *weights, struct resultSet *books);
+// Public API for typo tolerant search, puts the k closest matches in books, closest first
+// The query is split into case folded words and every word has to be within a few edits of a word of the book
+// Returns -1 if the file does not open
+// Returns the number of books returned, at most k
+int searchBooksFuzzy(char *query, int k, struct resultSet *books);
+// Public API for autocomplete, puts up to n distinct values of field (BOOK_FIELD_ID, BOOK_FIELD_TITLE or BOOK_FIELD_AUTHOR)
+// starting with prefix in completions, in alphabetical order ignoring case
+// Returns -1 if the file does not open
+// Returns the number of completions
+int completeBooks(int field, char *prefix, int n, struct resultSet *completions);
 // Public API for getting book info of the requested Issue No
+// Reads the current snapshot if the process holds one, otherwise the one record through the catalog hash index
 // Returns -1 if the file does not open
 // Returns 0 if the book is found
 // Returns 1 if the book is NOT found
 int getBookByID(char *id, struct bookClass *book);
 // Authenticated API for getting wish list info
-int getWishListInfo(char *token, struct bookInfoList *books);
+int getWishListInfo(char *token, struct resultSet *books);
 // Authenticated API for returning the info of the book issued
-int getIssuedBookInfo(char *token, struct bookInfoList *books);
+int getIssuedBookInfo(char *token, struct resultSet *books);
+// Public API for library wide overdue reporting, puts every loan due before time in loans, earliest due first
+// Only the heap entries due before time are read, so the cost follows the number of overdue loans and not of all loans
+// Returns -1 if a file does not open
+// Returns the number of overdue loans
+int viewOverdueLoans(time_t time, struct resultSet *loans);
+// Authenticated API for the notifications a user has not seen yet, oldest first, which are then marked as seen
+// Only the unread tail of the inbox is read
+// Returns -1 if the inbox does not open
+// Returns the number of notifications
+int getNotifications(char *token, struct resultSet *notes);
+// Writes a due soon notification for every loan that came within DUE_SOON_PERIOD of its due time since the last sweep,
+// and an overdue notification for every loan that passed it, so that every event is written once
+// Does nothing if another sweep is running or the last one ran less than SWEEP_INTERVAL before time
+// Returns -1 if a file does not open
+// Returns the number of notifications written
+int sweepNotifications(time_t time);
 // Authenticated API to issue a book
+// Returns -1 if a file does not open
+// Returns 0 if the book is issued
+// Returns 1 if the book is NOT found or every copy is issued
+// Returns 2 if the user already holds the book
+// Returns -2 if the loan was logged but could not be applied, recoverJournal will finish it
 int issueBook(char *token, struct bookInfo book, time_t time);
+// Authenticated API to issue n books at once, checking the whole batch before anything is written
+// Puts the status of every id in statuses: 0 if issued, 1 if not available, 2 if already issued or repeated, -1 if it failed
+// Returns -1 if a file does not open, nothing was issued
+// Returns -2 if the loans were logged but could not be applied, recoverJournal will finish them
+// Returns the number of books issued
+int issueBooks(char *token, char **ids, int n, time_t time, int *statuses);
 // Returns a issued book
 // Returns -1 if file does not open
 // Returns 0 if book successfully returned
 // Returns 1 if the book NOT found
 int returnBook(char *token, char *id);
-int viewBooksFromMarket(struct bookVendorList *books);
+// Returns n books, the book ids[i] held by the user tokens[i], grouped so that each file is rewritten once
+// Puts the status of every pair in statuses: 0 if returned, 1 if the book is not issued to the user, -1 if it failed
+// Returns -1 if a file does not open, nothing was returned
+// Returns -2 if the returns were logged but could not be applied, recoverJournal will finish them
+// Returns the number of books returned
+int returnBooks(char **tokens, char **ids, int n, int *statuses);
+// Buys n books from the market in one pass, quantities[i] copies of the market book ids[i] under the Issue No issueIDs[i]
+// The market is read once and every Issue No is checked against the catalog and the rest of the batch in memory
+// Puts the status of every order in statuses: 1 if bought, 0 if the Issue No is taken or repeated, 2 if not in the market, -1 if it failed
+// Returns -1 if a file does not open, nothing was bought
+// Returns -2 if the purchases were logged but could not be applied, recoverJournal will finish them
+// Returns the number of books bought
+int importBooksFromMarket(char **ids, char **issueIDs, int *quantities, int n, int *statuses);
+int viewBooksFromMarket(struct resultSet *books);
+// Public API for listing the book store a page at a time, starting at book number offset
+// Returns -1 if the file does not open
+// Returns the number of books in the page, less than limit on the last page
+int viewBookPage(int offset, int limit, struct resultSet *books);
+// Public API for getting a book of the market through the market index, the first listing winning if an id repeats
+// Returns -1 if the file does not open
+// Returns 0 if the book is found
+// Returns 1 if the book is NOT found
 int viewBookFromMarketByID(char *id, struct bookVendors *book);
+// Converts the text book store Server/bookStore.txt into the binary catalog and its hash index
+// Books with an id, title or author too long for their record are reported on stderr and left out
+// Returns -1 if a file does not open
+// Returns the number of books converted
+int convertBookStore();
+// ##########################################################################################################################
+
+/* Mock Server Storage */
+
+#define CATALOG_FILE "Server/bookStore.dat"
+#define CATALOG_INDEX_FILE "Server/bookStore.idx"
+#define CATALOG_MAGIC "LIBCAT01"
+#define INDEX_MAGIC "LIBIDX01"
+#define INDEX_HEADER_SIZE 4096
+#define ISSUED_DIR "Server/issued"
+#define TOKEN_INDEX_FILE "Server/tokenStore.idx"
+#define USERNAME_INDEX_FILE "Server/usernames.idx"
+#define ADMIN_INDEX_FILE "Server/adminTokenStore.idx"
+#define MARKET_INDEX_FILE "Server/bookMarket.idx"
+#define JOURNAL_FILE "Server/journal.log"
+#define JOURNAL_SYNC_FILE "Server/journal.sync"
+#define JOURNAL_MAGIC 0x4c4f474a
+#define DUE_HEAP_FILE "Server/dueHeap.dat"
+#define DUE_HEAP_MAGIC "LIBDUE01"
+#define LOAN_PERIOD 1296000
+#define INBOX_DIR "Server/inbox"
+#define INBOX_MAGIC "LIBBOX01"
+#define SWEEP_FILE "Server/notify.sweep"
+#define DUE_SOON_PERIOD 259200
+#define SWEEP_INTERVAL 3600
+#define NOTIFY_DUE_SOON 1
+#define NOTIFY_OVERDUE 2
+#define DAEMON_SOCKET "Server/libraryman.sock"
+#define LOCK_FILE "Server/server.lock"
+#define LOCK_TOKEN_STORE 0
+#define LOCK_SHARDS 1
+#define LOCK_SHARD_SLOTS 4096
+#define DAEMON_MAGIC 0x4c49424d
+#define DAEMON_WORKERS 8
+#define DAEMON_MESSAGE_MAX (256 << 20)
+#define OP_VERIFY_CREDENTIALS 1
+#define OP_VERIFY_ADMIN 2
+#define OP_CREATE_TOKEN 3
+#define OP_DELETE_TOKEN 4
+#define OP_VIEW_USERS 5
+#define OP_SEARCH_USERS 6
+#define OP_VERIFY_TOKEN 7
+#define OP_SEARCH_BOOKS 8
+#define OP_SEARCH_RANKED 9
+#define OP_SEARCH_FUZZY 10
+#define OP_COMPLETE_BOOKS 11
+#define OP_GET_BOOK 12
+#define OP_WISH_LIST 13
+#define OP_ISSUED_BOOKS 14
+#define OP_OVERDUE_LOANS 15
+#define OP_NOTIFICATIONS 16
+#define OP_SWEEP 17
+#define OP_ISSUE_BOOK 18
+#define OP_ISSUE_BOOKS 19
+#define OP_RETURN_BOOK 20
+#define OP_RETURN_BOOKS 21
+#define OP_BUY_BOOK 22
+#define OP_IMPORT_BOOKS 23
+#define OP_MARKET 24
+#define OP_MARKET_BOOK 25
+#define OP_BOOK_PAGE 26
+#define JOURNAL_ISSUE 1
+#define JOURNAL_RETURN 2
+#define JOURNAL_PURCHASE 3
+#define JOURNAL_CHECKPOINT_SIZE (1 << 20)
+#define BOOK_QUANTITY_OFFSET offsetof(struct bookRecord, quantity)
+#define BOOK_ISSUED_OFFSET offsetof(struct bookRecord, issued)
+#define COMPACT_COUNT_MAX 0xffff
+#define BOOK_PAGE_SIZE 10
+#define BOOK_FIELD_ID 0
+#define BOOK_FIELD_TITLE 1
+#define BOOK_FIELD_AUTHOR 2
+#define SEARCH_TOP_K 20
+#define FUZZY_MAX_WORDS 8
+#define FUZZY_MAX_BOOK_WORDS 64
+#define FUZZY_CANDIDATES 512
+#define COMPLETION_SIZE 10
+#define ISSUE_BATCH_SIZE 16
+#define SNAPSHOT_CHUNK 256
+#define SNAPSHOT_READERS 64
+#define SNAPSHOT_TRIGRAMS 1
+#define SNAPSHOT_COLUMN 2
+#define SNAPSHOT_PREFIXES 4
+#define SNAPSHOT_ALL 7
+#define SEARCH_SHARDS 8
+#define IO_RING_ENTRIES 256
+#define IO_ARENA_SIZE (256 << 10)
+#define IO_THREADS 8
+#define IO_STREAM_DEPTH 4
+#define IO_STREAM_RECORDS 128
+#define IO_READ 1
+#define IO_WRITE 2
+#define IO_SYNC 3
+
+// Bumped by clearCompactCatalog, so that a version built from a replaced catalog never shares its text
+static int CATALOG_GENERATION;
+// Readers store the epoch they entered at in their slot and zero once they leave, writers free what they retired
+// before the oldest epoch still in a slot
+// Threads past SNAPSHOT_READERS share the last slot one at a time
+static atomic_ulong CATALOG_EPOCH = 1;
+static atomic_ulong READER_EPOCHS[SNAPSHOT_READERS + 1];
+static atomic_int READER_SLOTS;
+static _Thread_local int READER_SLOT = -1;
+static pthread_mutex_t SHARED_SLOT_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static struct retiredPiece *RETIRED;
+
+// A task to run once for every shard, queued for the search threads until every shard is taken
+// Only touched under SHARD_LOCK, except by the task itself
+struct shardJob
+{
+	void (*task)(void *arg, int shard);
+	void *arg;
+	int next;
+	int done;
+	struct shardJob *queued;
+};
+
+// The arguments of a search fanned out over the shards of a catalog version and what each shard found
+struct shardSearch
+{
+	struct catalogVersion *version;
+	char *query;
+	int qlen;
+	int k;
+	struct searchWeights *weights;
+	char (*words)[50];
+	int nwords;
+	unsigned int *keys;
+	int nkeys;
+	int needed;
+	unsigned short *shared;
+	struct rankedBook *candidates;
+	int ncandidates;
+	unsigned int *records[SEARCH_SHARDS];
+	struct rankedBook *hits[SEARCH_SHARDS];
+	int sizes[SEARCH_SHARDS];
+};
+
+// Search threads, one less than the CPUs up to SEARCH_SHARDS, as the thread fanning out works on its own search too
+static int SEARCH_THREADS;
+static pthread_once_t SEARCH_THREADS_ONCE = PTHREAD_ONCE_INIT;
+static pthread_mutex_t SHARD_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t SHARD_QUEUED = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t SHARD_DONE = PTHREAD_COND_INITIALIZER;
+static struct shardJob *SHARD_QUEUE;
+
+// A read, write or fdatasync handed to the I/O backend, offset -1 reading or writing at the file position
+// A linked request holds back the next one of its batch until it succeeded, a failed link cancels the rest of the chain
+struct ioRequest
+{
+	int op;
+	int fd;
+	void *buffer;
+	unsigned int size;
+	off_t offset;
+	int linked;
+	ssize_t result;
+	struct ioBatch *batch;
+	struct ioRequest *queued;
+};
+
+// Requests put in flight together, finished once pending drops to 0
+struct ioBatch
+{
+	struct ioRequest *requests;
+	int count;
+	int submitted;
+	int pending;
+	int failed;
+};
+
+// The io_uring of one thread, fd being -1 if it has none, and the arena it registered as its fixed buffer
+// Reads and writes into the arena skip pinning the pages on every request, builds without io_uring only keep the arena
+struct ioRing
+{
+	int fd;
+	char *arena;
+	unsigned int arenaUsed;
+#ifdef LIBRARYMAN_IO_URING
+	unsigned int inFlight;
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int *sqMask;
+	unsigned int *sqArray;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int *cqMask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sqMap;
+	void *cqMap;
+	size_t sqSize;
+	size_t cqSize;
+	size_t sqeSize;
+	int registered;
+#endif
+};
+
+// Reads the records of a catalog from first up to last IO_STREAM_RECORDS at a time, keeping IO_STREAM_DEPTH reads in
+// flight ahead of the caller
+struct recordStream
+{
+	int fd;
+	int next;
+	int last;
+	int head;
+	int inFlight;
+	int arena;
+	struct bookRecord *buffer;
+	struct ioRequest requests[IO_STREAM_DEPTH];
+	struct ioBatch batches[IO_STREAM_DEPTH];
+};
+
+// 1 if this kernel runs io_uring, checked once, 0 sends every batch to the I/O threads and their pread and pwrite
+static int IO_URING;
+static pthread_once_t IO_ONCE = PTHREAD_ONCE_INIT;
+static pthread_key_t IO_RING_KEY;
+static _Thread_local struct ioRing *IO_RING;
+static int IO_THREAD_COUNT;
+static pthread_once_t IO_THREADS_ONCE = PTHREAD_ONCE_INIT;
+static pthread_mutex_t IO_LOCK = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t IO_QUEUED = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t IO_DONE = PTHREAD_COND_INITIALIZER;
+static struct ioRequest *IO_QUEUE;
+static struct ioRequest *IO_QUEUE_TAIL;
+
+// Opens the binary catalog and its index, converting the text book store on first use
+// Returns -1 if the catalog can not be opened
+// Returns 0 if the catalog is open
+int openCatalog(struct catalog *cat);
+void closeCatalog(struct catalog *cat);
+// Reads the record number record into rec
+// Returns -1 if the read fails
+// Returns 0 if the record is read
+int readBookRecord(struct catalog *cat, int record, struct bookRecord *rec);
+int writeBookRecord(struct catalog *cat, int record, struct bookRecord *rec);
+// Overwrites the counter at field (BOOK_QUANTITY_OFFSET or BOOK_ISSUED_OFFSET) of a record with one positioned write
+// Returns -1 if the write fails
+// Returns 0 if the counter is written
+int writeBookCounter(struct catalog *cat, int record, size_t field, int value);
+// Overwrites the counter at field of n records with one batch of writes
+// Returns -1 if a write fails
+int writeBookCounters(struct catalog *cat, int *records, int n, size_t field, int *values);
+// Looks up a book through the hash index and puts its record number in record if it is not NULL
+// Returns -1 if the read fails
+// Returns 0 if the book is found
+// Returns 1 if the book is NOT found
+int findBookRecord(struct catalog *cat, char *id, struct bookRecord *rec, int *record);
+// Looks up n books at once, every round reading the index windows and then the candidate records of all of them in one batch
+// Puts the record number of each book in records and 0 in its ret if found, 1 if NOT found, -1 if a read failed
+// Returns -1 if a read failed
+int findBookRecords(struct catalog *cat, char **ids, int n, int *records, int *rets);
+// Reads n records with one batch
+// Returns -1 if a read fails
+int readBookRecords(struct catalog *cat, int *records, int n, struct bookRecord *recs);
+// Appends a new record to the catalog and indexes it
+// Returns -1 if the write fails
+// Returns 0 if the record is appended
+int appendBookRecord(struct catalog *cat, struct bookRecord *rec);
+// Appends n new records to the catalog with a single write and indexes them
+// Callers hold the write lock on the header, which also keeps the index to one writer
+// Returns -1 if the write fails
+// Returns 0 if the records are appended
+int appendBookRecords(struct catalog *cat, struct bookRecord *recs, int n);
+// Sets the issued count of a book
+// Returns -1 if the catalog does not open
+// Returns 0 if the count is updated
+// Returns 1 if the book is NOT found
+int setIssuedCount(char *id, int issued);
+// Rebuilds the catalog index from the records
+int rebuildCatalogIndex(struct catalog *cat);
+// Opens a cursor positioned at record number offset
+// Returns -1 if the catalog does not open
+// Returns 0 if the cursor is open
+int openBookCursor(struct bookCursor *cursor, int offset);
+// Reads the book under the cursor into book and moves past it
+// Returns -1 if the read fails
+// Returns 0 if a book is read
+// Returns 1 if there are no more books
+int nextBook(struct bookCursor *cursor, struct bookClass *book);
+void closeBookCursor(struct bookCursor *cursor);
+void openRecordStream(struct recordStream *stream, struct catalog *cat, int first, int last);
+// Points recs at the next records of the stream
+// Returns -1 if a read fails
+// Returns the number of records, 0 once the stream is through
+int nextRecords(struct recordStream *stream, struct bookRecord **recs);
+// Waits for the reads still in flight
+void closeRecordStream(struct recordStream *stream);
+// Writes the loan into the issued books of a user
+int addIssuedBook(char *token, struct bookInfo book, time_t time);
+// Writes n loans into the issued books of a user with a single append
+int addIssuedBooks(char *token, struct bookInfo *books, int n, time_t time);
+// Removes the loan from the issued books of a user
+// Returns 0 if the loan was removed
+// Returns 1 if the loan was NOT found
+int removeIssuedBook(char *token, char *id);
+// Removes one loan for each of n ids from the issued books of a user in a single rewrite
+// Returns -1 if the shard can not be rewritten
+// Returns the number of loans removed
+int removeIssuedBooks(char *token, char **ids, int n);
+// Orders return pairs by token, then by id, then by position in the batch
+int compareReturn(const void *a, const void *b);
+// Puts the path of the shard holding the issued books of a user in path
+// Splits Server/issuedBooks.txt into per user shards on first use
+// Returns -1 if the token is not valid or the shards can not be created
+// Returns 0 if the path is set
+int issuedShardPath(char *token, char *path);
+// Moves every user block of Server/issuedBooks.txt into its own file under Server/issued
+// Returns -1 if the shards can not be created
+// Returns 0 if the shards exist
+int splitIssuedBooks();
+// Removes a directory of shards left behind by a split that failed or lost the race
+void removeShardDirectory(char *path);
+// Checks whether a user holds a book
+// Returns -1 if the file does not open
+// Returns 0 if the book is issued to the user
+// Returns 1 if the book is NOT issued to the user
+int findIssuedBook(char *token, char *id);
+// Opens the due heap holding a flock of the given operation and reads its header
+// Returns -1 if the heap does not open, or is missing or dirty and has to be rebuilt first
+// Returns the file descriptor of the heap
+int openDueHeap(int operation, struct dueHeapHeader *header);
+void closeDueHeap(int fd);
+// Counts an issue as pending on the heap before its loans go into the shard
+// Returns -1 if the heap is missing or dirty, its rebuild will find the loans in the shard
+// Returns the generation of the heap the issue was counted on
+int beginDueLoans();
+// Pushes the due times of n loans made at time onto the heap once they are in the shard, and settles the
+// issue counted by beginDueLoans unless the heap was rebuilt since
+// Returns -1 if the heap can not be written
+// Returns 0 if the loans are pushed, or left to the rebuild of a missing or dirty heap
+int endDueLoans(int generation, char *token, struct bookInfo *books, int n, time_t time);
+// Pushes the due times of n loans made at time onto the heap open at fd whose header is in heap, and writes back the header
+// Returns -1 if the heap can not be written
+// Returns 0 if the loans are pushed
+int pushDueLoans(int fd, struct dueHeapHeader *heap, char *token, struct bookInfo *books, int n, time_t time);
+// Rewrites the heap open at fd from the loans in the shards, dropping every returned loan
+// Returns -1 if a file does not open
+// Returns the number of loans in the heap
+int buildDueHeap(int fd);
+// Rebuilds the heap under an exclusive lock when it is missing or dirty, when force is set, or when pending is set
+// and issues are still pending, which only the journal recovery can tell apart from issues in flight
+// Returns -1 if the heap can not be built
+// Returns 0 if the heap is up to date
+int rebuildDueHeap(int force, int pending);
+// Puts the path of the inbox of a user in path, creating the inbox directory on first use
+// Returns -1 if the token is not valid or the directory can not be created
+// Returns 0 if the path is set
+int inboxPath(char *token, char *path);
+// Appends n notifications to the inbox of a user with one write, dropping the notifications already seen once they pile up
+// Returns -1 if the inbox can not be written
+// Returns 0 if the notifications are added
+int addNotifications(char *token, struct notification *notes, int n);
+// Removes the unread notifications about any of n ids from the inbox of a user, for loans that were returned
+// Returns -1 if the inbox can not be rewritten
+// Returns the number of notifications removed
+int dropNotifications(char *token, char **ids, int n);
+// Orders loans by token, then by due time
+int compareLoanToken(const void *a, const void *b);
+// Puts every loan still held that is due at or after from and before to in loans, earliest due first
+// Returns -1 if a file does not open
+// Returns the number of loans, loans then points to an array the caller frees
+int findDueLoans(time_t from, time_t to, struct loanList **loans);
+// Opens LOCK_FILE, whose bytes stand for the Server files that are replaced by renames and so can not carry locks themselves
+// Returns -1 if the file does not open
+// Returns a new open file description, closing it releases every lock taken through it
+int openLockFile();
+// Locks length bytes at start of fd for reading (F_RDLCK) or writing (F_WRLCK), waiting for conflicting holders
+// The lock belongs to the open file description and not to the process, so it also keeps out the other threads of the daemon
+// and is not dropped when some other descriptor of the same file is closed
+// Systems without open file description locks take a flock on the whole file instead, which belongs to the open file
+// description as well but makes every range of the file one lock
+// Returns -1 if the lock can not be taken
+// Returns 0 if the lock is held
+int lockRange(int fd, short type, off_t start, off_t length);
+void unlockRange(int fd, off_t start, off_t length);
+// Locks record number record of the catalog open at cat, record -1 being the header which appenders lock
+// Returns -1 if the lock can not be taken
+// Returns 0 if the lock is held
+int lockBookRecord(struct catalog *cat, int record, short type);
+// Write locks n records of the catalog in record order, so that two batches sharing books never wait for each other
+// Returns -1 if a lock can not be taken
+// Returns 0 if every lock is held
+int lockBookRecords(struct catalog *cat, int *records, int n);
+// Returns the byte of LOCK_FILE that stands for the shard of a user
+off_t shardLock(char *token);
+// Write locks the shards of n users through fd in the order of their bytes in LOCK_FILE
+// Returns -1 if a lock can not be taken
+// Returns 0 if every lock is held
+int lockShards(int fd, char **tokens, int n);
+// Orders ints ascending
+int compareInt(const void *a, const void *b);
+// Reads the loans of a user from the shard without locking it, for callers that already hold the lock of the shard
+// or can do with a shard that is being replaced
+// Returns -1 if the file does not open
+// Returns the number of loans
+int readIssuedBooks(char *token, struct resultSet *books);
+// Orders due entries by due time, then by token and id
+int compareDueEntry(const void *a, const void *b);
+// Orders due entries by token, then by id and issue time
+int compareDueLoan(const void *a, const void *b);
+// Orders overdue loans by due time, then by token and id
+int compareOverdueLoan(const void *a, const void *b);
+// Opens the journal for an operation, holding off checkpoints until endJournal
+// Returns -1 if the journal does not open
+int beginJournal(struct journal *log);
+// Appends an entry and returns once it is durable
+// Concurrent callers share fsyncs: whoever takes the commit lock syncs every entry appended so far
+// Returns -1 if the entry could not be made durable
+int logJournal(struct journal *log, struct journalEntry *entry);
+// Appends n entries with one write and returns once all of them are durable
+int logJournalEntries(struct journal *log, struct journalEntry *entries, int n);
+// Releases the journal and checkpoints it once it grows past JOURNAL_CHECKPOINT_SIZE
+void endJournal(struct journal *log);
+// Logs an entry and applies it to the Server files
+// Returns -1 if the entry could not be logged, nothing was changed
+// Returns -2 if the entry was logged but could not be applied, recoverJournal will finish it
+// Returns 0 if the entry is applied
+int runJournalEntry(struct journalEntry *entry);
+// Applies a logged entry, skipping the parts that are already on disk
+int applyJournalEntry(struct journalEntry *entry);
+// Syncs the Server files and empties the journal
+int checkpointJournal();
+int syncFile(char *path);
+// Replays the journal after a crash
+// Returns -1 if the journal could not be replayed
+// Returns the number of entries replayed
+int recoverJournal();
+// Brings the trigram index up to date with the records appended to the catalog since the last call
+// Returns -1 if the catalog could not be read
+// Returns 0 if the index is up to date
+int updateTrigramIndex(struct catalog *cat);
+void indexBookTrigrams(int record, struct bookRecord *rec);
+void indexTextTrigrams(int record, int shard, char *text);
+unsigned int trigramKey(char *s);
+// Returns the shard of a book, from the hash of its Issue No
+int bookShard(char *id);
+// Returns the key of the posting list of a trigram in one shard, every shard keeping its own lists in the index
+unsigned int shardKey(unsigned int key, int shard);
+struct postingList *findPostingList(struct trigramIndex *index, unsigned int key, int create);
+int comparePostingSize(const void *a, const void *b);
+// Puts the record numbers of a shard that contain every trigram of query in records, ascending
+// Returns -1 if query is shorter than a trigram
+// Returns the number of candidates
+int trigramCandidates(struct trigramIndex *index, int shard, char *query, unsigned int **records);
+// Puts the record numbers of a shard of a version that may contain query in records, ascending, for the caller to verify
+// Queries shorter than a trigram scan an even slice of the text column per shard instead
+// Returns the number of candidates
+int bookCandidates(struct catalogVersion *version, int shard, char *query, unsigned int **records);
+// Runs task once for every shard, spread over the search threads and the caller, and returns once all of them finished
+void runShards(void (*task)(void *arg, int shard), void *arg);
+void startSearchThreads();
+void *searchThread(void *arg);
+// Takes the next shard of a queued job, unqueueing the job with its last shard, under SHARD_LOCK
+int takeShard(struct shardJob *job);
+// Shard tasks of searchBooks, searchBooksRanked and searchBooksFuzzy
+void matchShard(void *arg, int shard);
+void rankShard(void *arg, int shard);
+void fuzzyShard(void *arg, int shard);
+void distanceShard(void *arg, int shard);
+// Merges the best k hits of every shard into heap, best first, and frees them
+// Returns the number of hits in heap
+int mergeShardHits(struct shardSearch *search, int k, struct rankedBook **heap);
+// Scores a row of the compact catalog, its strings being in pool, against query, 0 if the query is empty or in none of its fields
+int scoreBook(char *pool, struct compactBook *row, char *query, int qlen, struct searchWeights *weights);
+// Returns 1 if a ranks below b
+int rankedBelow(struct rankedBook *a, struct rankedBook *b);
+void siftRankedDown(struct rankedBook *heap, int size, int i);
+// Offers hit to a min heap of the best k so far, whose root is the weakest kept
+void keepRanked(struct rankedBook *heap, int *size, int k, struct rankedBook hit);
+// Sorts a heap made by keepRanked best first
+void sortRanked(struct rankedBook *heap, int size);
+// Splits text into at most max lower case words of letters and digits
+// Returns the number of words
+int splitWords(char *text, char words[][50], int max);
+// Returns the number of edits a query word of length len may be away from a match
+int allowedEdits(int len);
+// Returns the edit distance between a and b counting a swap of neighbouring letters as one edit,
+// or bound + 1 once it is known to exceed bound
+int editDistance(char *a, int alen, char *b, int blen, int bound);
+// Puts up to limit records sharing the most trigrams with the words of a search in candidates, scored by the number shared
+// Returns the number of candidates
+int fuzzyCandidates(struct shardSearch *search, int limit, struct rankedBook **candidates);
+// Returns the total number of edits needed to find every word in a book, or -1 if a word is too far off
+// Puts the number of words of the book that matched no query word in unmatched
+int fuzzyDistance(char *pool, struct compactBook *row, char words[][50], int nwords, int *unmatched);
+// Adds the records appended to the compact catalog since the last call to the prefix index of field
+void updatePrefixIndex(int field);
+int comparePrefixEntry(const void *a, const void *b);
+// Returns the position of the first entry of index not sorting before prefix
+int findPrefixStart(char *pool, struct prefixIndex *index, char *prefix);
+// Brings the compact catalog up to date: appended records are added and, when the catalog was
+// written by someone else since the last call, the counts of every record are reloaded
+// Returns -1 if the catalog could not be read
+// Returns 0 if the compact catalog is current
+int updateCompactCatalog(struct catalog *cat);
+void addCompactBook(struct bookRecord *rec);
+void setCompactCounts(struct compactBook *book, int quantity, int issued);
+// Puts record number record of a version in book
+// Returns -1 if an overflowed count could not be read from the catalog
+// Returns 0 if the book is filled
+int readCompactBook(struct catalogVersion *version, int record, struct bookClass *book);
+void clearCompactCatalog();
+// Enters the current epoch and returns the published catalog version, which stays valid until closeSnapshot
+// No lock is taken unless the catalog file changed since the version was published or the version lacks one of parts
+// (SNAPSHOT_TRIGRAMS, SNAPSHOT_COLUMN, SNAPSHOT_PREFIXES), the caller then refreshes it first
+// Returns NULL if the catalog could not be read, closeSnapshot is then not called
+struct catalogVersion *openSnapshot(int parts);
+void closeSnapshot();
+// Returns the row of record number record of a version
+struct compactBook *snapshotBook(struct catalogVersion *version, int record);
+// Returns the record number of the book with Issue No id in a version, or -1
+int findSnapshotBook(struct catalogVersion *version, char *id);
+// Brings the compact catalog, parts and the parts the published version already has up to date with the catalog file
+// and publishes them as a new version
+// Returns -1 if the catalog could not be read
+// Returns 0 if the published version is current
+int refreshCatalog(int parts);
+// Publishes the compact catalog as a new version, sharing every chunk and the text of the old version that did not change
+// Callers hold CATALOG_LOCK
+void publishCatalogVersion(int parts);
+// Copies the string pool and parts of the indexes over it for a new version
+struct catalogText *buildCatalogText(int parts);
+void freeCatalogText(void *data);
+// Hands a piece of an old version to free once no reader entered at or before epoch is left
+// Callers hold CATALOG_LOCK
+void retireCatalogPiece(unsigned long epoch, void *data, void (*release)(void *data));
+void reclaimCatalogPieces();
+// Returns the offset of a copy of s in the pool, reusing an equal string already interned
+unsigned int internString(struct stringPool *pool, char *s);
+// Returns the offset of a new copy of s in the pool, for strings that never repeat
+unsigned int appendString(struct stringPool *pool, char *s);
+// Appends an entry made of n fields to a text column
+void appendColumnEntry(struct textColumn *column, char **fields, int n);
+void clearTextColumn(struct textColumn *column);
+// Brings the book text column up to date with the catalog
+// Returns -1 if the catalog could not be read
+int updateBookColumn(struct catalog *cat);
+// Reloads the username column when Server/tokenStore.txt has changed, callers hold USERTEXT_LOCK
+// Returns -1 if the file does not open
+int updateUserColumn();
+// Puts the numbers of the entries containing query in entries, ascending
+// Returns the number of matching entries
+int scanTextColumn(struct textColumn *column, char *query, unsigned int **entries);
+// Same for the entries from first up to last only
+int scanTextColumnRange(struct textColumn *column, int first, int last, char *query, unsigned int **entries);
+// Returns the position of the first occurrence of needle in data at or after from, or -1
+// Picks the widest kernel the CPU supports on first use
+long findSubstring(char *data, long size, char *needle, int nlen, long from);
+void pickSubstringKernel();
+long findSubstringScalar(char *data, long size, char *needle, int nlen, long from);
+long findSubstringSSE2(char *data, long size, char *needle, int nlen, long from);
+long findSubstringAVX2(char *data, long size, char *needle, int nlen, long from);
+// Identifies the current contents of a file from its size and modification time
+long fileStamp(int fd);
+long pathStamp(char *path);
+// Indexes every block of blockLines lines in a text file by the hash of its line keyLine, the value being the block offset
+int buildTextIndex(char *textPath, char *indexPath, int blockLines, int keyLine);
+// Opens the index of a text file, rebuilding it first if the text file changed since the index was written
+// Returns -1 if the index can not be opened
+// Returns 0 if the index is open and current
+int openTextIndex(char *textPath, char *indexPath, int blockLines, int keyLine, struct hashIndex *index);
+// Finds the block of a text file whose line keyLine equals key and reads its blockLines lines into lines
+// Returns -1 if a file does not open
+// Returns 0 if the block is found
+// Returns 1 if the block is NOT found
+int findTextBlock(char *textPath, char *indexPath, int blockLines, int keyLine, char *key, char lines[][50]);
+// Opens a persistent hash index
+// Returns -1 if the index is missing or corrupted
+// Returns 0 if the index is open
+int openHashIndex(char *path, struct hashIndex *index);
+void closeHashIndex(struct hashIndex *index);
+// Writes a new index at path from n (hash, value) pairs, replacing any existing index
+int buildHashIndex(char *path, unsigned int *hashes, unsigned int *values, unsigned int n, long stamp);
+// Rewrites an index with twice the room its entries and n more (hash, value) pairs need, merging those pairs in
+// Returns -1 if the index can not be rewritten
+int growHashIndex(struct hashIndex *index, unsigned int *hashes, unsigned int *values, unsigned int n);
+int insertHashIndex(struct hashIndex *index, unsigned int hash, unsigned int value);
+// Inserts n (hash, value) pairs, rewriting the index once instead of probing it pair by pair when the batch is large
+// Returns -1 if the index can not be written
+// Returns 0 if the pairs are inserted
+int insertHashIndexEntries(struct hashIndex *index, unsigned int *hashes, unsigned int *values, unsigned int n);
+void startHashProbe(struct hashIndex *index, unsigned int hash, struct hashProbe *probe);
+// Walks the probe sequence through the slots already in its window
+// Returns 0 if a candidate is found
+// Returns 1 if there are no more candidates
+// Returns 2 if the probe needs its next window read first
+int stepHashProbe(struct hashIndex *index, struct hashProbe *probe, unsigned int *value);
+// Fills request with the read of the next window of a probe
+void hashWindowRequest(struct hashIndex *index, struct hashProbe *probe, struct ioRequest *request);
+// Walks the probe sequence and puts the next value stored under the probed hash in value
+// Returns -1 if the read fails
+// Returns 0 if a candidate is found
+// Returns 1 if there are no more candidates
+int probeHashIndex(struct hashIndex *index, struct hashProbe *probe, unsigned int *value);
+// Puts the requests of a batch in flight, on the io_uring of the calling thread or else the I/O threads, and returns
+// Requests that do not fit in the ring yet go in as finishIO reaps room for them
+void startIO(struct ioBatch *batch, struct ioRequest *requests, int n);
+// Waits for every request of a batch
+// Returns -1 if a request failed or came up short
+// Returns 0 if every request completed in full
+int finishIO(struct ioBatch *batch);
+// Runs n requests as one batch and waits for them
+int runIO(struct ioRequest *requests, int n);
+// Carves size bytes off the arena of the calling thread
+// Returns NULL if the arena is full, callers then bring their own memory
+void *reserveIOBuffer(unsigned int size);
+// Gives back an arena buffer and everything reserved after it
+void releaseIOBuffer(void *buffer);
+void setupIO();
+// Returns the ring of the calling thread, setting it up on first use
+struct ioRing *threadRing();
+// Returns -1 if the build or the kernel has no io_uring or the kernel turns it down
+int openIORing(struct ioRing *ring);
+void closeIORing(struct ioRing *ring);
+void freeThreadRing(void *ring);
+// Drops the ring and the I/O threads of the parent in a forked child, which sets up its own on first use
+void forgetIO();
+// Pushes the chains of a batch that fit in the ring and enters them
+void submitRing(struct ioRing *ring, struct ioBatch *batch);
+// Reaps the completions posted so far, first waiting for one if wait is set
+void reapRing(struct ioRing *ring, int wait);
+void completeRequest(struct ioRequest *request, ssize_t result);
+// Queues every chain of a batch for the I/O threads, running them on the caller if there are none
+void queueIO(struct ioBatch *batch);
+void startIOThreads();
+void *ioThread(void *arg);
+// Runs a chain of linked requests with pread, pwrite and fdatasync
+// Returns the number of requests in the chain
+int runChain(struct ioRequest *chain);
+// Returns the number of requests in the chain starting at request first of a batch
+int chainLength(struct ioBatch *batch, int first);
+// ##########################################################################################################################
+
+/* Mock Server Daemon */
+
+// A request is a requestHeader followed by length bytes of arguments, the reply a replyHeader followed by its results
+// Arguments and results are packed back to back: ints and longs as they are, strings and buffers after their length
+
+// Starts an empty message
+void initMessage(struct message *msg);
+void freeMessage(struct message *msg);
+void putInt(struct message *msg, int value);
+void putLong(struct message *msg, long value);
+void putString(struct message *msg, char *s);
+void putBytes(struct message *msg, void *data, unsigned int size);
+// Packs every node of a result set, leaving out the next pointers
+void putResults(struct message *msg, struct resultSet *results, unsigned int nodeSize);
+// The readers return zeroes once the message runs out and mark it failed
+int getInt(struct message *msg);
+long getLong(struct message *msg);
+// Copies a string into s, cutting it to size - 1 characters
+void getString(struct message *msg, char *s, int size);
+void getBytes(struct message *msg, void *data, unsigned int size);
+// Appends the nodes packed by putResults to a result set
+// Returns the number of nodes appended
+int getResults(struct message *msg, struct resultSet *results);
+// Reads or writes exactly size bytes on a socket
+// Returns -1 if the connection fails first
+// Returns 0 if every byte went through
+int readFully(int fd, void *data, size_t size);
+int writeFully(int fd, void *data, size_t size);
+// Connects to DAEMON_SOCKET
+// Returns -1 if nobody is listening
+// Returns the connected socket otherwise
+int connectDaemon();
+// Sends a request to the daemon and replaces the arguments in msg with the results
+// Returns -1 if the daemon can not be reached, the caller then runs the call itself
+// Returns 0 if the request was delivered, the return value of the call is put in ret
+int callDaemon(int op, struct message *msg, int *ret);
+// Forwards a Server API call to the daemon if this process is its client, packing the arguments and unpacking the results
+// as format says: i an int, l a long, s a string, b a buffer and its size_t size, v an array of strings and their count,
+// then after a > the results: r a result set, s a string buffer and its int size, b a buffer and its size_t size
+// Returns 1 if the daemon carried out the call, its return value is put in ret
+// Returns 0 if the call has to run in this process
+int forwardCall(int op, int *ret, char *format, ...);
+// Returns 1 if a daemon is listening on DAEMON_SOCKET, 0 otherwise
+int daemonRunning();
+// Loads the catalog and the username column once and serves the Server APIs on DAEMON_SOCKET with DAEMON_WORKERS threads
+// Loans, wish lists, the market and the token store are read from their files on every call, as CLIs that
+// started before the daemon still write them directly
+// Returns -1 if another daemon is running or the socket can not be set up, otherwise it never returns
+int runDaemon();
+// Accepts connections on the listening socket and serves one request on each
+void *daemonWorker(void *arg);
+// Runs the notification sweep for the whole library, looking every minute whether SWEEP_INTERVAL has passed
+void *daemonSweeper(void *arg);
+void serveConnection(int fd);
+// Unpacks the arguments of a request, runs the Server API and packs its results into reply
+// Returns the return value of the Server API
+int dispatchRequest(int op, struct message *request, struct message *reply);
 // ##########################################################################################################################
 
 /* Mock Local Database Interactor*/
@@ -169,8 +1371,43 @@ int matchPassword(char *password, char *passwordc);
 int validateUsername(char *username);
 // Generates unique token for a username
 char *generateToken(char *username, int64 hash);
+// Validates a login token to be 1 to 20 characters from 0 to 9, a to z and A to Z
+// Returns 0 if the token is valid
+// Returns 1 if the token is not valid
+int validateToken(char *token);
 // Clears the previous screen and loads new screen
 void loadScreen(void (*screen)());
+// FNV-1a hash of a string, used by the persistent indexes
+unsigned int hashString(char *s);
+unsigned int hashBytes(void *data, size_t n);
+// Sets up an empty key set with room for capacity keys, it grows past that as needed
+void initKeySet(struct keySet *set, int capacity);
+// Adds key to the set unless an equal key is already in it
+// Returns the position of the equal key if there is one
+// Returns -1 if the key is added, at position count - 1
+int addKey(struct keySet *set, char *key);
+// Returns the position of key in the set, or -1 if it is not in it
+int findKey(struct keySet *set, char *key);
+void freeKeySet(struct keySet *set);
+// Removes the trailing newline left by fgets, if any
+void stripNewline(char *line);
+// Reads one line of fp into field without its newline, skipping whatever of it does not fit in size - 1 characters
+// Returns -1 at the end of the file
+// Returns 0 if the whole line is read
+// Returns 1 if the line was too long for field
+int readField(FILE *fp, char *field, int size);
+// Reads the next non empty line of input without its newline, skipping what an earlier scanf left behind
+// Returns -1 at the end of input
+// Returns 0 if a line is read
+int readLine(char *line, int size);
+void initResultSet(struct resultSet *results);
+// Allocates a zeroed node of size bytes from the arena of the set and links it at the end
+void *appendResult(struct resultSet *results, size_t size);
+// Iterates a result set: for (struct bookList *b = firstResult(&set); b != NULL; b = nextResult(b))
+void *firstResult(struct resultSet *results);
+void *nextResult(void *result);
+// Releases every node of a result set and leaves it empty for reuse
+void freeResultSet(struct resultSet *results);
 
 // ##########################################################################################################################
 
@@ -200,7 +1437,7 @@ char *getCurrentUser();
 // Returns 7 if the passwords does not match
 int registerUser(char *username, char *password, char *passwordc);
 // Returns the size of user and userlist
-int getAllUsers(struct users *userlist);
+int getAllUsers(struct resultSet *userlist);
 // Removes User
 int removeUser(char *username);
 int deleteMyAccount(char *username);
@@ -212,21 +1449,56 @@ int viewBookByID(char *id, struct bookClass *book);
 // Returns 1 if book not available
 // Returns 2 if book is already issued
 int issueBookByID(char *id);
-int getAllIssuedBooks(struct bookInfoList *books);
+// Issues several books in one go, putting the status of every id in statuses as issueBookByID would return it
+// Returns -1 if something went wrong
+// Returns -2 if the system crashed while issuing
+// Returns the number of books issued
+int issueBooksByID(char **ids, int n, int *statuses);
+// Returns the books left in the drop box, the book ids[i] by the user usernames[i]
+// Puts the status of every pair in statuses as returnIssued would return it
+// Returns -1 if something went wrong
+// Returns -2 if the system crashed while returning
+// Returns the number of books returned
+int returnDropBox(char **usernames, char **ids, int n, int *statuses);
+// Buys every row of a vendor shipment file, one row per line as the market id, the Issue No and the quantity
+// Puts the rows that were not bought in rejected with their status as importBooksFromMarket gives it,
+// or 3 if the line is malformed or the quantity is not valid
+// Returns -1 if something went wrong
+// Returns -2 if the system crashed while buying
+// Returns the number of books bought
+int importShipment(char *path, struct resultSet *rejected);
+int getAllIssuedBooks(struct resultSet *books);
+// Lists every loan of the library that is overdue now, with the username of the member holding it
+// Returns -1 if something went wrong
+// Returns the number of overdue loans
+int getOverdueLoans(struct resultSet *loans);
 // searches the book store for the given keyword
 // Returns -1 if something went wrong
 // Returns the number of books that matched
-int search(char *book, struct bookList *books);
-// Finds the books that are due
+int search(char *book, struct resultSet *books);
+// Searches the book store and returns the best k matches first
+int searchRanked(char *book, int k, struct resultSet *books);
+// Searches the book store allowing for typos and returns the closest k matches first
+int searchFuzzy(char *book, int k, struct resultSet *books);
+// Completes a prefix of an issue number, title or author
+int autocomplete(int field, char *prefix, int n, struct resultSet *completions);
+// Lists limit books of the book store starting at book number offset
+// Returns -1 if something went wrong
+// Returns the number of books listed
+int listBooks(int offset, int limit, struct resultSet *books);
+// Shows the unread notifications of the current user
 void dueBooks();
+// Runs the notification sweep once an issue or a return went through, if it is due
+// With a daemon running the daemon sweeps on its own timer instead
+void sweepAfterLoans();
 // Returns an issued book to the library
 // Decreases Issued Count by 1 if successfully returned
 // Returns -1 if something went wrong
 // Returns 0 if book successfully returned
 // Returns 1 if book is not issued
 int returnIssued(char *id);
-int searchUsers(char *suser, struct users *userlist);
-int getBooksFromMarket(struct bookVendorList *books);
+int searchUsers(char *suser, struct resultSet *userlist);
+int getBooksFromMarket(struct resultSet *books);
 int getBookFromMarketByID(char *id, struct bookVendors *book);
 int buyBookFromMarket(char *id, char *issueID, int quantity);
 // ##########################################################################################################################
@@ -250,11 +1522,28 @@ void searchUsersScreen();
 void allUsersScreen();
 void loginAsAdminUI();
 void bookMarketUI();
+void dropBoxUI();
+void shipmentUI();
+void overdueUI();
 void systemCrash();
-void createNotification(int size, struct bookInfoList *books);
+void createNotification(int size, struct notificationList *notes);
+// Prints the issue numbers, titles and authors starting with prefix
+void printCompletions(char *prefix);
+// Reads the Issue No of a book, listing completions whenever the input ends with *
+void readIssueNo(char *issue);
+// Reads up to ISSUE_BATCH_SIZE Issue Nos and issues them together
+// Returns -2 if the system crashed while issuing
+// Returns 0 otherwise
+int issueSeveralBooks();
+// Prints the page of the book store starting at book number offset
+// Returns -1 if something went wrong
+// Returns the number of books printed
+int printBookPage(int offset);
 // ##########################################################################################################################
 
-int main()
+// The benchmarks under bench/ include this file with LIBRARYMAN_NO_MAIN defined and bring their own main
+#ifndef LIBRARYMAN_NO_MAIN
+int main(int argc, char *argv[])
 {
 	// printf("%llu", generateSaltedHash("zzzzzyAzzzzzzzz", generateSalt("heelo")));
 	// printf("%d", validatePassword("he1Hlloooo"));
@@ -276,6 +1565,19 @@ int main()
 	// char* username = (char*) malloc(50 * sizeof(char));
 	// int ret = verifyToken("lJf9SpfllcpnqyAKqy", username);
 	// printf("%d\n%s", ret, username);
+	if (argc > 1 && strcmp(argv[1], "--daemon") == 0)
+	{
+		return runDaemon() == -1 ? 1 : 0;
+	}
+	// With a daemon running the Server APIs are calls to it and the daemon owns recovery
+	if (daemonRunning())
+	{
+		DAEMON_CLIENT = 1;
+	}
+	else
+	{
+		recoverJournal();
+	}
 	newScreen(splashScreen);
 	for (;;)
 	{
@@ -317,114 +1619,255 @@ int main()
 	// int ret = registerUser("aush", "abcDef123", "abcDef123");
 	// printf("%d\n", ret);
 }
+#endif
 
 // ##########################################################################################################################
 
 int buyBooksFromMarket(char *id, char *issueID, int quantity)
 {
+	int forwarded;
+	if (forwardCall(OP_BUY_BOOK, &forwarded, "ssi", id, issueID, quantity))
+	{
+		return forwarded;
+	}
+	// Appenders queue on the header of the catalog, so two buyers can not both find an Issue No free and both add it
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		return -1;
+	}
+	if (lockBookRecord(&cat, -1, F_WRLCK) != 0)
+	{
+		closeCatalog(&cat);
+		return -1;
+	}
 	struct bookClass *book = (struct bookClass *)malloc(sizeof(struct bookClass));
 	int ret = getBookByID(issueID, book);
+	free(book);
 	if (ret != 1)
 	{
+		closeCatalog(&cat);
 		return ret;
 	}
-	free(book);
 	struct bookVendors *vbook = (struct bookVendors *)malloc(sizeof(struct bookVendors));
 	int r = viewBookFromMarketByID(id, vbook);
 	if (r == -1)
 	{
+		free(vbook);
+		closeCatalog(&cat);
 		return -1;
 	}
 	else if (r == 1)
 	{
+		free(vbook);
+		closeCatalog(&cat);
 		return 2;
 	}
-	FILE *fp;
-	fp = fopen("Server/bookStore.txt", "a");
-	if (fp == NULL)
+	struct bookRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	strncpy(rec.id, issueID, sizeof(rec.id) - 1);
+	strncpy(rec.bookTitle, vbook->bookTitle, sizeof(rec.bookTitle) - 1);
+	strncpy(rec.author, vbook->author, sizeof(rec.author) - 1);
+	rec.quantity = quantity;
+	rec.issued = 0;
+	free(vbook);
+	struct journalEntry entry;
+	memset(&entry, 0, sizeof(entry));
+	entry.type = JOURNAL_PURCHASE;
+	entry.book = rec;
+	ret = runJournalEntry(&entry);
+	closeCatalog(&cat);
+	if (ret != 0)
 	{
 		return -1;
 	}
-	fputs(issueID, fp);
-	fputs("\n", fp);
-	fputs(vbook->bookTitle, fp);
-	fputs(vbook->author, fp);
-	char quan[50];
-	sprintf(quan, "%d", quantity);
-	fputs(quan, fp);
-	fputs("\n", fp);
-	fputs("0", fp);
-	free(vbook);
-	fclose(fp);
 	return 1;
 }
 
-int viewBookFromMarketByID(char *id, struct bookVendors *book)
+int importBooksFromMarket(char **ids, char **issueIDs, int *quantities, int n, int *statuses)
 {
-	FILE *fp;
-	fp = fopen("Server/bookMarket.txt", "r");
-	if (fp == NULL)
+	int forwarded;
+	if (forwardCall(OP_IMPORT_BOOKS, &forwarded, "ivvb>b", n, ids, n, issueIDs, n, quantities, sizeof(int) * n, statuses, sizeof(int) * n))
+	{
+		return forwarded;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		statuses[i] = -1;
+	}
+	struct resultSet market;
+	initResultSet(&market);
+	if (viewBooksFromMarket(&market) == -1)
 	{
+		freeResultSet(&market);
 		return -1;
 	}
-	char line[50];
-	int s = 0;
-	int linenum = 0;
-	while (fgets(line, 50, fp))
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		freeResultSet(&market);
+		return -1;
+	}
+	// The Issue Nos taken are only gathered once no other purchase can append
+	struct catalogVersion *version;
+	if (lockBookRecord(&cat, -1, F_WRLCK) != 0 || (version = openSnapshot(0)) == NULL)
+	{
+		closeCatalog(&cat);
+		freeResultSet(&market);
+		return -1;
+	}
+	// The first listing of a market id wins, as it does for viewBookFromMarketByID
+	struct keySet offered;
+	initKeySet(&offered, 64);
+	struct bookVendors **vendors = (struct bookVendors **)malloc((market.size > 0 ? market.size : 1) * sizeof(struct bookVendors *));
+	for (struct bookVendorList *list = firstResult(&market); list != NULL; list = nextResult(list))
 	{
-		if (linenum % 4 == 0)
+		stripNewline(list->book.id);
+		stripNewline(list->book.bookTitle);
+		stripNewline(list->book.author);
+		if (addKey(&offered, list->book.id) == -1)
 		{
-			line[strlen(line) - 1] = '\0';
-			if (strcmp(line, id) == 0)
-			{
-				strcpy(book->id, line);
-				fgets(line, 50, fp);
-				strcpy(book->bookTitle, line);
-				fgets(line, 50, fp);
-				strcpy(book->author, line);
-				fgets(line, 50, fp);
-				strcpy(book->vendor, line);
-				fclose(fp);
-				return 0;
-			}
+			vendors[offered.count - 1] = &list->book;
 		}
 	}
-	return 1;
-}
-
-int getBookFromMarketByID(char *id, struct bookVendors *book)
-{
-	return viewBookFromMarketByID(id, book);
-}
-
-int viewBooksFromMarket(struct bookVendorList *books)
-{
-	FILE *fp;
-	fp = fopen("Server/bookMarket.txt", "r");
-	if (fp == NULL)
+	// Issue Nos are checked as the catalog will store them, cut to fit the record
+	struct keySet taken;
+	initKeySet(&taken, version->count + n);
+	for (int i = 0; i < version->count; i++)
 	{
-		return -1;
+		addKey(&taken, version->text->pool + snapshotBook(version, i)->id);
 	}
-	char line[50];
-	int s = 0;
-	while (fgets(line, 50, fp))
+	closeSnapshot();
+	struct bookRecord *recs = (struct bookRecord *)calloc(n > 0 ? n : 1, sizeof(struct bookRecord));
+	int accepted = 0;
+	for (int i = 0; i < n; i++)
 	{
-		s++;
-		strcpy(books->book.id, line);
+		struct bookRecord *rec = &recs[accepted];
+		strncpy(rec->id, issueIDs[i], sizeof(rec->id) - 1);
+		int found = findKey(&offered, ids[i]);
+		if (findKey(&taken, rec->id) != -1)
+		{
+			statuses[i] = 0;
+		}
+		else if (found == -1)
+		{
+			statuses[i] = 2;
+		}
+		else
+		{
+			addKey(&taken, rec->id);
+			strncpy(rec->bookTitle, vendors[found]->bookTitle, sizeof(rec->bookTitle) - 1);
+			strncpy(rec->author, vendors[found]->author, sizeof(rec->author) - 1);
+			rec->quantity = quantities[i];
+			rec->issued = 0;
+			statuses[i] = 1;
+			accepted++;
+			continue;
+		}
+		memset(rec, 0, sizeof(*rec));
+	}
+	// The pool the catalog ids point into may move once the new books are added to it
+	freeKeySet(&taken);
+	freeKeySet(&offered);
+	free(vendors);
+	freeResultSet(&market);
+	int ret = accepted;
+	if (accepted > 0)
+	{
+		struct journalEntry *entries = (struct journalEntry *)calloc(accepted, sizeof(struct journalEntry));
+		for (int i = 0; i < accepted; i++)
+		{
+			entries[i].type = JOURNAL_PURCHASE;
+			entries[i].book = recs[i];
+		}
+		struct journal log;
+		if (beginJournal(&log) != 0)
+		{
+			ret = -1;
+		}
+		else
+		{
+			if (logJournalEntries(&log, entries, accepted) != 0)
+			{
+				ret = -1;
+			}
+			else if (appendBookRecords(&cat, recs, accepted) != 0)
+			{
+				ret = -2;
+			}
+			endJournal(&log);
+		}
+		free(entries);
+	}
+	if (ret == -1)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			statuses[i] = statuses[i] == 1 ? -1 : statuses[i];
+		}
+	}
+	free(recs);
+	closeCatalog(&cat);
+	return ret;
+}
+
+int viewBookFromMarketByID(char *id, struct bookVendors *book)
+{
+	int forwarded;
+	if (forwardCall(OP_MARKET_BOOK, &forwarded, "s>b", id, book, sizeof(struct bookVendors)))
+	{
+		return forwarded;
+	}
+	char lines[4][50];
+	int ret = findTextBlock("Server/bookMarket.txt", MARKET_INDEX_FILE, 4, 0, id, lines);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	strcpy(book->id, lines[0]);
+	strcpy(book->bookTitle, lines[1]);
+	strcpy(book->author, lines[2]);
+	strcpy(book->vendor, lines[3]);
+	return 0;
+}
+
+int getBookFromMarketByID(char *id, struct bookVendors *book)
+{
+	return viewBookFromMarketByID(id, book);
+}
+
+int viewBooksFromMarket(struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_MARKET, &forwarded, ">r", books))
+	{
+		return forwarded;
+	}
+	FILE *fp;
+	fp = fopen("Server/bookMarket.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	char line[50];
+	int s = 0;
+	while (fgets(line, 50, fp))
+	{
+		s++;
+		struct bookVendorList *book = appendResult(books, sizeof(struct bookVendorList));
+		strcpy(book->book.id, line);
 		fgets(line, 50, fp);
-		strcpy(books->book.bookTitle, line);
+		strcpy(book->book.bookTitle, line);
 		fgets(line, 50, fp);
-		strcpy(books->book.author, line);
+		strcpy(book->book.author, line);
 		fgets(line, 50, fp);
-		strcpy(books->book.vendor, line);
-		books->next = (struct bookVendorList *)malloc(sizeof(struct bookVendorList));
-		books = books->next;
+		strcpy(book->book.vendor, line);
 	}
 	fclose(fp);
 	return s;
 }
 
-int getBooksFromMarket(struct bookVendorList *books)
+int getBooksFromMarket(struct resultSet *books)
 {
 	return viewBooksFromMarket(books);
 }
@@ -436,22 +1879,21 @@ int viewBookByID(char *id, struct bookClass *book)
 
 void allUsersScreen()
 {
-	struct users *userlist = (struct users *)malloc(sizeof(struct users *));
-	struct users *last = userlist;
-	int size = getAllUsers(userlist);
+	struct resultSet userlist;
+	initResultSet(&userlist);
+	int size = getAllUsers(&userlist);
 	if (size == -1)
 	{
 		printf("Something went wrong\n");
 		sleep(1);
-		free(userlist);
+		freeResultSet(&userlist);
 		newScreen(homeScreenAdmin);
 		return;
 	}
 	printf("Following are all the registered memebers of the library\n");
-	for (int i = 0; i < size; i++)
+	for (struct users *last = firstResult(&userlist); last != NULL; last = nextResult(last))
 	{
 		printf("%s", last->username);
-		last = last->next;
 	}
 uopti:
 	printf("\nPress 1 to select a user\n");
@@ -464,20 +1906,21 @@ uopti:
 	{
 		printf("Enter the username exactly as it to select it\n");
 		scanf("%s", usern);
-		struct users *l = userlist;
-		for (int i = 0; i < size; i++)
+		for (struct users *l = firstResult(&userlist); l != NULL; l = nextResult(l))
 		{
-			l->username[strlen(l->username) - 1] = '\0';
+			stripNewline(l->username);
 			int cmp = strcmp(usern, l->username);
 			if (cmp == 0)
 			{
-				goto userse;
+				break;
 			}
-			l = l->next;
 		}
+		freeResultSet(&userlist);
+		goto userse;
 	}
 	else if (r == 2)
 	{
+		freeResultSet(&userlist);
 		newScreen(homeScreenAdmin);
 		return;
 	}
@@ -509,22 +1952,25 @@ userse:
 	}
 }
 
-int viewUsers(struct users *userlist)
+int viewUsers(struct resultSet *userlist)
 {
+	int forwarded;
+	if (forwardCall(OP_VIEW_USERS, &forwarded, ">r", userlist))
+	{
+		return forwarded;
+	}
 	FILE *fp;
 	fp = fopen("Server/tokenStore.txt", "r");
 	if (fp == NULL)
 	{
 		return -1;
 	}
-	struct users *user = userlist;
 	char line[20];
 	int size = 0;
 	while (fgets(line, 20, fp))
 	{
+		struct users *user = appendResult(userlist, sizeof(struct users));
 		strcpy(user->username, line);
-		user->next = (struct users *)malloc(sizeof(struct users));
-		user = user->next;
 		size++;
 		fgets(line, 20, fp);
 		fgets(line, 20, fp);
@@ -533,34 +1979,28 @@ int viewUsers(struct users *userlist)
 	return size;
 }
 
-int searchUsers(char *suser, struct users *userlist)
+int searchUsers(char *suser, struct resultSet *userlist)
 {
-	int ulen = strlen(suser);
-	FILE *fp;
-	fp = fopen("Server/tokenStore.txt", "r");
-	if (fp == NULL)
+	int forwarded;
+	if (forwardCall(OP_SEARCH_USERS, &forwarded, "s>r", suser, userlist))
+	{
+		return forwarded;
+	}
+	pthread_mutex_lock(&USERTEXT_LOCK);
+	if (updateUserColumn() != 0)
 	{
+		pthread_mutex_unlock(&USERTEXT_LOCK);
 		return -1;
 	}
-	struct users *user = userlist;
-	char line[20];
-	int size = 0;
-	while (fgets(line, 20, fp))
+	unsigned int *entries;
+	int size = scanTextColumn(&USERTEXT, suser, &entries);
+	for (int i = 0; i < size; i++)
 	{
-		int llen = strlen(line);
-		for (int i = 0; i < (llen - ulen); i++)
-		{
-			int cmp = strncmp(suser, &line[i], ulen);
-			if (cmp == 0)
-			{
-				size++;
-				strcpy(userlist->username, line);
-				userlist->next = (struct users *)malloc(sizeof(struct users));
-				userlist = userlist->next;
-				break;
-			}
-		}
+		struct users *user = appendResult(userlist, sizeof(struct users));
+		sprintf(user->username, "%s\n", USERTEXT.data + USERTEXT.offsets[entries[i]]);
 	}
+	pthread_mutex_unlock(&USERTEXT_LOCK);
+	free(entries);
 	return size;
 }
 
@@ -569,13 +2009,12 @@ void searchUsersScreen()
 	printf("Type in your search:\n");
 	char userss[50];
 	scanf("%s", userss);
-	struct users *userlist = (struct users *)malloc(sizeof(struct users *));
-	struct users *last = userlist;
-	int size = searchUsers(userss, userlist);
-	for (int i = 0; i < size; i++)
+	struct resultSet userlist;
+	initResultSet(&userlist);
+	searchUsers(userss, &userlist);
+	for (struct users *last = firstResult(&userlist); last != NULL; last = nextResult(last))
 	{
 		printf("%s", last->username);
-		last = last->next;
 	}
 uoptir:
 	printf("\nPress 1 to select a user\n");
@@ -590,24 +2029,26 @@ uoptir:
 	{
 		printf("Enter the username exactly as it to select it\n");
 		scanf("%s", usern);
-		struct users *l = userlist;
-		for (int i = 0; i < size; i++)
+		for (struct users *l = firstResult(&userlist); l != NULL; l = nextResult(l))
 		{
-			l->username[strlen(l->username) - 1] = '\0';
+			stripNewline(l->username);
 			int cmp = strcmp(usern, l->username);
 			if (cmp == 0)
 			{
-				goto userser;
+				break;
 			}
-			l = l->next;
 		}
+		freeResultSet(&userlist);
+		goto userser;
 	}
 	else if (r == 2)
 	{
+		freeResultSet(&userlist);
 		return;
 	}
 	else if (r == 3)
 	{
+		freeResultSet(&userlist);
 		newScreen(homeScreenAdmin);
 		return;
 	}
@@ -639,7 +2080,7 @@ userser:
 	}
 }
 
-int getAllUsers(struct users *userlist)
+int getAllUsers(struct resultSet *userlist)
 {
 	return viewUsers(userlist);
 }
@@ -662,52 +2103,75 @@ int deleteMyAccount(char *username)
 
 int deleteTokenPermanently(char *username)
 {
+	int forwarded;
+	if (forwardCall(OP_DELETE_TOKEN, &forwarded, "s", username))
+	{
+		return forwarded;
+	}
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_WRLCK, LOCK_TOKEN_STORE, 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	char lines[3][50];
+	int ret = findTextBlock("Server/tokenStore.txt", USERNAME_INDEX_FILE, 3, 0, username, lines);
+	if (ret != 0)
+	{
+		close(lock);
+		return ret;
+	}
 	FILE *fp;
 	fp = fopen("Server/tokenStore.txt", "r");
 	if (fp == NULL)
 	{
+		close(lock);
 		return -1;
 	}
-	struct txtFile *original = (struct txtFile *)malloc(sizeof(struct txtFile));
-	struct txtFile *txtfile = original;
-	struct txtFile *last = txtfile;
-	int filesize = 0;
-	char line[20];
-	while (fgets(line, 20, fp))
+	char tmp[] = "Server/tokenStore.txt.XXXXXX";
+	int fd = mkstemp(tmp);
+	FILE *out;
+	out = fd == -1 ? NULL : fdopen(fd, "w");
+	if (out == NULL)
 	{
-		strcpy(last->line, line);
-		filesize++;
-		last->next = malloc(sizeof(struct txtFile));
-		last = last->next;
+		fclose(fp);
+		close(lock);
+		return -1;
 	}
-	fp = freopen("Server/tokenStore.txt", "w", fp);
-	for (int i = 0; i < filesize; i++)
+	fchmod(fd, 0644);
+	char line[3][50];
+	while (fgets(line[0], 50, fp))
 	{
-		if (i != 0)
-		{
-			fputs("\n", fp);
-		}
-
-		txtfile->line[strlen(txtfile->line) - 1] = '\0';
-		if (strcmp(txtfile->line, username) == 0)
+		for (int i = 1; i < 3; i++)
 		{
-			for (int j = 0; j < 3; j++)
+			if (!fgets(line[i], 50, fp))
 			{
-				i++;
-				txtfile = txtfile->next;
+				strcpy(line[i], "\n");
 			}
-			i++;
-			txtfile->line[strlen(txtfile->line) - 1] = '\0';
 		}
-		fputs(txtfile->line, fp);
-		txtfile = txtfile->next;
+		stripNewline(line[0]);
+		if (strcmp(line[0], username) == 0)
+		{
+			continue;
+		}
+		stripNewline(line[1]);
+		stripNewline(line[2]);
+		fprintf(out, "%s\n%s\n%s\n", line[0], line[1], line[2]);
 	}
-	for (int i = 0; i < filesize; i++)
+	fclose(fp);
+	if (fclose(out) != 0 || rename(tmp, "Server/tokenStore.txt") != 0)
 	{
-		free(original);
-		original = original->next;
+		unlink(tmp);
+		close(lock);
+		return -1;
 	}
-	fclose(fp);
+	// Every block after the removed one moved, so both indexes are rebuilt right away
+	buildTextIndex("Server/tokenStore.txt", USERNAME_INDEX_FILE, 3, 0);
+	buildTextIndex("Server/tokenStore.txt", TOKEN_INDEX_FILE, 3, 2);
+	close(lock);
 	return 0;
 }
 
@@ -723,25 +2187,101 @@ void logout()
 	deleteToken();
 }
 
+void printCompletions(char *prefix)
+{
+	char *names[3] = {"Issue Nos", "Titles", "Authors"};
+	for (int f = BOOK_FIELD_ID; f <= BOOK_FIELD_AUTHOR; f++)
+	{
+		struct resultSet completions;
+		initResultSet(&completions);
+		if (autocomplete(f, prefix, COMPLETION_SIZE, &completions) > 0)
+		{
+			printf("%s starting with \"%s\":\n", names[f], prefix);
+			for (struct completionList *c = firstResult(&completions); c != NULL; c = nextResult(c))
+			{
+				printf("  %s\n", c->text);
+			}
+		}
+		freeResultSet(&completions);
+	}
+	printf("\n");
+}
+
+void readIssueNo(char *issue)
+{
+	printf("Enter the Issue No exactly as it is of the book that you want to select:\n");
+	printf("End it with * to list the Issue Nos starting with what you typed\n");
+	for (;;)
+	{
+		scanf("%s", issue);
+		issue[49] = '\0';
+		int len = strlen(issue);
+		if (len == 0 || issue[len - 1] != '*')
+		{
+			return;
+		}
+		issue[len - 1] = '\0';
+		struct resultSet completions;
+		initResultSet(&completions);
+		int n = autocomplete(BOOK_FIELD_ID, issue, COMPLETION_SIZE, &completions);
+		if (n <= 0)
+		{
+			printf("No Issue No starts with %s\n", issue);
+		}
+		for (struct completionList *c = firstResult(&completions); c != NULL; c = nextResult(c))
+		{
+			printf("  %s\n", c->text);
+		}
+		freeResultSet(&completions);
+		printf("Enter the Issue No:\n");
+	}
+}
+
 void searchScreen()
 {
-	printf("Type in your search:\n");
+	printf("Type in your search, end it with * to list completions or with ! to see only the best matches:\n");
 	char searchText[500];
-	scanf("%s", searchText);
+	readLine(searchText, 500);
 	searchText[49] = '\0';
-	struct bookList *books = (struct bookList *)malloc(sizeof(struct bookList));
-	int size = search(searchText, books);
-	struct bookList *last = books;
+	int slen = strlen(searchText);
+	if (slen > 0 && searchText[slen - 1] == '*')
+	{
+		searchText[slen - 1] = '\0';
+		printCompletions(searchText);
+		return;
+	}
+	int ranked = slen > 0 && searchText[slen - 1] == '!';
+	if (ranked)
+	{
+		searchText[slen - 1] = '\0';
+	}
+	struct resultSet books;
+	initResultSet(&books);
+	int size = ranked ? searchRanked(searchText, SEARCH_TOP_K, &books) : search(searchText, &books);
+	if (size > 0 && ranked)
+	{
+		printf("Best %d matches:\n\n", size);
+	}
+	else if (size == 0)
+	{
+		size = searchFuzzy(searchText, SEARCH_TOP_K, &books);
+		if (size > 0)
+		{
+			printf("No exact matches, showing the %d closest:\n\n", size);
+		}
+	}
+	struct bookList *last = firstResult(&books);
 	for (int i = 0; i < size; i++)
 	{
 		printf("%d.\n", (i + 1));
-		printf("Issue No: %s", last->book.id);
+		printf("Issue No: %s\n", last->book.id);
 		printf("Book Title: %s\n", last->book.bookTitle);
 		printf("Author: %s\n", last->book.author);
 		printf("Quanitity: %d\n", last->book.quantity);
 		printf("No of Books Issued: %d\n\n", last->book.issued);
-		last = last->next;
+		last = nextResult(last);
 	}
+	freeResultSet(&books);
 searchoption:
 	printf("\nPress 1 to search again\n");
 	printf("Press 2 to select a book from the result\n");
@@ -755,10 +2295,8 @@ searchoption:
 	}
 	else if (r == 2)
 	{
-		printf("Enter the Issue No exactly as it is of the book that you want to select:\n");
 		char issue[500];
-		scanf("%s", issue);
-		issue[49] = '\0';
+		readIssueNo(issue);
 		struct bookClass *book = (struct bookClass *)malloc(sizeof(struct bookClass));
 		int getb = viewBookByID(issue, book);
 		printf("%d\n", getb);
@@ -859,23 +2397,49 @@ searchoption:
 
 void searchScreenAdmin()
 {
-	printf("Type in your search:\n");
+	printf("Type in your search, end it with * to list completions or with ! to see only the best matches:\n");
 	char searchText[500];
-	scanf("%s", searchText);
+	readLine(searchText, 500);
 	searchText[49] = '\0';
-	struct bookList *books = (struct bookList *)malloc(sizeof(struct bookList));
-	int size = search(searchText, books);
-	struct bookList *last = books;
+	int slen = strlen(searchText);
+	if (slen > 0 && searchText[slen - 1] == '*')
+	{
+		searchText[slen - 1] = '\0';
+		printCompletions(searchText);
+		return;
+	}
+	int ranked = slen > 0 && searchText[slen - 1] == '!';
+	if (ranked)
+	{
+		searchText[slen - 1] = '\0';
+	}
+	struct resultSet books;
+	initResultSet(&books);
+	int size = ranked ? searchRanked(searchText, SEARCH_TOP_K, &books) : search(searchText, &books);
+	if (size > 0 && ranked)
+	{
+		printf("Best %d matches:\n\n", size);
+	}
+	else if (size == 0)
+	{
+		size = searchFuzzy(searchText, SEARCH_TOP_K, &books);
+		if (size > 0)
+		{
+			printf("No exact matches, showing the %d closest:\n\n", size);
+		}
+	}
+	struct bookList *last = firstResult(&books);
 	for (int i = 0; i < size; i++)
 	{
 		printf("%d.\n", (i + 1));
-		printf("Issue No: %s", last->book.id);
+		printf("Issue No: %s\n", last->book.id);
 		printf("Book Title: %s\n", last->book.bookTitle);
 		printf("Author: %s\n", last->book.author);
 		printf("Quanitity: %d\n", last->book.quantity);
 		printf("No of Books Issued: %d\n\n", last->book.issued);
-		last = last->next;
+		last = nextResult(last);
 	}
+	freeResultSet(&books);
 searchadminoption:
 	printf("\nPress 1 to search again\n");
 	printf("Press 2 to go to main page\n");
@@ -897,6 +2461,114 @@ searchadminoption:
 	}
 }
 
+int returnDropBox(char **usernames, char **ids, int n, int *statuses)
+{
+	char(*tokens)[50] = (char(*)[50])malloc((n > 0 ? n : 1) * sizeof(*tokens));
+	char **tokenList = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	for (int i = 0; i < n; i++)
+	{
+		char lines[3][50];
+		// A username nobody holds gets an empty token, which returnBooks turns away
+		tokens[i][0] = '\0';
+		if (findTextBlock("Server/tokenStore.txt", USERNAME_INDEX_FILE, 3, 0, usernames[i], lines) == 0)
+		{
+			strcpy(tokens[i], lines[2]);
+		}
+		tokenList[i] = tokens[i];
+	}
+	int ret = returnBooks(tokenList, ids, n, statuses);
+	sweepAfterLoans();
+	free(tokenList);
+	free(tokens);
+	return ret;
+}
+
+int importShipment(char *path, struct resultSet *rejected)
+{
+	FILE *fp;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	struct resultSet rows;
+	initResultSet(&rows);
+	char line[200];
+	while (fgets(line, sizeof(line), fp))
+	{
+		char id[50];
+		char issueID[50];
+		int quantity;
+		char rest[2];
+		if (sscanf(line, "%1s", rest) != 1)
+		{
+			continue;
+		}
+		if (sscanf(line, "%49s %49s %d %1s", id, issueID, &quantity, rest) == 3 && quantity > 0)
+		{
+			struct purchaseList *row = appendResult(&rows, sizeof(struct purchaseList));
+			strcpy(row->id, id);
+			strcpy(row->issueID, issueID);
+			row->quantity = quantity;
+		}
+		else
+		{
+			struct purchaseList *row = appendResult(rejected, sizeof(struct purchaseList));
+			stripNewline(line);
+			snprintf(row->id, sizeof(row->id), "%s", line);
+			row->status = 3;
+		}
+	}
+	fclose(fp);
+	int n = rows.size;
+	char **ids = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	char **issueIDs = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	int *quantities = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	int *statuses = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	int i = 0;
+	for (struct purchaseList *row = firstResult(&rows); row != NULL; row = nextResult(row), i++)
+	{
+		ids[i] = row->id;
+		issueIDs[i] = row->issueID;
+		quantities[i] = row->quantity;
+	}
+	int ret = importBooksFromMarket(ids, issueIDs, quantities, n, statuses);
+	i = 0;
+	for (struct purchaseList *row = firstResult(&rows); row != NULL && ret != -1; row = nextResult(row), i++)
+	{
+		if (statuses[i] != 1)
+		{
+			struct purchaseList *miss = appendResult(rejected, sizeof(struct purchaseList));
+			strcpy(miss->id, row->id);
+			strcpy(miss->issueID, row->issueID);
+			miss->quantity = row->quantity;
+			miss->status = statuses[i];
+		}
+	}
+	free(statuses);
+	free(quantities);
+	free(issueIDs);
+	free(ids);
+	freeResultSet(&rows);
+	return ret;
+}
+
+int getOverdueLoans(struct resultSet *loans)
+{
+	int size = viewOverdueLoans(time(NULL), loans);
+	for (struct loanList *loan = firstResult(loans); loan != NULL && size > 0; loan = nextResult(loan))
+	{
+		char lines[3][50];
+		// A member who deleted the account still shows up, under the token
+		strcpy(loan->username, loan->token);
+		if (findTextBlock("Server/tokenStore.txt", TOKEN_INDEX_FILE, 3, 2, loan->token, lines) == 0)
+		{
+			strcpy(loan->username, lines[0]);
+		}
+	}
+	return size;
+}
+
 int returnIssued(char *id)
 {
 	char token[20];
@@ -905,41 +2577,32 @@ int returnIssued(char *id)
 	{
 		return -1;
 	}
-	return returnBook(token, id);
+	ret = returnBook(token, id);
+	sweepAfterLoans();
+	return ret;
 }
 
 void dueBooks()
 {
 	char token[50];
-	int ret = getToken(token);
-	int s = 0;
-	struct bookInfoList *books = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-	struct bookInfoList *last = books;
-	int size = getIssuedBookInfo(token, books);
-	time_t t = time(NULL);
-	struct bookInfoList *booklist = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-	struct bookInfoList *head = booklist;
-	for (int i = 0; i < size; i++)
+	if (getToken(token) == -1)
 	{
-		if ((t - last->time) > 1296000)
-		{
-			printf("%ld", (last->time - t));
-			s++;
-			strcpy(head->book.id, last->book.id);
-			strcpy(head->book.bookTitle, last->book.bookTitle);
-			strcpy(head->book.author, last->book.author);
-			head->time = last->time;
-			head->next = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-			head = head->next;
-		}
-		last = last->next;
+		return;
 	}
-	for (int i = 0; i < size; i++)
+	// Rendering only reads the unread notifications, the sweeps run after issues and returns or on the daemon timer
+	struct resultSet notes;
+	initResultSet(&notes);
+	int size = getNotifications(token, &notes);
+	createNotification(size, firstResult(&notes));
+	freeResultSet(&notes);
+}
+
+void sweepAfterLoans()
+{
+	if (!DAEMON_CLIENT)
 	{
-		free(books);
-		books = books->next;
+		sweepNotifications(time(NULL));
 	}
-	createNotification(s, booklist);
 }
 
 void newScreen(void (*screen)())
@@ -1005,9 +2668,10 @@ option:
 
 void issuedBookUI()
 {
-	struct bookInfoList *books = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-	int size = getAllIssuedBooks(books);
-	struct bookInfoList *last = books;
+	struct resultSet books;
+	initResultSet(&books);
+	int size = getAllIssuedBooks(&books);
+	struct bookInfoList *last = firstResult(&books);
 	if (size == -1)
 	{
 		printf("Something Went Wrong");
@@ -1023,13 +2687,9 @@ void issuedBookUI()
 		printf("Author: %s\n", last->book.author);
 		char *ti = ctime(&(last->time));
 		printf("Issued at: %s\n\n", ti);
-		last = last->next;
-	}
-	for (int i = 0; i < size; i++)
-	{
-		free(books);
-		books = books->next;
+		last = nextResult(last);
 	}
+	freeResultSet(&books);
 issoption:
 	printf("Press 1 to select a book\n");
 	printf("Press 2 to go to main page\n");
@@ -1088,8 +2748,10 @@ setopt:
 	int r = atoi(rs);
 	if (r == 1)
 	{
-		struct bookInfoList *books = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-		int s = getAllIssuedBooks(books);
+		struct resultSet books;
+		initResultSet(&books);
+		int s = getAllIssuedBooks(&books);
+		freeResultSet(&books);
 		if (s > 0)
 		{
 			printf("You have not returned few issued books\n");
@@ -1121,21 +2783,29 @@ setopt:
 	}
 }
 
-void createNotification(int size, struct bookInfoList *books)
+void createNotification(int size, struct notificationList *notes)
 {
 	if (size > 0)
 	{
-		printf("You have %d books due\n", size);
-		printf("Kindly return the following books to the library\n");
+		printf("You have %d new notifications\n", size);
 		for (int i = 0; i < size; i++)
 		{
 			printf("%d\n", i + 1);
-			printf("Issue No: %s\n", books->book.id);
-			printf("Book Title: %s\n", books->book.bookTitle);
-			printf("Author: %s\n", books->book.author);
-			char *ti = ctime(&(books->time));
-			printf("Issued at: %s\n\n", ti);
-			books = books->next;
+			if (notes->note.type == NOTIFY_OVERDUE)
+			{
+				printf("This book is overdue, kindly return it to the library\n");
+			}
+			else
+			{
+				printf("This book is due soon\n");
+			}
+			printf("Issue No: %s\n", notes->note.id);
+			printf("Book Title: %s\n", notes->note.bookTitle);
+			printf("Author: %s\n", notes->note.author);
+			time_t due = notes->note.due;
+			char *ti = ctime(&due);
+			printf("Due at: %s\n", ti);
+			notes = nextResult(notes);
 		}
 	}
 }
@@ -1187,21 +2857,34 @@ homeoption:
 	}
 }
 
-void bookStoreUIAdmin()
+int printBookPage(int offset)
 {
-	struct bookList *books = (struct bookList *)malloc(sizeof(struct bookList));
-	int s = search("", books);
-	struct bookList *last = books;
-	for (int i = 0; i < s; i++)
+	struct resultSet books;
+	initResultSet(&books);
+	int s = listBooks(offset, BOOK_PAGE_SIZE, &books);
+	int i = offset;
+	for (struct bookList *last = firstResult(&books); last != NULL; last = nextResult(last))
 	{
-		printf("%d\n", i + 1);
-		printf("Issue No: %s", last->book.id);
+		printf("%d\n", ++i);
+		printf("Issue No: %s\n", last->book.id);
 		printf("Book Title: %s\n", last->book.bookTitle);
 		printf("Author: %s\n", last->book.author);
 		printf("Quantity: %d\n", last->book.quantity);
 		printf("No of books issued: %d\n\n", last->book.issued);
-		last = last->next;
 	}
+	freeResultSet(&books);
+	if (s == 0)
+	{
+		printf("No more books\n");
+	}
+	return s;
+}
+
+void bookStoreUIAdmin()
+{
+	int offset = 0;
+page:;
+	int s = printBookPage(offset);
 	if (s == -1)
 	{
 		printf("Something went wrong\n");
@@ -1210,7 +2893,15 @@ void bookStoreUIAdmin()
 		return;
 	}
 opti:
-	printf("Press 1 to go to main page");
+	printf("Press 1 to go to main page\n");
+	if (s == BOOK_PAGE_SIZE)
+	{
+		printf("Press 2 for the next page\n");
+	}
+	if (offset > 0)
+	{
+		printf("Press 3 for the previous page\n");
+	}
 	char inp[50];
 	scanf("%s", inp);
 	int is = atoi(inp);
@@ -1219,6 +2910,16 @@ opti:
 		newScreen(homeScreenAdmin);
 		return;
 	}
+	else if (is == 2 && s == BOOK_PAGE_SIZE)
+	{
+		offset += BOOK_PAGE_SIZE;
+		goto page;
+	}
+	else if (is == 3 && offset > 0)
+	{
+		offset -= BOOK_PAGE_SIZE;
+		goto page;
+	}
 	else
 	{
 		printf("NOT A VALID ENTRY!\nEnter Again:\n");
@@ -1228,20 +2929,9 @@ opti:
 
 void bookStoreUI()
 {
-	struct bookList *books = (struct bookList *)malloc(sizeof(struct bookList));
-	int s = search("", books);
-	struct bookList *last = books;
-	for (int i = 0; i < s; i++)
-	{
-		printf("%d\n", i + 1);
-		printf("Issue No: %s", last->book.id);
-		printf("Book Title: %s\n", last->book.bookTitle);
-		printf("Author: %s\n", last->book.author);
-		printf("Quantity: %d\n", last->book.quantity);
-		printf("No of books issued: %d\n\n", last->book.issued);
-		last = last->next;
-	}
-
+	int offset = 0;
+page:;
+	int s = printBookPage(offset);
 	if (s == -1)
 	{
 		printf("Something went wrong\n");
@@ -1252,15 +2942,22 @@ void bookStoreUI()
 homeop:
 	printf("\nPress 1 to select a book\n");
 	printf("Press 2 to go to main page\n");
+	if (s == BOOK_PAGE_SIZE)
+	{
+		printf("Press 3 for the next page\n");
+	}
+	if (offset > 0)
+	{
+		printf("Press 4 for the previous page\n");
+	}
+	printf("Press 5 to issue several books at once\n");
 	char rs[50];
 	scanf("%s", rs);
 	int r = atoi(rs);
 	if (r == 1)
 	{
-		printf("Enter the Issue No exactly as it is of the book that you want to select:\n");
 		char issue[500];
-		scanf("%s", issue);
-		issue[49] = '\0';
+		readIssueNo(issue);
 		struct bookClass *book = (struct bookClass *)malloc(sizeof(struct bookClass));
 		int getb = viewBookByID(issue, book);
 		if (getb == -1)
@@ -1353,13 +3050,92 @@ homeop:
 		newScreen(homeScreen);
 		return;
 	}
-	else
+	else if (r == 3 && s == BOOK_PAGE_SIZE)
 	{
-		printf("NOT A VALID ENTRY!\nEnter Again:\n");
-		goto homeop;
+		offset += BOOK_PAGE_SIZE;
+		goto page;
 	}
-}
-
+	else if (r == 4 && offset > 0)
+	{
+		offset -= BOOK_PAGE_SIZE;
+		goto page;
+	}
+	else if (r == 5)
+	{
+		if (issueSeveralBooks() == -2)
+		{
+			newScreen(systemCrash);
+			return;
+		}
+		goto homeop;
+	}
+	else
+	{
+		printf("NOT A VALID ENTRY!\nEnter Again:\n");
+		goto homeop;
+	}
+}
+
+int issueSeveralBooks()
+{
+	char issues[ISSUE_BATCH_SIZE][50];
+	char *ids[ISSUE_BATCH_SIZE];
+	int statuses[ISSUE_BATCH_SIZE];
+	int n = 0;
+	printf("Enter the Issue Nos one by one, at most %d, and 0 when you are done\n", ISSUE_BATCH_SIZE);
+	while (n < ISSUE_BATCH_SIZE)
+	{
+		char issue[500];
+		scanf("%s", issue);
+		issue[49] = '\0';
+		if (strcmp(issue, "0") == 0)
+		{
+			break;
+		}
+		strcpy(issues[n], issue);
+		ids[n] = issues[n];
+		n++;
+	}
+	if (n == 0)
+	{
+		return 0;
+	}
+	int ret = issueBooksByID(ids, n, statuses);
+	if (ret == -2)
+	{
+		return -2;
+	}
+	if (ret == -1)
+	{
+		printf("Something went wrong\n");
+		printf("Try Again\n");
+		sleep(2);
+		return 0;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		if (statuses[i] == 0)
+		{
+			printf("%s: Book Issued Successfully\n", ids[i]);
+		}
+		else if (statuses[i] == 1)
+		{
+			printf("%s: Book Not Availabe\n", ids[i]);
+		}
+		else if (statuses[i] == 2)
+		{
+			printf("%s: Book already issued\n", ids[i]);
+		}
+		else
+		{
+			printf("%s: Something went Wrong\n", ids[i]);
+		}
+	}
+	printf("%d of %d books issued\n", ret, n);
+	sleep(2);
+	return 0;
+}
+
 void homeScreenAdmin()
 {
 	printf("Welcome %s\n", USERNAME);
@@ -1370,8 +3146,10 @@ homeadminoption:
 	printf("Press 3 to search for users\n");
 	printf("Press 4 to list all the users\n");
 	printf("Press 5 to buy books from vendors\n");
-	printf("Press 6 to Log Out\n");
-	printf("Press 7 to exit the program\n\n");
+	printf("Press 6 to process the return drop box\n");
+	printf("Press 7 to view overdue books\n");
+	printf("Press 8 to Log Out\n");
+	printf("Press 9 to exit the program\n\n");
 	char rs[50];
 	scanf("%s", rs);
 	int r = atoi(rs);
@@ -1396,11 +3174,19 @@ homeadminoption:
 		newScreen(bookMarketUI);
 	}
 	else if (r == 6)
+	{
+		newScreen(dropBoxUI);
+	}
+	else if (r == 7)
+	{
+		newScreen(overdueUI);
+	}
+	else if (r == 8)
 	{
 		logout();
 		newScreen(welcomeScreen);
 	}
-	else if (r == 7)
+	else if (r == 9)
 	{
 		exit(0);
 	}
@@ -1414,16 +3200,86 @@ homeadminoption:
 void systemCrash()
 {
 	printf("System Crashed due to unexpected failure\n");
-	printf("Kindly restore the Server from the backup folder\n");
+	printf("Kindly restart the portal, unfinished changes will be recovered from the journal\n");
 	sleep(4);
 	exit(0);
 }
 
+void dropBoxUI()
+{
+	printf("Enter every book in the drop box as the username of the member followed by the Issue No\n");
+	printf("Enter 0 when you are done\n");
+	int n = 0;
+	int capacity = 64;
+	char(*usernames)[50] = (char(*)[50])malloc(capacity * sizeof(*usernames));
+	char(*issues)[50] = (char(*)[50])malloc(capacity * sizeof(*issues));
+	for (;;)
+	{
+		char username[500];
+		char issue[500];
+		if (scanf("%s", username) != 1 || strcmp(username, "0") == 0 || scanf("%s", issue) != 1)
+		{
+			break;
+		}
+		if (n == capacity)
+		{
+			capacity *= 2;
+			usernames = (char(*)[50])realloc(usernames, capacity * sizeof(*usernames));
+			issues = (char(*)[50])realloc(issues, capacity * sizeof(*issues));
+		}
+		username[49] = '\0';
+		issue[49] = '\0';
+		strcpy(usernames[n], username);
+		strcpy(issues[n], issue);
+		n++;
+	}
+	char **userList = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	char **idList = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	int *statuses = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	for (int i = 0; i < n; i++)
+	{
+		userList[i] = usernames[i];
+		idList[i] = issues[i];
+	}
+	int ret = returnDropBox(userList, idList, n, statuses);
+	if (ret == -2)
+	{
+		newScreen(systemCrash);
+	}
+	else if (ret == -1)
+	{
+		printf("Something went wrong\n");
+		printf("Try Again\n");
+		sleep(2);
+		newScreen(homeScreenAdmin);
+	}
+	else
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (statuses[i] != 0)
+			{
+				printf("%s %s: Book is not issued to this member\n", usernames[i], issues[i]);
+			}
+		}
+		printf("%d of %d books returned\n", ret, n);
+		sleep(2);
+		newScreen(homeScreenAdmin);
+	}
+	free(statuses);
+	free(idList);
+	free(userList);
+	free(issues);
+	free(usernames);
+}
+
 void bookMarketUI()
 {
-	struct bookVendorList *books = (struct bookVendorList *)malloc(sizeof(struct bookVendorList));
-	struct bookVendorList *last = books;
-	int ret = getBooksFromMarket(books);
+	struct resultSet books;
+	initResultSet(&books);
+	struct bookVendorList *last;
+	int ret = getBooksFromMarket(&books);
+	last = firstResult(&books);
 	if (ret == -1)
 	{
 		printf("Something went wrong\n");
@@ -1439,11 +3295,13 @@ void bookMarketUI()
 		printf("Book Title: %s", last->book.bookTitle);
 		printf("Author: %s", last->book.author);
 		printf("Vendor: %s\n", last->book.vendor);
-		last = last->next;
+		last = nextResult(last);
 	}
+	freeResultSet(&books);
 venopt:
 	printf("\nPress 1 to buy a book\n");
-	printf("Press 2 to go to the main page\n");
+	printf("Press 2 to buy a vendor shipment from a file\n");
+	printf("Press 3 to go to the main page\n");
 	char ps[50];
 	scanf("%s", ps);
 	int p = atoi(ps);
@@ -1491,6 +3349,11 @@ venopt:
 		}
 	}
 	else if (p == 2)
+	{
+		newScreen(shipmentUI);
+		return;
+	}
+	else if (p == 3)
 	{
 		newScreen(homeScreenAdmin);
 		return;
@@ -1502,6 +3365,86 @@ venopt:
 	}
 }
 
+void overdueUI()
+{
+	struct resultSet loans;
+	initResultSet(&loans);
+	int size = getOverdueLoans(&loans);
+	if (size == -1)
+	{
+		printf("Something went wrong\n");
+		sleep(2);
+		freeResultSet(&loans);
+		newScreen(homeScreenAdmin);
+		return;
+	}
+	printf("%d books are overdue\n\n", size);
+	time_t t = time(NULL);
+	int i = 1;
+	for (struct loanList *loan = firstResult(&loans); loan != NULL; loan = nextResult(loan), i++)
+	{
+		printf("%d\n", i);
+		printf("Member: %s\n", loan->username);
+		printf("Issue No: %s\n", loan->book.id);
+		printf("Book Title: %s\n", loan->book.bookTitle);
+		printf("Author: %s\n", loan->book.author);
+		printf("Overdue by %ld days\n\n", (long)(t - loan->due) / 86400);
+	}
+	freeResultSet(&loans);
+	printf("Press any key to go to the main page\n");
+	char ps[50];
+	scanf("%s", ps);
+	newScreen(homeScreenAdmin);
+}
+
+void shipmentUI()
+{
+	printf("Enter the path of the shipment file\n");
+	printf("Every line of it holds the id of a book in the market, the Issue No to give it and the quantity\n");
+	char path[200];
+	if (readLine(path, sizeof(path)) != 0)
+	{
+		newScreen(homeScreenAdmin);
+		return;
+	}
+	struct resultSet rejected;
+	initResultSet(&rejected);
+	int ret = importShipment(path, &rejected);
+	if (ret == -2)
+	{
+		newScreen(systemCrash);
+	}
+	else if (ret == -1)
+	{
+		printf("Something went wrong\n");
+		printf("Try Again\n");
+		sleep(2);
+		newScreen(homeScreenAdmin);
+	}
+	else
+	{
+		for (struct purchaseList *row = firstResult(&rejected); row != NULL; row = nextResult(row))
+		{
+			if (row->status == 3)
+			{
+				printf("%s: Not a valid line\n", row->id);
+			}
+			else if (row->status == 0)
+			{
+				printf("%s %s: Issue ID given already exists\n", row->id, row->issueID);
+			}
+			else if (row->status == 2)
+			{
+				printf("%s %s: No such book in the market\n", row->id, row->issueID);
+			}
+		}
+		printf("%d books purchased successfully!\n", ret);
+		sleep(2);
+		newScreen(homeScreenAdmin);
+	}
+	freeResultSet(&rejected);
+}
+
 void loginAsAdminUI()
 {
 	char username[500];
@@ -1687,51 +3630,21 @@ void loadScreen(void (*screen)())
 
 int verifyToken(char *token, char *username)
 {
-	FILE *fp;
-	char gToken[50];
-	int tlen = strlen(token);
-	fp = fopen("Server/tokenStore.txt", "r");
-	if (fp == NULL)
+	int forwarded;
+	if (forwardCall(OP_VERIFY_TOKEN, &forwarded, "s>s", token, username, 20))
 	{
+		// The caller hands the token over either way, the local lookup below frees it when the daemon is gone
 		free(token);
-		return -1;
+		return forwarded;
 	}
-	int equals = 0;
-	int linenum = 0;
-	while (fgets(gToken, 50, fp))
+	char lines[3][50];
+	int ret = findTextBlock("Server/tokenStore.txt", TOKEN_INDEX_FILE, 3, 2, token, lines);
+	free(token);
+	if (ret == 0)
 	{
-		if ((linenum % 3) == 2)
-		{
-			for (int i = 0; i < tlen; i++)
-			{
-				if (gToken[i] == token[i])
-				{
-					equals = 1;
-				}
-				else
-				{
-					equals = 0;
-					break;
-				}
-			}
-			if (equals == 1)
-			{
-				rewind(fp);
-				linenum--;
-				linenum--;
-				for (int m = 0; m <= linenum; m++)
-				{
-					fgets(username, 50, fp);
-				}
-				username[strlen(username) - 1] = '\0';
-				free(token);
-				return 0;
-			}
-		}
-		linenum++;
+		strcpy(username, lines[0]);
 	}
-	free(token);
-	return 1;
+	return ret;
 }
 
 int getToken(char *token)
@@ -1992,786 +3905,6090 @@ char *generateToken(char *username, int64 hash)
 	return token;
 }
 
-int createNewToken(char *username, int64 hash)
+int validateToken(char *token)
 {
-	int ulen = strlen(username);
-	char ha[50];
-	int hlen = sprintf(ha, "%llu", hash);
-
-	FILE *fp;
-	fp = fopen("./Server/tokenStore.txt", "r");
-	if (fp == NULL)
+	int tlen = strlen(token);
+	if (tlen == 0 || tlen > 20)
 	{
-		return -1;
+		return 1;
 	}
-	char line[50];
-	int linenum = 0;
-	int equals = 0;
-	while (fgets(line, 50, fp))
+	for (int i = 0; i < tlen; i++)
 	{
-		if ((linenum % 3) == 0)
-		{
-			if (ulen == (strlen(line) - 1))
-			{
-				for (int i = 0; i < ulen; i++)
-				{
-					if (username[i] == line[i])
-					{
-						equals = 1;
-					}
-					else
-					{
-						equals = 0;
-						break;
-					}
-				}
-			}
-		}
-		if (equals == 1)
+		if (!(('0' <= token[i] && token[i] <= '9') || ('A' <= token[i] && token[i] <= 'Z') || ('a' <= token[i] && token[i] <= 'z')))
 		{
 			return 1;
 		}
-		linenum++;
 	}
-	fp = freopen("Server/tokenStore.txt", "a", fp);
-	fputs(username, fp);
-	fputs("\n", fp);
-	fputs(ha, fp);
-	fputs("\n", fp);
-	char *token = generateToken(username, hash);
-	fputs(token, fp);
-	fputs("\n", fp);
-	fclose(fp);
-	free(token);
+	return 0;
 }
 
-int verifyCredentials(char *username, int64 hash, char *token)
+unsigned int hashBytes(void *data, size_t n)
 {
-	int ulen = strlen(username);
-	char ha[50];
-	int hlen = sprintf(ha, "%llu", hash);
-	FILE *fp;
-	fp = fopen("Server/tokenStore.txt", "r");
-	if (fp == NULL)
+	unsigned char *bytes = (unsigned char *)data;
+	unsigned int hash = 2166136261u;
+	for (size_t i = 0; i < n; i++)
 	{
-		return -1;
+		hash ^= bytes[i];
+		hash *= 16777619u;
 	}
-	char line[50];
-	int linenum = 0;
-	int equals = 0;
-	while (fgets(line, 50, fp))
+	return hash;
+}
+
+unsigned int hashString(char *s)
+{
+	unsigned int hash = 2166136261u;
+	while (*s != '\0')
 	{
-		if ((linenum % 3) == 0)
+		hash ^= (unsigned char)*s;
+		hash *= 16777619u;
+		s++;
+	}
+	return hash;
+}
+
+void initKeySet(struct keySet *set, int capacity)
+{
+	set->capacity = capacity > 16 ? capacity : 16;
+	set->count = 0;
+	set->keys = (char **)malloc(set->capacity * sizeof(char *));
+	set->slotCount = 32;
+	while (set->slotCount < (unsigned int)set->capacity * 2)
+	{
+		set->slotCount *= 2;
+	}
+	set->slots = (unsigned int *)calloc(set->slotCount, sizeof(unsigned int));
+}
+
+int addKey(struct keySet *set, char *key)
+{
+	unsigned int slot = hashString(key) & (set->slotCount - 1);
+	while (set->slots[slot] != 0)
+	{
+		if (strcmp(set->keys[set->slots[slot] - 1], key) == 0)
 		{
-			if (ulen == (strlen(line) - 1))
-			{
-				for (int i = 0; i < ulen; i++)
-				{
-					if (username[i] == line[i])
-					{
-						equals = 1;
-					}
-					else
-					{
-						equals = 0;
-						break;
-					}
-				}
-			}
+			return set->slots[slot] - 1;
 		}
-		if (equals == 1)
+		slot = (slot + 1) & (set->slotCount - 1);
+	}
+	if (set->count == set->capacity)
+	{
+		set->capacity *= 2;
+		set->keys = (char **)realloc(set->keys, set->capacity * sizeof(char *));
+	}
+	set->keys[set->count++] = key;
+	set->slots[slot] = set->count;
+	if ((unsigned int)set->count * 2 > set->slotCount)
+	{
+		set->slotCount *= 2;
+		free(set->slots);
+		set->slots = (unsigned int *)calloc(set->slotCount, sizeof(unsigned int));
+		for (int i = 0; i < set->count; i++)
 		{
-			fgets(line, 50, fp);
-			int creds = 0;
-			if (hlen == (strlen(line) - 1))
-			{
-				for (int i = 0; i < hlen; i++)
-				{
-					if (ha[i] == line[i])
-					{
-						creds = 1;
-					}
-					else
-					{
-						creds = 0;
-						break;
-					}
-				}
-			}
-			if (creds == 0)
+			slot = hashString(set->keys[i]) & (set->slotCount - 1);
+			while (set->slots[slot] != 0)
 			{
-				fclose(fp);
-				return 1;
-			}
-			else
-			{
-				fgets(line, 50, fp);
-				for (int i = 0; i < 50; i++)
-				{
-					if (line[i] == '\n')
-					{
-						token[i] = '\0';
-						break;
-					}
-					token[i] = line[i];
-				}
-				fclose(fp);
-				return 0;
+				slot = (slot + 1) & (set->slotCount - 1);
 			}
+			set->slots[slot] = i + 1;
 		}
-		linenum++;
 	}
-	fclose(fp);
-	return 1;
+	return -1;
 }
 
-int verifyCredentialsForAdmin(char *username, int64 hash, char *token)
+int findKey(struct keySet *set, char *key)
 {
-	int ulen = strlen(username);
-	char ha[50];
-	int hlen = sprintf(ha, "%llu", hash);
-	FILE *fp;
-	fp = fopen("Server/adminTokenStore.txt", "r");
+	unsigned int slot = hashString(key) & (set->slotCount - 1);
+	while (set->slots[slot] != 0)
+	{
+		if (strcmp(set->keys[set->slots[slot] - 1], key) == 0)
+		{
+			return set->slots[slot] - 1;
+		}
+		slot = (slot + 1) & (set->slotCount - 1);
+	}
+	return -1;
+}
+
+void freeKeySet(struct keySet *set)
+{
+	free(set->keys);
+	free(set->slots);
+	set->keys = NULL;
+	set->slots = NULL;
+	set->count = 0;
+}
+
+void initResultSet(struct resultSet *results)
+{
+	results->arena = NULL;
+	results->head = NULL;
+	results->tail = NULL;
+	results->size = 0;
+}
+
+void *appendResult(struct resultSet *results, size_t size)
+{
+	size = (size + 15) & ~(size_t)15;
+	struct arenaBlock *block = results->arena;
+	if (block == NULL || block->used + size > block->capacity)
+	{
+		size_t capacity = block == NULL ? 16384 : block->capacity * 2;
+		while (capacity < size)
+		{
+			capacity *= 2;
+		}
+		block = (struct arenaBlock *)malloc(sizeof(struct arenaBlock) + capacity);
+		block->prev = results->arena;
+		block->used = 0;
+		block->capacity = capacity;
+		results->arena = block;
+	}
+	struct resultNode *node = (struct resultNode *)(block->data + block->used);
+	block->used += size;
+	memset(node, 0, size);
+	if (results->tail == NULL)
+	{
+		results->head = node;
+	}
+	else
+	{
+		results->tail->next = node;
+	}
+	results->tail = node;
+	results->size++;
+	return node;
+}
+
+void *firstResult(struct resultSet *results)
+{
+	return results->head;
+}
+
+void *nextResult(void *result)
+{
+	return ((struct resultNode *)result)->next;
+}
+
+void freeResultSet(struct resultSet *results)
+{
+	while (results->arena != NULL)
+	{
+		struct arenaBlock *prev = results->arena->prev;
+		free(results->arena);
+		results->arena = prev;
+	}
+	initResultSet(results);
+}
+
+int readLine(char *line, int size)
+{
+	do
+	{
+		if (fgets(line, size, stdin) == NULL)
+		{
+			line[0] = '\0';
+			return -1;
+		}
+		stripNewline(line);
+	} while (line[0] == '\0');
+	return 0;
+}
+
+void stripNewline(char *line)
+{
+	int llen = strlen(line);
+	if (llen > 0 && line[llen - 1] == '\n')
+	{
+		line[llen - 1] = '\0';
+	}
+}
+
+int readField(FILE *fp, char *field, int size)
+{
+	if (!fgets(field, size, fp))
+	{
+		field[0] = '\0';
+		return -1;
+	}
+	int flen = strlen(field);
+	if (flen > 0 && field[flen - 1] == '\n')
+	{
+		field[flen - 1] = '\0';
+		return 0;
+	}
+	int c = getc(fp);
+	if (c == '\n' || c == EOF)
+	{
+		return 0;
+	}
+	while (c != '\n' && c != EOF)
+	{
+		c = getc(fp);
+	}
+	return 1;
+}
+
+int createNewToken(char *username, int64 hash)
+{
+	int forwarded;
+	if (forwardCall(OP_CREATE_TOKEN, &forwarded, "sl", username, (long)hash))
+	{
+		return forwarded;
+	}
+	// Registrations and removals take turns on the token store, so a name can not be registered twice
+	// and a registration can not be lost to a removal rewriting the store
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_WRLCK, LOCK_TOKEN_STORE, 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	char ha[50];
+	sprintf(ha, "%llu", hash);
+	char lines[3][50];
+	int exists = findTextBlock("Server/tokenStore.txt", USERNAME_INDEX_FILE, 3, 0, username, lines);
+	if (exists != 1)
+	{
+		close(lock);
+		return exists == 0 ? 1 : -1;
+	}
+	FILE *fp;
+	fp = fopen("Server/tokenStore.txt", "a");
+	if (fp == NULL)
+	{
+		close(lock);
+		return -1;
+	}
+	long stampBefore = fileStamp(fileno(fp));
+	long offset = ftell(fp);
+	fputs(username, fp);
+	fputs("\n", fp);
+	fputs(ha, fp);
+	fputs("\n", fp);
+	char *token = generateToken(username, hash);
+	fputs(token, fp);
+	fputs("\n", fp);
+	fflush(fp);
+	// Keep both indexes current instead of letting the next lookup rebuild them
+	long stamp = fileStamp(fileno(fp));
+	char *indexes[2] = {USERNAME_INDEX_FILE, TOKEN_INDEX_FILE};
+	char *keys[2] = {username, token};
+	for (int i = 0; i < 2; i++)
+	{
+		struct hashIndex index;
+		if (openHashIndex(indexes[i], &index) == 0)
+		{
+			if (index.stamp == stampBefore)
+			{
+				index.stamp = stamp;
+				insertHashIndex(&index, hashString(keys[i]), offset);
+			}
+			closeHashIndex(&index);
+		}
+	}
+	fclose(fp);
+	free(token);
+	close(lock);
+	return 0;
+}
+
+// Checks a username and password hash against a token store and copies out the login token
+int verifyStoredCredentials(char *path, char *indexPath, char *username, int64 hash, char *token)
+{
+	char ha[50];
+	sprintf(ha, "%llu", hash);
+	char lines[3][50];
+	int ret = findTextBlock(path, indexPath, 3, 0, username, lines);
+	if (ret != 0)
+	{
+		return ret;
+	}
+	if (strcmp(lines[1], ha) != 0)
+	{
+		return 1;
+	}
+	strcpy(token, lines[2]);
+	return 0;
+}
+
+int verifyCredentials(char *username, int64 hash, char *token)
+{
+	int forwarded;
+	if (forwardCall(OP_VERIFY_CREDENTIALS, &forwarded, "sl>s", username, (long)hash, token, 50))
+	{
+		return forwarded;
+	}
+	return verifyStoredCredentials("Server/tokenStore.txt", USERNAME_INDEX_FILE, username, hash, token);
+}
+
+int verifyCredentialsForAdmin(char *username, int64 hash, char *token)
+{
+	int forwarded;
+	if (forwardCall(OP_VERIFY_ADMIN, &forwarded, "sl>s", username, (long)hash, token, 50))
+	{
+		return forwarded;
+	}
+	return verifyStoredCredentials("Server/adminTokenStore.txt", ADMIN_INDEX_FILE, username, hash, token);
+}
+
+int getBookByID(char *id, struct bookClass *book)
+{
+	int forwarded;
+	if (forwardCall(OP_GET_BOOK, &forwarded, "s>b", id, book, sizeof(struct bookClass)))
+	{
+		return forwarded;
+	}
+	// A process that holds no snapshot yet reads the one record from the catalog rather than load all of it for one book
+	if (atomic_load(&CATALOG_VERSION) == NULL)
+	{
+		struct catalog cat;
+		if (openCatalog(&cat) != 0)
+		{
+			return -1;
+		}
+		struct bookRecord rec;
+		int ret = findBookRecord(&cat, id, &rec, NULL);
+		closeCatalog(&cat);
+		if (ret == 0)
+		{
+			strcpy(book->id, rec.id);
+			strcpy(book->bookTitle, rec.bookTitle);
+			strcpy(book->author, rec.author);
+			book->quantity = rec.quantity;
+			book->issued = rec.issued;
+		}
+		return ret;
+	}
+	struct catalogVersion *version = openSnapshot(0);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	int record = findSnapshotBook(version, id);
+	int ret = record == -1 ? 1 : readCompactBook(version, record, book);
+	closeSnapshot();
+	return ret;
+}
+
+int search(char *book, struct resultSet *books)
+{
+	return searchBooks(book, books);
+}
+
+int searchRanked(char *book, int k, struct resultSet *books)
+{
+	return searchBooksRanked(book, k, NULL, books);
+}
+
+int searchFuzzy(char *book, int k, struct resultSet *books)
+{
+	return searchBooksFuzzy(book, k, books);
+}
+
+int autocomplete(int field, char *prefix, int n, struct resultSet *completions)
+{
+	return completeBooks(field, prefix, n, completions);
+}
+
+int listBooks(int offset, int limit, struct resultSet *books)
+{
+	return viewBookPage(offset, limit, books);
+}
+
+int viewBookPage(int offset, int limit, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_BOOK_PAGE, &forwarded, "ii>r", offset, limit, books))
+	{
+		return forwarded;
+	}
+	struct bookCursor cursor;
+	if (openBookCursor(&cursor, offset) != 0)
+	{
+		return -1;
+	}
+	int size = 0;
+	struct bookClass book;
+	int ret = 0;
+	while (size < limit && (ret = nextBook(&cursor, &book)) == 0)
+	{
+		struct bookList *booklist = appendResult(books, sizeof(struct bookList));
+		booklist->book = book;
+		size++;
+	}
+	closeBookCursor(&cursor);
+	return ret == -1 ? -1 : size;
+}
+
+int searchBooks(char *book, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_SEARCH_BOOKS, &forwarded, "s>r", book, books))
+	{
+		return forwarded;
+	}
+	struct catalogVersion *version = openSnapshot(strlen(book) < 3 ? SNAPSHOT_COLUMN : SNAPSHOT_TRIGRAMS);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	struct shardSearch search;
+	memset(&search, 0, sizeof(search));
+	search.version = version;
+	search.query = book;
+	runShards(matchShard, &search);
+	// Every shard matched in record order, sorted together the matches keep the catalog order
+	int size = 0;
+	for (int s = 0; s < SEARCH_SHARDS; s++)
+	{
+		size += search.sizes[s];
+	}
+	unsigned int *matches = (unsigned int *)malloc((size + 1) * sizeof(unsigned int));
+	size = 0;
+	for (int s = 0; s < SEARCH_SHARDS; s++)
+	{
+		if (search.sizes[s] > 0)
+		{
+			memcpy(matches + size, search.records[s], search.sizes[s] * sizeof(unsigned int));
+		}
+		size += search.sizes[s];
+		free(search.records[s]);
+	}
+	qsort(matches, size, sizeof(unsigned int), compareInt);
+	int ret = size;
+	for (int i = 0; i < size; i++)
+	{
+		struct bookList *booklist = appendResult(books, sizeof(struct bookList));
+		if (readCompactBook(version, matches[i], &booklist->book) != 0)
+		{
+			ret = -1;
+			break;
+		}
+	}
+	free(matches);
+	closeSnapshot();
+	return ret;
+}
+
+int searchBooksRanked(char *book, int k, struct searchWeights *weights, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_SEARCH_RANKED, &forwarded, "siib>r", book, k, weights != NULL, weights, weights != NULL ? sizeof(struct searchWeights) : 0, books))
+	{
+		return forwarded;
+	}
+	if (book[0] == '\0' || k <= 0)
+	{
+		return 0;
+	}
+	if (weights == NULL)
+	{
+		weights = &SEARCH_WEIGHTS;
+	}
+	struct catalogVersion *version = openSnapshot(strlen(book) < 3 ? SNAPSHOT_COLUMN : SNAPSHOT_TRIGRAMS);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	struct shardSearch search;
+	memset(&search, 0, sizeof(search));
+	search.version = version;
+	search.query = book;
+	search.qlen = strlen(book);
+	search.k = k;
+	search.weights = weights;
+	runShards(rankShard, &search);
+	struct rankedBook *heap;
+	int size = mergeShardHits(&search, k, &heap);
+	int ret = size;
+	for (int i = 0; i < size; i++)
+	{
+		struct bookList *booklist = appendResult(books, sizeof(struct bookList));
+		if (readCompactBook(version, heap[i].record, &booklist->book) != 0)
+		{
+			ret = -1;
+			break;
+		}
+	}
+	free(heap);
+	closeSnapshot();
+	return ret;
+}
+
+int searchBooksFuzzy(char *query, int k, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_SEARCH_FUZZY, &forwarded, "si>r", query, k, books))
+	{
+		return forwarded;
+	}
+	char words[FUZZY_MAX_WORDS][50];
+	int nwords = splitWords(query, words, FUZZY_MAX_WORDS);
+	if (nwords == 0 || k <= 0)
+	{
+		return 0;
+	}
+	struct catalogVersion *version = openSnapshot(SNAPSHOT_TRIGRAMS);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	struct shardSearch search;
+	memset(&search, 0, sizeof(search));
+	search.version = version;
+	search.words = words;
+	search.nwords = nwords;
+	search.ncandidates = fuzzyCandidates(&search, FUZZY_CANDIDATES, &search.candidates);
+	search.k = k;
+	runShards(distanceShard, &search);
+	free(search.candidates);
+	struct rankedBook *heap;
+	int size = mergeShardHits(&search, k, &heap);
+	int ret = size;
+	for (int i = 0; i < size; i++)
+	{
+		struct bookList *booklist = appendResult(books, sizeof(struct bookList));
+		if (readCompactBook(version, heap[i].record, &booklist->book) != 0)
+		{
+			ret = -1;
+			break;
+		}
+	}
+	free(heap);
+	closeSnapshot();
+	return ret;
+}
+
+int completeBooks(int field, char *prefix, int n, struct resultSet *completions)
+{
+	int forwarded;
+	if (forwardCall(OP_COMPLETE_BOOKS, &forwarded, "isi>r", field, prefix, n, completions))
+	{
+		return forwarded;
+	}
+	if (field < BOOK_FIELD_ID || field > BOOK_FIELD_AUTHOR)
+	{
+		return 0;
+	}
+	struct catalogVersion *version = openSnapshot(SNAPSHOT_PREFIXES);
+	if (version == NULL)
+	{
+		return -1;
+	}
+	struct prefixIndex *index = &version->text->prefixes[field];
+	char *pool = version->text->pool;
+	int plen = strlen(prefix);
+	int size = 0;
+	char *last = NULL;
+	for (int i = findPrefixStart(pool, index, prefix); i < index->count && size < n; i++)
+	{
+		char *text = pool + index->entries[i].text;
+		if (strncasecmp(text, prefix, plen) != 0)
+		{
+			break;
+		}
+		// Equal strings sort next to each other, so a repeat is always the previous completion
+		if (last != NULL && strcmp(last, text) == 0)
+		{
+			continue;
+		}
+		struct completionList *completion = appendResult(completions, sizeof(struct completionList));
+		strcpy(completion->text, text);
+		last = text;
+		size++;
+	}
+	closeSnapshot();
+	return size;
+}
+
+int getWishListInfo(char *token, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_WISH_LIST, &forwarded, "s>r", token, books))
+	{
+		return forwarded;
+	}
+	FILE *fp;
+	fp = fopen("Server/wishList.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	int tokenline = 1;
+	char line[50];
+	while (fgets(line, 50, fp))
+	{
+		if (tokenline == 1)
+		{
+			line[strlen(line) - 1] = '\0';
+			int cmp = strcmp(token, line);
+			if (cmp == 0)
+			{
+				int size = 0;
+				fgets(line, 50, fp);
+				while (1)
+				{
+					struct bookInfoList *booklist = appendResult(books, sizeof(struct bookInfoList));
+					line[strlen(line) - 1] = '\0';
+					strcpy(booklist->book.id, line);
+					fgets(line, 50, fp);
+					line[strlen(line) - 1] = '\0';
+					strcpy(booklist->book.bookTitle, line);
+					fgets(line, 50, fp);
+					line[strlen(line) - 1] = '\0';
+					strcpy(booklist->book.author, line);
+					size++;
+					fgets(line, 50, fp);
+					if (strcmp(line, "\n") == 0)
+					{
+						fclose(fp);
+						return size;
+					}
+				}
+			}
+		}
+		if (line[0] == '\n')
+		{
+			tokenline = 1;
+		}
+		else
+		{
+			tokenline = 0;
+		}
+	}
+	fclose(fp);
+	return 0;
+}
+
+int getAllIssuedBooks(struct resultSet *books)
+{
+	char token[50];
+	int ret = getToken(token);
+	if (ret == -1)
+	{
+		return -1;
+	}
+	return getIssuedBookInfo(token, books);
+}
+
+int getIssuedBookInfo(char *token, struct resultSet *books)
+{
+	int forwarded;
+	if (forwardCall(OP_ISSUED_BOOKS, &forwarded, "s>r", token, books))
+	{
+		return forwarded;
+	}
+	// Readers share the lock of the shard, they only wait for a loan being added or returned
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_RDLCK, shardLock(token), 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	int ret = readIssuedBooks(token, books);
+	close(lock);
+	return ret;
+}
+
+int readIssuedBooks(char *token, struct resultSet *books)
+{
+	char path[100];
+	if (issuedShardPath(token, path) != 0)
+	{
+		return -1;
+	}
+	FILE *fp;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		return errno == ENOENT ? 0 : -1;
+	}
+	int size = 0;
+	char line[50];
+	while (fgets(line, 50, fp))
+	{
+		struct bookInfoList *booklist = appendResult(books, sizeof(struct bookInfoList));
+		stripNewline(line);
+		strcpy(booklist->book.id, line);
+		fgets(line, 50, fp);
+		stripNewline(line);
+		strcpy(booklist->book.bookTitle, line);
+		fgets(line, 50, fp);
+		stripNewline(line);
+		strcpy(booklist->book.author, line);
+		fgets(line, 50, fp);
+		booklist->time = atol(line);
+		size++;
+	}
+	fclose(fp);
+	return size;
+}
+
+int viewOverdueLoans(time_t time, struct resultSet *loans)
+{
+	int forwarded;
+	if (forwardCall(OP_OVERDUE_LOANS, &forwarded, "l>r", (long)time, loans))
+	{
+		return forwarded;
+	}
+	struct loanList *found;
+	int live = findDueLoans(0, time, &found);
+	if (live == -1)
+	{
+		return -1;
+	}
+	for (int i = 0; i < live; i++)
+	{
+		struct loanList *loan = appendResult(loans, sizeof(struct loanList));
+		strcpy(loan->token, found[i].token);
+		loan->book = found[i].book;
+		loan->time = found[i].time;
+		loan->due = found[i].due;
+	}
+	free(found);
+	return live;
+}
+
+int getNotifications(char *token, struct resultSet *notes)
+{
+	int forwarded;
+	if (forwardCall(OP_NOTIFICATIONS, &forwarded, "s>r", token, notes))
+	{
+		return forwarded;
+	}
+	char path[100];
+	if (inboxPath(token, path) != 0)
+	{
+		return -1;
+	}
+	int fd = open(path, O_RDWR);
+	if (fd == -1)
+	{
+		return errno == ENOENT ? 0 : -1;
+	}
+	flock(fd, LOCK_EX);
+	struct inboxHeader header;
+	int size = -1;
+	if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, INBOX_MAGIC, 8) == 0)
+	{
+		size = header.count - header.unread;
+		struct notification *unread = (struct notification *)malloc((size > 0 ? size : 1) * sizeof(struct notification));
+		ssize_t want = size * sizeof(struct notification);
+		if (pread(fd, unread, want, (off_t)(header.unread + 1) * sizeof(struct notification)) != want)
+		{
+			size = -1;
+		}
+		for (int i = 0; i < size; i++)
+		{
+			struct notificationList *note = appendResult(notes, sizeof(struct notificationList));
+			note->note = unread[i];
+		}
+		free(unread);
+		header.unread = header.count;
+		if (size > 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		{
+			size = -1;
+		}
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return size;
+}
+
+int sweepNotifications(time_t time)
+{
+	int forwarded;
+	if (forwardCall(OP_SWEEP, &forwarded, "l", (long)time))
+	{
+		return forwarded;
+	}
+	int fd = open(SWEEP_FILE, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if (flock(fd, LOCK_EX | LOCK_NB) != 0)
+	{
+		close(fd);
+		return 0;
+	}
+	long last = 0;
+	if (pread(fd, &last, sizeof(last), 0) != sizeof(last))
+	{
+		last = 0;
+	}
+	if (time - last < SWEEP_INTERVAL)
+	{
+		flock(fd, LOCK_UN);
+		close(fd);
+		return 0;
+	}
+	// Loans due before last already had their overdue notification, and those due before last + DUE_SOON_PERIOD
+	// their due soon one, so only the heap entries due since last are looked at
+	struct loanList *loans;
+	int n = findDueLoans(last, time + DUE_SOON_PERIOD, &loans);
+	if (n == -1)
+	{
+		flock(fd, LOCK_UN);
+		close(fd);
+		return -1;
+	}
+	qsort(loans, n, sizeof(struct loanList), compareLoanToken);
+	struct notification *notes = (struct notification *)calloc(n > 0 ? n : 1, sizeof(struct notification));
+	int written = 0;
+	int ret = 0;
+	for (int i = 0; i < n && ret == 0;)
+	{
+		int m = 0;
+		int end = i;
+		for (; end < n && strcmp(loans[end].token, loans[i].token) == 0; end++)
+		{
+			struct loanList *loan = &loans[end];
+			int type = loan->due < time ? NOTIFY_OVERDUE : loan->due - DUE_SOON_PERIOD >= last ? NOTIFY_DUE_SOON : 0;
+			if (type == 0)
+			{
+				continue;
+			}
+			struct notification *note = &notes[m++];
+			memset(note, 0, sizeof(*note));
+			note->type = type;
+			note->due = loan->due;
+			note->time = loan->time;
+			strcpy(note->id, loan->book.id);
+			strcpy(note->bookTitle, loan->book.bookTitle);
+			strcpy(note->author, loan->book.author);
+		}
+		if (m > 0 && addNotifications(loans[i].token, notes, m) != 0)
+		{
+			ret = -1;
+		}
+		written += m;
+		i = end;
+	}
+	free(notes);
+	free(loans);
+	// The mark only moves once every inbox is written, a failed sweep is redone from the same point
+	long mark = time;
+	if (ret == 0 && pwrite(fd, &mark, sizeof(mark), 0) != sizeof(mark))
+	{
+		ret = -1;
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return ret == 0 ? written : -1;
+}
+
+int findDueLoans(time_t from, time_t to, struct loanList **loans)
+{
+	// Readers share the heap, an issue only waits for them to push its loans
+	struct dueHeapHeader header;
+	int fd = openDueHeap(LOCK_SH, &header);
+	if (fd == -1)
+	{
+		// A heap a writer left dirty, or one that is gone, is rebuilt and read again
+		if (rebuildDueHeap(0, 0) != 0 || (fd = openDueHeap(LOCK_SH, &header)) == -1)
+		{
+			return -1;
+		}
+	}
+	// Every ancestor of an entry due before to is due no later than it, so walking down from the root
+	// and stopping at the first entry that is not reads those entries and at most two children each
+	// The walk goes level by level, so the slots it visits only ever increase and one read fetches several of them
+	int count = 0;
+	int capacity = 64;
+	struct dueEntry *due = (struct dueEntry *)malloc(capacity * sizeof(struct dueEntry));
+	int queueCapacity = 64;
+	int *queue = (int *)malloc(queueCapacity * sizeof(int));
+	int head = 0;
+	int tail = 0;
+	struct dueEntry window[64];
+	int windowStart = 0;
+	int windowSize = 0;
+	int ret = 0;
+	if (header.count > 0)
+	{
+		queue[tail++] = 0;
+	}
+	while (head < tail)
+	{
+		int slot = queue[head++];
+		if (slot >= windowStart + windowSize)
+		{
+			windowStart = slot;
+			windowSize = header.count - slot < 64 ? header.count - slot : 64;
+			ssize_t want = windowSize * sizeof(struct dueEntry);
+			if (pread(fd, window, want, (off_t)(slot + 1) * sizeof(struct dueEntry)) != want)
+			{
+				ret = -1;
+				break;
+			}
+		}
+		struct dueEntry *entry = &window[slot - windowStart];
+		if (entry->due >= to)
+		{
+			continue;
+		}
+		if (entry->due >= from)
+		{
+			if (count == capacity)
+			{
+				capacity *= 2;
+				due = (struct dueEntry *)realloc(due, capacity * sizeof(struct dueEntry));
+			}
+			due[count++] = *entry;
+		}
+		if (tail + 2 > queueCapacity)
+		{
+			queueCapacity *= 2;
+			queue = (int *)realloc(queue, queueCapacity * sizeof(int));
+		}
+		for (int child = slot * 2 + 1; child <= slot * 2 + 2 && child < header.count; child++)
+		{
+			queue[tail++] = child;
+		}
+	}
+	free(queue);
+	// Returned loans are still in the heap, so every entry is checked against its shard, each shard being read once
+	qsort(due, count, sizeof(struct dueEntry), compareDueLoan);
+	struct loanList *found = (struct loanList *)malloc((count > 0 ? count : 1) * sizeof(struct loanList));
+	int live = 0;
+	for (int i = 0; i < count && ret == 0;)
+	{
+		int end = i;
+		while (end < count && strcmp(due[end].token, due[i].token) == 0)
+		{
+			end++;
+		}
+		struct resultSet books;
+		initResultSet(&books);
+		if (readIssuedBooks(due[i].token, &books) == -1)
+		{
+			ret = -1;
+		}
+		for (int j = i; j < end && ret == 0; j++)
+		{
+			// A loan pushed twice, by a replayed journal entry or after a rebuild that already found it in the shard, is only reported once
+			if (j > i && compareDueLoan(&due[j], &due[j - 1]) == 0)
+			{
+				continue;
+			}
+			for (struct bookInfoList *list = firstResult(&books); list != NULL; list = nextResult(list))
+			{
+				if (list->time == due[j].time && strcmp(list->book.id, due[j].id) == 0)
+				{
+					struct loanList *loan = &found[live++];
+					memset(loan, 0, sizeof(*loan));
+					strcpy(loan->token, due[j].token);
+					loan->book = list->book;
+					loan->time = list->time;
+					loan->due = due[j].due;
+					break;
+				}
+			}
+		}
+		freeResultSet(&books);
+		i = end;
+	}
+	free(due);
+	closeDueHeap(fd);
+	if (ret == 0 && count - live > 64 && count - live > live)
+	{
+		// Once returned loans outweigh the live ones the heap is rebuilt without them
+		rebuildDueHeap(1, 0);
+	}
+	if (ret == -1)
+	{
+		free(found);
+		return -1;
+	}
+	// The loans were gathered user by user, hand them out earliest due first
+	qsort(found, live, sizeof(struct loanList), compareOverdueLoan);
+	*loans = found;
+	return live;
+}
+
+int issueBooksByID(char **ids, int n, int *statuses)
+{
+	char token[50];
+	if (getToken(token) == -1)
+	{
+		return -1;
+	}
+	int ret = issueBooks(token, ids, n, time(NULL), statuses);
+	sweepAfterLoans();
+	return ret;
+}
+
+int issueBookByID(char *id)
+{
+	char token[20];
+	int ret = getToken(token);
+	if (ret == -1)
+	{
+		return -1;
+	}
+	struct resultSet books;
+	initResultSet(&books);
+	getIssuedBookInfo(token, &books);
+	for (struct bookInfoList *list = firstResult(&books); list != NULL; list = nextResult(list))
+	{
+		if (strcmp(list->book.id, id) == 0)
+		{
+			freeResultSet(&books);
+			return 2;
+		}
+	}
+	freeResultSet(&books);
+	time_t t = time(NULL);
+	struct bookClass *book = (struct bookClass *)malloc(sizeof(struct bookClass));
+	int r = getBookByID(id, book);
+	if (r != 0)
+	{
+		free(book);
+		return r == 1 ? 1 : -1;
+	}
+	// Loans keep the first 49 characters of the longer catalog fields
+	struct bookInfo booki;
+	snprintf(booki.id, sizeof(booki.id), "%.*s", (int)sizeof(booki.id) - 1, book->id);
+	snprintf(booki.bookTitle, sizeof(booki.bookTitle), "%.*s", (int)sizeof(booki.bookTitle) - 1, book->bookTitle);
+	snprintf(booki.author, sizeof(booki.author), "%.*s", (int)sizeof(booki.author) - 1, book->author);
+	free(book);
+	ret = issueBook(token, booki, t);
+	sweepAfterLoans();
+	return ret;
+}
+
+int issueBook(char *token, struct bookInfo book, time_t time)
+{
+	int forwarded;
+	if (forwardCall(OP_ISSUE_BOOK, &forwarded, "sbl", token, &book, sizeof(book), (long)time))
+	{
+		return forwarded;
+	}
+	// The shard lock keeps two terminals of one user apart, the record lock keeps the count of the book
+	// from being read by another issue or return before this one has set it
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_WRLCK, shardLock(token), 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	// Checked under the lock, as a second terminal of the same user may be issuing the book right now
+	int held = findIssuedBook(token, book.id);
+	if (held != 1)
+	{
+		close(lock);
+		return held == 0 ? 2 : -1;
+	}
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		close(lock);
+		return -1;
+	}
+	struct bookRecord rec;
+	int record;
+	int ret = findBookRecord(&cat, book.id, &rec, &record);
+	if (ret == 0 && (lockBookRecord(&cat, record, F_WRLCK) != 0 || readBookRecord(&cat, record, &rec) != 0))
+	{
+		ret = -1;
+	}
+	// The count is only final under the record lock, two users racing for the last copy can not both get it
+	if (ret == 0 && rec.quantity <= rec.issued)
+	{
+		ret = 1;
+	}
+	if (ret == 0)
+	{
+		struct journalEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.type = JOURNAL_ISSUE;
+		entry.issued = rec.issued + 1;
+		entry.time = time;
+		strncpy(entry.token, token, sizeof(entry.token) - 1);
+		snprintf(entry.book.id, sizeof(entry.book.id), "%s", book.id);
+		strncpy(entry.book.bookTitle, book.bookTitle, sizeof(entry.book.bookTitle) - 1);
+		strncpy(entry.book.author, book.author, sizeof(entry.book.author) - 1);
+		ret = runJournalEntry(&entry);
+	}
+	// Closing the catalog releases the record lock
+	closeCatalog(&cat);
+	close(lock);
+	return ret;
+}
+
+int addIssuedBooks(char *token, struct bookInfo *books, int n, time_t time)
+{
+	char path[100];
+	if (issuedShardPath(token, path) != 0)
+	{
+		return -1;
+	}
+	// The loans go into the shard before they go onto the heap, so a rebuild in between only pushes them twice
+	// A failed append leaves the issue pending, the journal recovery that retries it rebuilds the heap
+	int generation = beginDueLoans();
+	FILE *fp;
+	fp = fopen(path, "a");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	// A full buffer keeps the whole batch in one write
+	char buffer[ISSUE_BATCH_SIZE * 320];
+	setvbuf(fp, buffer, _IOFBF, sizeof(buffer));
+	for (int i = 0; i < n; i++)
+	{
+		fprintf(fp, "%s\n%s\n%s\n%ld\n", books[i].id, books[i].bookTitle, books[i].author, time);
+	}
+	if (fclose(fp) != 0)
+	{
+		return -1;
+	}
+	return endDueLoans(generation, token, books, n, time);
+}
+
+int addIssuedBook(char *token, struct bookInfo book, time_t time)
+{
+	return addIssuedBooks(token, &book, 1, time);
+}
+
+int returnBook(char *token, char *id)
+{
+	int forwarded;
+	if (forwardCall(OP_RETURN_BOOK, &forwarded, "ss", token, id))
+	{
+		return forwarded;
+	}
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_WRLCK, shardLock(token), 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	int ret = findIssuedBook(token, id);
+	if (ret != 0)
+	{
+		close(lock);
+		return ret;
+	}
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		close(lock);
+		return -1;
+	}
+	struct bookRecord rec;
+	int record;
+	if (findBookRecord(&cat, id, &rec, &record) != 0 || lockBookRecord(&cat, record, F_WRLCK) != 0 || readBookRecord(&cat, record, &rec) != 0)
+	{
+		ret = -1;
+	}
+	if (ret == 0)
+	{
+		struct journalEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.type = JOURNAL_RETURN;
+		entry.issued = rec.issued - 1;
+		strncpy(entry.token, token, sizeof(entry.token) - 1);
+		strncpy(entry.book.id, id, sizeof(entry.book.id) - 1);
+		ret = runJournalEntry(&entry);
+	}
+	closeCatalog(&cat);
+	close(lock);
+	return ret;
+}
+
+int findIssuedBook(char *token, char *id)
+{
+	struct resultSet books;
+	initResultSet(&books);
+	int s = readIssuedBooks(token, &books);
+	int ret = s == -1 ? -1 : 1;
+	for (struct bookInfoList *list = firstResult(&books); list != NULL; list = nextResult(list))
+	{
+		if (strcmp(list->book.id, id) == 0)
+		{
+			ret = 0;
+			break;
+		}
+	}
+	freeResultSet(&books);
+	return ret;
+}
+
+int openDueHeap(int operation, struct dueHeapHeader *header)
+{
+	int fd = open(DUE_HEAP_FILE, O_RDWR);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if (flock(fd, operation) != 0 || pread(fd, header, sizeof(*header), 0) != sizeof(*header) || memcmp(header->magic, DUE_HEAP_MAGIC, 8) != 0 || header->dirty != 0)
+	{
+		closeDueHeap(fd);
+		return -1;
+	}
+	return fd;
+}
+
+void closeDueHeap(int fd)
+{
+	if (fd != -1)
+	{
+		flock(fd, LOCK_UN);
+		close(fd);
+	}
+}
+
+int beginDueLoans()
+{
+	struct dueHeapHeader header;
+	int fd = openDueHeap(LOCK_EX, &header);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	header.pending++;
+	int ret = pwrite(fd, &header, sizeof(header), 0) == sizeof(header) ? header.generation : -1;
+	closeDueHeap(fd);
+	return ret;
+}
+
+int endDueLoans(int generation, char *token, struct bookInfo *books, int n, time_t time)
+{
+	struct dueHeapHeader header;
+	int fd = openDueHeap(LOCK_EX, &header);
+	if (fd == -1)
+	{
+		// A missing or dirty heap is rebuilt from the shards, which hold the loans by now
+		return 0;
+	}
+	if (generation != -1 && generation == header.generation && header.pending > 0)
+	{
+		header.pending--;
+	}
+	int ret = pushDueLoans(fd, &header, token, books, n, time);
+	closeDueHeap(fd);
+	return ret;
+}
+
+int pushDueLoans(int fd, struct dueHeapHeader *heap, char *token, struct bookInfo *books, int n, time_t time)
+{
+	struct dueHeapHeader header = *heap;
+	header.dirty = 1;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		return -1;
+	}
+	for (int i = 0; i < n; i++)
+	{
+		struct dueEntry entry;
+		memset(&entry, 0, sizeof(entry));
+		entry.time = time;
+		entry.due = time + LOAN_PERIOD;
+		strncpy(entry.token, token, sizeof(entry.token) - 1);
+		strncpy(entry.id, books[i].id, sizeof(entry.id) - 1);
+		// Sift up: parents due later than the new entry move down one level
+		int slot = header.count;
+		while (slot > 0)
+		{
+			struct dueEntry parent;
+			int up = (slot - 1) / 2;
+			if (pread(fd, &parent, sizeof(parent), (off_t)(up + 1) * sizeof(parent)) != sizeof(parent))
+			{
+				return -1;
+			}
+			if (parent.due <= entry.due)
+			{
+				break;
+			}
+			if (pwrite(fd, &parent, sizeof(parent), (off_t)(slot + 1) * sizeof(parent)) != sizeof(parent))
+			{
+				return -1;
+			}
+			slot = up;
+		}
+		if (pwrite(fd, &entry, sizeof(entry), (off_t)(slot + 1) * sizeof(entry)) != sizeof(entry))
+		{
+			return -1;
+		}
+		header.count++;
+	}
+	header.dirty = 0;
+	if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		return -1;
+	}
+	*heap = header;
+	return 0;
+}
+
+int buildDueHeap(int fd)
+{
+	if (splitIssuedBooks() != 0)
+	{
+		return -1;
+	}
+	DIR *dir = opendir(ISSUED_DIR);
+	if (dir == NULL)
+	{
+		return -1;
+	}
+	int count = 0;
+	int capacity = 1024;
+	struct dueEntry *entries = (struct dueEntry *)malloc(capacity * sizeof(struct dueEntry));
+	struct dirent *file;
+	int ret = 0;
+	while ((file = readdir(dir)) != NULL)
+	{
+		char token[24];
+		char *dot = strrchr(file->d_name, '.');
+		if (dot == NULL || strcmp(dot, ".txt") != 0 || dot - file->d_name >= (long)sizeof(token))
+		{
+			continue;
+		}
+		memcpy(token, file->d_name, dot - file->d_name);
+		token[dot - file->d_name] = '\0';
+		struct resultSet books;
+		initResultSet(&books);
+		if (readIssuedBooks(token, &books) == -1)
+		{
+			freeResultSet(&books);
+			ret = -1;
+			break;
+		}
+		for (struct bookInfoList *list = firstResult(&books); list != NULL; list = nextResult(list))
+		{
+			if (count == capacity)
+			{
+				capacity *= 2;
+				entries = (struct dueEntry *)realloc(entries, capacity * sizeof(struct dueEntry));
+			}
+			struct dueEntry *entry = &entries[count++];
+			memset(entry, 0, sizeof(*entry));
+			entry->time = list->time;
+			entry->due = list->time + LOAN_PERIOD;
+			strcpy(entry->token, token);
+			strcpy(entry->id, list->book.id);
+		}
+		freeResultSet(&books);
+	}
+	closedir(dir);
+	if (ret == 0)
+	{
+		// An array sorted by due time already satisfies the heap order
+		qsort(entries, count, sizeof(struct dueEntry), compareDueEntry);
+		struct dueHeapHeader header;
+		int generation = pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, DUE_HEAP_MAGIC, 8) == 0 ? header.generation : 0;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, DUE_HEAP_MAGIC, 8);
+		header.generation = generation + 1;
+		header.count = count;
+		header.dirty = 1;
+		ssize_t want = count * sizeof(struct dueEntry);
+		if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || pwrite(fd, entries, want, sizeof(header)) != want || ftruncate(fd, sizeof(header) + want) != 0)
+		{
+			ret = -1;
+		}
+		header.dirty = 0;
+		if (ret == 0 && pwrite(fd, &header, sizeof(header), 0) != sizeof(header))
+		{
+			ret = -1;
+		}
+	}
+	free(entries);
+	return ret == 0 ? count : -1;
+}
+
+int rebuildDueHeap(int force, int pending)
+{
+	int fd = open(DUE_HEAP_FILE, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	if (flock(fd, LOCK_EX) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	// Another process may have rebuilt it while this one waited for the lock
+	struct dueHeapHeader header;
+	int ret = 0;
+	if (force || pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, DUE_HEAP_MAGIC, 8) != 0 || header.dirty != 0 || (pending && header.pending != 0))
+	{
+		ret = buildDueHeap(fd) == -1 ? -1 : 0;
+	}
+	closeDueHeap(fd);
+	return ret;
+}
+
+int compareDueEntry(const void *a, const void *b)
+{
+	struct dueEntry *x = (struct dueEntry *)a;
+	struct dueEntry *y = (struct dueEntry *)b;
+	if (x->due != y->due)
+	{
+		return x->due < y->due ? -1 : 1;
+	}
+	int c = strcmp(x->token, y->token);
+	return c != 0 ? c : strcmp(x->id, y->id);
+}
+
+int compareDueLoan(const void *a, const void *b)
+{
+	struct dueEntry *x = (struct dueEntry *)a;
+	struct dueEntry *y = (struct dueEntry *)b;
+	int c = strcmp(x->token, y->token);
+	if (c == 0)
+	{
+		c = strcmp(x->id, y->id);
+	}
+	if (c == 0 && x->time != y->time)
+	{
+		c = x->time < y->time ? -1 : 1;
+	}
+	return c;
+}
+
+int compareOverdueLoan(const void *a, const void *b)
+{
+	struct loanList *x = (struct loanList *)a;
+	struct loanList *y = (struct loanList *)b;
+	if (x->due != y->due)
+	{
+		return x->due < y->due ? -1 : 1;
+	}
+	int c = strcmp(x->token, y->token);
+	return c != 0 ? c : strcmp(x->book.id, y->book.id);
+}
+
+int inboxPath(char *token, char *path)
+{
+	if (validateToken(token) != 0 || (mkdir(INBOX_DIR, 0755) != 0 && errno != EEXIST))
+	{
+		return -1;
+	}
+	sprintf(path, "%s/%s.dat", INBOX_DIR, token);
+	return 0;
+}
+
+int addNotifications(char *token, struct notification *notes, int n)
+{
+	char path[100];
+	if (inboxPath(token, path) != 0)
+	{
+		return -1;
+	}
+	int fd = open(path, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	flock(fd, LOCK_EX);
+	struct inboxHeader header;
+	if (pread(fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, INBOX_MAGIC, 8) != 0)
+	{
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, INBOX_MAGIC, 8);
+	}
+	int ret = 0;
+	if (header.unread >= 64)
+	{
+		// Seen notifications are dropped by moving the unread ones to the front
+		int keep = header.count - header.unread;
+		struct notification *unread = (struct notification *)malloc((keep > 0 ? keep : 1) * sizeof(struct notification));
+		ssize_t want = keep * sizeof(struct notification);
+		if (pread(fd, unread, want, (off_t)(header.unread + 1) * sizeof(struct notification)) != want || pwrite(fd, unread, want, sizeof(header)) != want)
+		{
+			ret = -1;
+		}
+		free(unread);
+		header.count = keep;
+		header.unread = 0;
+	}
+	ssize_t want = n * sizeof(struct notification);
+	if (ret == 0 && pwrite(fd, notes, want, (off_t)(header.count + 1) * sizeof(struct notification)) != want)
+	{
+		ret = -1;
+	}
+	if (ret == 0)
+	{
+		header.count += n;
+		if (pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || ftruncate(fd, (off_t)(header.count + 1) * sizeof(struct notification)) != 0)
+		{
+			ret = -1;
+		}
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return ret;
+}
+
+int dropNotifications(char *token, char **ids, int n)
+{
+	char path[100];
+	if (inboxPath(token, path) != 0)
+	{
+		return -1;
+	}
+	int fd = open(path, O_RDWR);
+	if (fd == -1)
+	{
+		return errno == ENOENT ? 0 : -1;
+	}
+	flock(fd, LOCK_EX);
+	struct inboxHeader header;
+	int removed = 0;
+	if (pread(fd, &header, sizeof(header), 0) == sizeof(header) && memcmp(header.magic, INBOX_MAGIC, 8) == 0 && header.count > header.unread)
+	{
+		int size = header.count - header.unread;
+		struct notification *unread = (struct notification *)malloc(size * sizeof(struct notification));
+		ssize_t want = size * sizeof(struct notification);
+		off_t offset = (off_t)(header.unread + 1) * sizeof(struct notification);
+		if (pread(fd, unread, want, offset) != want)
+		{
+			removed = -1;
+		}
+		int kept = 0;
+		for (int i = 0; i < size && removed != -1; i++)
+		{
+			int drop = 0;
+			for (int j = 0; j < n && !drop; j++)
+			{
+				drop = strcmp(unread[i].id, ids[j]) == 0;
+			}
+			if (drop)
+			{
+				removed++;
+			}
+			else
+			{
+				unread[kept++] = unread[i];
+			}
+		}
+		if (removed > 0)
+		{
+			header.count = header.unread + kept;
+			want = kept * sizeof(struct notification);
+			if (pwrite(fd, unread, want, offset) != want || pwrite(fd, &header, sizeof(header), 0) != sizeof(header) || ftruncate(fd, offset + want) != 0)
+			{
+				removed = -1;
+			}
+		}
+		free(unread);
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return removed;
+}
+
+int compareLoanToken(const void *a, const void *b)
+{
+	struct loanList *x = (struct loanList *)a;
+	struct loanList *y = (struct loanList *)b;
+	int c = strcmp(x->token, y->token);
+	if (c == 0 && x->due != y->due)
+	{
+		c = x->due < y->due ? -1 : 1;
+	}
+	return c;
+}
+
+int removeIssuedBook(char *token, char *id)
+{
+	int ret = removeIssuedBooks(token, &id, 1);
+	return ret == -1 ? -1 : ret == 1 ? 0 : 1;
+}
+
+int compareReturn(const void *a, const void *b)
+{
+	struct returnPair *x = (struct returnPair *)a;
+	struct returnPair *y = (struct returnPair *)b;
+	int c = strcmp(x->token, y->token);
+	if (c == 0)
+	{
+		c = strcmp(x->id, y->id);
+	}
+	if (c == 0)
+	{
+		c = x->position - y->position;
+	}
+	return c;
+}
+
+int removeIssuedBooks(char *token, char **ids, int n)
+{
+	char path[100];
+	if (issuedShardPath(token, path) != 0)
+	{
+		return -1;
+	}
+	FILE *fp;
+	fp = fopen(path, "r");
+	if (fp == NULL)
+	{
+		return errno == ENOENT ? 0 : -1;
+	}
+	char tmp[110];
+	sprintf(tmp, "%s.tmp", path);
+	FILE *out;
+	out = fopen(tmp, "w");
+	if (out == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	char *matched = (char *)calloc(n, 1);
+	int removed = 0;
+	int kept = 0;
+	char line[4][50];
+	while (fgets(line[0], 50, fp))
+	{
+		for (int i = 1; i < 4; i++)
+		{
+			if (!fgets(line[i], 50, fp))
+			{
+				line[i][0] = '\0';
+			}
+		}
+		stripNewline(line[0]);
+		int skip = 0;
+		for (int i = 0; i < n && !skip; i++)
+		{
+			if (!matched[i] && strcmp(line[0], ids[i]) == 0)
+			{
+				matched[i] = 1;
+				skip = 1;
+			}
+		}
+		if (skip)
+		{
+			removed++;
+			continue;
+		}
+		fprintf(out, "%s\n%s%s%s", line[0], line[1], line[2], line[3]);
+		kept++;
+	}
+	free(matched);
+	fclose(fp);
+	if (fclose(out) != 0)
+	{
+		unlink(tmp);
+		return -1;
+	}
+	if (removed == 0)
+	{
+		unlink(tmp);
+		return 0;
+	}
+	// The last loan of a user takes the shard with it
+	if (kept == 0)
+	{
+		unlink(tmp);
+		if (unlink(path) != 0)
+		{
+			return -1;
+		}
+	}
+	else if (rename(tmp, path) != 0)
+	{
+		return -1;
+	}
+	// Reminders about books that came back are of no use any more
+	dropNotifications(token, ids, n);
+	return removed;
+}
+
+// ##########################################################################################################################
+
+/* Mock Server Storage */
+
+int convertBookStore()
+{
+	FILE *fp;
+	fp = fopen("Server/bookStore.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	FILE *out;
+	out = fopen(CATALOG_FILE ".tmp", "w");
+	if (out == NULL)
+	{
+		fclose(fp);
+		return -1;
+	}
+	struct bookRecord rec;
+	struct catalogHeader header;
+	memset(&header, 0, sizeof(header));
+	fwrite(&header, sizeof(header), 1, out);
+	int capacity = 1024;
+	unsigned int *hashes = (unsigned int *)malloc(capacity * sizeof(unsigned int));
+	unsigned int *values = (unsigned int *)malloc(capacity * sizeof(unsigned int));
+	int count = 0;
+	char number[16];
+	for (;;)
+	{
+		memset(&rec, 0, sizeof(rec));
+		int cut = readField(fp, rec.id, sizeof(rec.id));
+		if (cut == -1)
+		{
+			break;
+		}
+		if (rec.id[0] == '\0')
+		{
+			continue;
+		}
+		cut = readField(fp, rec.bookTitle, sizeof(rec.bookTitle)) == 1 || cut;
+		cut = readField(fp, rec.author, sizeof(rec.author)) == 1 || cut;
+		if (readField(fp, number, sizeof(number)) == 0)
+		{
+			rec.quantity = atoi(number);
+		}
+		if (readField(fp, number, sizeof(number)) == 0)
+		{
+			rec.issued = atoi(number);
+		}
+		if (cut)
+		{
+			fprintf(stderr, "Server/bookStore.txt: book %s has a field too long for the catalog, left out\n", rec.id);
+			continue;
+		}
+		fwrite(&rec, sizeof(rec), 1, out);
+		if (count == capacity)
+		{
+			capacity *= 2;
+			hashes = (unsigned int *)realloc(hashes, capacity * sizeof(unsigned int));
+			values = (unsigned int *)realloc(values, capacity * sizeof(unsigned int));
+		}
+		hashes[count] = hashString(rec.id);
+		values[count] = count;
+		count++;
+	}
+	fclose(fp);
+	memcpy(header.magic, CATALOG_MAGIC, 8);
+	header.count = count;
+	rewind(out);
+	fwrite(&header, sizeof(header), 1, out);
+	int failed = fflush(out) != 0 || fsync(fileno(out)) != 0;
+	fclose(out);
+	if (failed || buildHashIndex(CATALOG_INDEX_FILE, hashes, values, count, 0) != 0 || rename(CATALOG_FILE ".tmp", CATALOG_FILE) != 0)
+	{
+		free(hashes);
+		free(values);
+		unlink(CATALOG_FILE ".tmp");
+		return -1;
+	}
+	free(hashes);
+	free(values);
+	return count;
+}
+
+int openCatalog(struct catalog *cat)
+{
+	cat->fd = open(CATALOG_FILE, O_RDWR);
+	if (cat->fd == -1)
+	{
+		if (errno != ENOENT || convertBookStore() == -1)
+		{
+			return -1;
+		}
+		cat->fd = open(CATALOG_FILE, O_RDWR);
+		if (cat->fd == -1)
+		{
+			return -1;
+		}
+	}
+	struct catalogHeader header;
+	if (pread(cat->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, CATALOG_MAGIC, 8) != 0)
+	{
+		close(cat->fd);
+		return -1;
+	}
+	cat->count = header.count;
+	if (openHashIndex(CATALOG_INDEX_FILE, &cat->index) != 0)
+	{
+		if (rebuildCatalogIndex(cat) != 0 || openHashIndex(CATALOG_INDEX_FILE, &cat->index) != 0)
+		{
+			close(cat->fd);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void closeCatalog(struct catalog *cat)
+{
+	closeHashIndex(&cat->index);
+	close(cat->fd);
+}
+
+int readBookRecord(struct catalog *cat, int record, struct bookRecord *rec)
+{
+	if (pread(cat->fd, rec, sizeof(*rec), (off_t)(record + 1) * sizeof(*rec)) != sizeof(*rec))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+int readBookRecords(struct catalog *cat, int *records, int n, struct bookRecord *recs)
+{
+	struct ioRequest *requests = (struct ioRequest *)calloc(n > 0 ? n : 1, sizeof(struct ioRequest));
+	for (int i = 0; i < n; i++)
+	{
+		requests[i].op = IO_READ;
+		requests[i].fd = cat->fd;
+		requests[i].buffer = &recs[i];
+		requests[i].size = sizeof(struct bookRecord);
+		requests[i].offset = (off_t)(records[i] + 1) * sizeof(struct bookRecord);
+	}
+	int ret = runIO(requests, n);
+	free(requests);
+	return ret;
+}
+
+int writeBookRecord(struct catalog *cat, int record, struct bookRecord *rec)
+{
+	if (pwrite(cat->fd, rec, sizeof(*rec), (off_t)(record + 1) * sizeof(*rec)) != sizeof(*rec))
+	{
+		return -1;
+	}
+	return 0;
+}
+
+int writeBookCounter(struct catalog *cat, int record, size_t field, int value)
+{
+	pthread_mutex_lock(&CATALOG_LOCK);
+	long stamp = record < BOOKS.count ? fileStamp(cat->fd) : -1;
+	if (pwrite(cat->fd, &value, sizeof(value), (off_t)(record + 1) * sizeof(struct bookRecord) + field) != sizeof(value))
+	{
+		pthread_mutex_unlock(&CATALOG_LOCK);
+		return -1;
+	}
+	// Our own write only needs the one row patched, as long as nobody else wrote since the compact catalog was loaded
+	if (stamp != -1 && stamp == BOOKS.stamp)
+	{
+		struct compactBook *book = &BOOKS.books[record];
+		if (field == BOOK_QUANTITY_OFFSET)
+		{
+			setCompactCounts(book, value, book->issued);
+		}
+		else
+		{
+			setCompactCounts(book, book->quantity, value);
+		}
+		BOOKS.stamp = fileStamp(cat->fd);
+	}
+	pthread_mutex_unlock(&CATALOG_LOCK);
+	return 0;
+}
+
+int writeBookCounters(struct catalog *cat, int *records, int n, size_t field, int *values)
+{
+	struct ioRequest *requests = (struct ioRequest *)calloc(n > 0 ? n : 1, sizeof(struct ioRequest));
+	for (int i = 0; i < n; i++)
+	{
+		requests[i].op = IO_WRITE;
+		requests[i].fd = cat->fd;
+		requests[i].buffer = &values[i];
+		requests[i].size = sizeof(int);
+		requests[i].offset = (off_t)(records[i] + 1) * sizeof(struct bookRecord) + field;
+	}
+	pthread_mutex_lock(&CATALOG_LOCK);
+	long stamp = fileStamp(cat->fd);
+	int ret = runIO(requests, n);
+	if (ret == 0 && stamp == BOOKS.stamp)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			if (records[i] >= BOOKS.count)
+			{
+				continue;
+			}
+			struct compactBook *book = &BOOKS.books[records[i]];
+			if (field == BOOK_QUANTITY_OFFSET)
+			{
+				setCompactCounts(book, values[i], book->issued);
+			}
+			else
+			{
+				setCompactCounts(book, book->quantity, values[i]);
+			}
+		}
+		BOOKS.stamp = fileStamp(cat->fd);
+	}
+	pthread_mutex_unlock(&CATALOG_LOCK);
+	free(requests);
+	return ret;
+}
+
+int findBookRecord(struct catalog *cat, char *id, struct bookRecord *rec, int *record)
+{
+	struct hashProbe probe;
+	unsigned int value;
+	startHashProbe(&cat->index, hashString(id), &probe);
+	for (;;)
+	{
+		int ret = probeHashIndex(&cat->index, &probe, &value);
+		if (ret != 0)
+		{
+			return ret;
+		}
+		if (readBookRecord(cat, value, rec) != 0)
+		{
+			return -1;
+		}
+		if (strcmp(rec->id, id) == 0)
+		{
+			if (record != NULL)
+			{
+				*record = value;
+			}
+			return 0;
+		}
+	}
+}
+
+int findBookRecords(struct catalog *cat, char **ids, int n, int *records, int *rets)
+{
+	struct hashProbe *probes = (struct hashProbe *)malloc((n > 0 ? n : 1) * sizeof(struct hashProbe));
+	struct ioRequest *requests = (struct ioRequest *)malloc((n > 0 ? n : 1) * sizeof(struct ioRequest));
+	int *active = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	// The candidate records land in the registered arena when they fit
+	struct bookRecord *recs = (struct bookRecord *)reserveIOBuffer(n * sizeof(struct bookRecord));
+	int arena = recs != NULL;
+	if (!arena)
+	{
+		recs = (struct bookRecord *)malloc((n > 0 ? n : 1) * sizeof(struct bookRecord));
+	}
+	for (int i = 0; i < n; i++)
+	{
+		startHashProbe(&cat->index, hashString(ids[i]), &probes[i]);
+		rets[i] = 1;
+		active[i] = i;
+	}
+	int nactive = n;
+	int ret = 0;
+	while (nactive > 0 && ret == 0)
+	{
+		// Every probe that walked off its window reads the next one in a single batch
+		unsigned int value;
+		int m = 0;
+		for (int a = 0; a < nactive; a++)
+		{
+			int i = active[a];
+			if (probes[i].slot < probes[i].windowStart || probes[i].slot >= probes[i].windowStart + probes[i].windowSize)
+			{
+				hashWindowRequest(&cat->index, &probes[i], &requests[m++]);
+			}
+		}
+		if (m > 0 && runIO(requests, m) != 0)
+		{
+			ret = -1;
+			break;
+		}
+		// Then every probe walks to its next candidate and the candidates are read in a second batch
+		int kept = 0;
+		m = 0;
+		for (int a = 0; a < nactive; a++)
+		{
+			int i = active[a];
+			int step = stepHashProbe(&cat->index, &probes[i], &value);
+			if (step == 1)
+			{
+				continue;
+			}
+			active[kept++] = i;
+			if (step == 0)
+			{
+				records[i] = value;
+				memset(&requests[m], 0, sizeof(requests[m]));
+				requests[m].op = IO_READ;
+				requests[m].fd = cat->fd;
+				requests[m].buffer = &recs[i];
+				requests[m].size = sizeof(struct bookRecord);
+				requests[m].offset = (off_t)(value + 1) * sizeof(struct bookRecord);
+				m++;
+			}
+		}
+		nactive = kept;
+		if (m > 0 && runIO(requests, m) != 0)
+		{
+			ret = -1;
+			break;
+		}
+		kept = 0;
+		for (int a = 0; a < m; a++)
+		{
+			int i = (struct bookRecord *)requests[a].buffer - recs;
+			if (strcmp(recs[i].id, ids[i]) == 0)
+			{
+				rets[i] = 0;
+			}
+		}
+		for (int a = 0; a < nactive; a++)
+		{
+			if (rets[active[a]] != 0)
+			{
+				active[kept++] = active[a];
+			}
+		}
+		nactive = kept;
+	}
+	if (ret == -1)
+	{
+		for (int a = 0; a < nactive; a++)
+		{
+			rets[active[a]] = -1;
+		}
+	}
+	if (arena)
+	{
+		releaseIOBuffer(recs);
+	}
+	else
+	{
+		free(recs);
+	}
+	free(probes);
+	free(requests);
+	free(active);
+	return ret;
+}
+
+int appendBookRecord(struct catalog *cat, struct bookRecord *rec)
+{
+	return appendBookRecords(cat, rec, 1);
+}
+
+int appendBookRecords(struct catalog *cat, struct bookRecord *recs, int n)
+{
+	struct catalogHeader header;
+	if (pread(cat->fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		return -1;
+	}
+	int record = header.count;
+	pthread_mutex_lock(&CATALOG_LOCK);
+	long stamp = fileStamp(cat->fd);
+	ssize_t want = n * sizeof(struct bookRecord);
+	if (pwrite(cat->fd, recs, want, (off_t)(record + 1) * sizeof(struct bookRecord)) != want)
+	{
+		pthread_mutex_unlock(&CATALOG_LOCK);
+		return -1;
+	}
+	header.count += n;
+	if (pwrite(cat->fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		pthread_mutex_unlock(&CATALOG_LOCK);
+		return -1;
+	}
+	cat->count = header.count;
+	if (BOOKS.count == record && BOOKS.stamp == stamp)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			addCompactBook(&recs[i]);
+		}
+		BOOKS.stamp = fileStamp(cat->fd);
+	}
+	if (TRIGRAMS.indexed == record)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			indexBookTrigrams(record + i, &recs[i]);
+		}
+		TRIGRAMS.indexed = cat->count;
+	}
+	pthread_mutex_unlock(&CATALOG_LOCK);
+	unsigned int *hashes = (unsigned int *)malloc(n * sizeof(unsigned int));
+	unsigned int *values = (unsigned int *)malloc(n * sizeof(unsigned int));
+	for (int i = 0; i < n; i++)
+	{
+		hashes[i] = hashString(recs[i].id);
+		values[i] = record + i;
+	}
+	int ret = insertHashIndexEntries(&cat->index, hashes, values, n);
+	free(hashes);
+	free(values);
+	return ret;
+}
+
+int setIssuedCount(char *id, int issued)
+{
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		return -1;
+	}
+	struct bookRecord rec;
+	int record;
+	int ret = findBookRecord(&cat, id, &rec, &record);
+	if (ret == 0)
+	{
+		ret = writeBookCounter(&cat, record, BOOK_ISSUED_OFFSET, issued);
+	}
+	closeCatalog(&cat);
+	return ret;
+}
+
+int openBookCursor(struct bookCursor *cursor, int offset)
+{
+	if (openCatalog(&cursor->cat) != 0)
+	{
+		return -1;
+	}
+	cursor->next = offset < 0 ? 0 : offset;
+	cursor->buffered = 0;
+	cursor->used = 0;
+	return 0;
+}
+
+int nextBook(struct bookCursor *cursor, struct bookClass *book)
+{
+	if (cursor->used == cursor->buffered)
+	{
+		if (cursor->next >= cursor->cat.count)
+		{
+			return 1;
+		}
+		int n = cursor->cat.count - cursor->next < 16 ? cursor->cat.count - cursor->next : 16;
+		ssize_t want = n * sizeof(struct bookRecord);
+		if (pread(cursor->cat.fd, cursor->buffer, want, (off_t)(cursor->next + 1) * sizeof(struct bookRecord)) != want)
+		{
+			return -1;
+		}
+		cursor->buffered = n;
+		cursor->used = 0;
+	}
+	struct bookRecord *rec = &cursor->buffer[cursor->used++];
+	cursor->next++;
+	strcpy(book->id, rec->id);
+	strcpy(book->bookTitle, rec->bookTitle);
+	strcpy(book->author, rec->author);
+	book->quantity = rec->quantity;
+	book->issued = rec->issued;
+	return 0;
+}
+
+void closeBookCursor(struct bookCursor *cursor)
+{
+	closeCatalog(&cursor->cat);
+}
+
+void openRecordStream(struct recordStream *stream, struct catalog *cat, int first, int last)
+{
+	stream->fd = cat->fd;
+	stream->next = first;
+	stream->last = last;
+	stream->head = 0;
+	stream->inFlight = 0;
+	unsigned int size = IO_STREAM_DEPTH * IO_STREAM_RECORDS * sizeof(struct bookRecord);
+	stream->buffer = (struct bookRecord *)reserveIOBuffer(size);
+	stream->arena = stream->buffer != NULL;
+	if (!stream->arena)
+	{
+		stream->buffer = (struct bookRecord *)malloc(size);
+	}
+}
+
+int nextRecords(struct recordStream *stream, struct bookRecord **recs)
+{
+	// The chunk handed out last time is free again, every free chunk is put back in flight before waiting on the oldest
+	while (stream->inFlight < IO_STREAM_DEPTH && stream->next < stream->last)
+	{
+		int chunk = (stream->head + stream->inFlight) % IO_STREAM_DEPTH;
+		int n = stream->last - stream->next < IO_STREAM_RECORDS ? stream->last - stream->next : IO_STREAM_RECORDS;
+		struct ioRequest *request = &stream->requests[chunk];
+		memset(request, 0, sizeof(*request));
+		request->op = IO_READ;
+		request->fd = stream->fd;
+		request->buffer = stream->buffer + chunk * IO_STREAM_RECORDS;
+		request->size = n * sizeof(struct bookRecord);
+		request->offset = (off_t)(stream->next + 1) * sizeof(struct bookRecord);
+		startIO(&stream->batches[chunk], request, 1);
+		stream->next += n;
+		stream->inFlight++;
+	}
+	if (stream->inFlight == 0)
+	{
+		return 0;
+	}
+	int chunk = stream->head;
+	stream->head = (stream->head + 1) % IO_STREAM_DEPTH;
+	stream->inFlight--;
+	if (finishIO(&stream->batches[chunk]) != 0)
+	{
+		return -1;
+	}
+	*recs = stream->buffer + chunk * IO_STREAM_RECORDS;
+	return stream->requests[chunk].size / sizeof(struct bookRecord);
+}
+
+void closeRecordStream(struct recordStream *stream)
+{
+	while (stream->inFlight > 0)
+	{
+		finishIO(&stream->batches[stream->head]);
+		stream->head = (stream->head + 1) % IO_STREAM_DEPTH;
+		stream->inFlight--;
+	}
+	if (stream->arena)
+	{
+		releaseIOBuffer(stream->buffer);
+	}
+	else
+	{
+		free(stream->buffer);
+	}
+}
+
+int rebuildCatalogIndex(struct catalog *cat)
+{
+	unsigned int *hashes = (unsigned int *)malloc((cat->count + 1) * sizeof(unsigned int));
+	unsigned int *values = (unsigned int *)malloc((cat->count + 1) * sizeof(unsigned int));
+	struct recordStream stream;
+	struct bookRecord *recs;
+	int n;
+	openRecordStream(&stream, cat, 0, cat->count);
+	for (int i = 0; (n = nextRecords(&stream, &recs)) > 0;)
+	{
+		for (int j = 0; j < n; j++, i++)
+		{
+			hashes[i] = hashString(recs[j].id);
+			values[i] = i;
+		}
+	}
+	closeRecordStream(&stream);
+	int ret = n == -1 ? -1 : 0;
+	if (ret == 0)
+	{
+		ret = buildHashIndex(CATALOG_INDEX_FILE, hashes, values, cat->count, 0);
+	}
+	free(hashes);
+	free(values);
+	return ret;
+}
+
+int openLockFile()
+{
+	return open(LOCK_FILE, O_RDWR | O_CREAT, 0644);
+}
+
+int lockRange(int fd, short type, off_t start, off_t length)
+{
+	struct flock lock;
+	memset(&lock, 0, sizeof(lock));
+	lock.l_type = type;
+	lock.l_whence = SEEK_SET;
+	lock.l_start = start;
+	lock.l_len = length;
+#ifdef F_OFD_SETLKW
+	while (fcntl(fd, F_OFD_SETLKW, &lock) != 0)
+#else
+	// fcntl locks belong to the process there, they would neither keep the daemon threads apart nor survive
+	// another thread closing its descriptor of the same file
+	while (flock(fd, type == F_WRLCK ? LOCK_EX : type == F_RDLCK ? LOCK_SH : LOCK_UN) != 0)
+#endif
+	{
+		if (errno != EINTR)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void unlockRange(int fd, off_t start, off_t length)
+{
+	lockRange(fd, F_UNLCK, start, length);
+}
+
+int lockBookRecord(struct catalog *cat, int record, short type)
+{
+	return lockRange(cat->fd, type, (off_t)(record + 1) * sizeof(struct bookRecord), sizeof(struct bookRecord));
+}
+
+int lockBookRecords(struct catalog *cat, int *records, int n)
+{
+	int *order = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	memcpy(order, records, n * sizeof(int));
+	qsort(order, n, sizeof(int), compareInt);
+	int ret = 0;
+	for (int i = 0; i < n && ret == 0; i++)
+	{
+		ret = lockBookRecord(cat, order[i], F_WRLCK);
+	}
+	free(order);
+	return ret;
+}
+
+off_t shardLock(char *token)
+{
+	return LOCK_SHARDS + hashString(token) % LOCK_SHARD_SLOTS;
+}
+
+int lockShards(int fd, char **tokens, int n)
+{
+	int *order = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	for (int i = 0; i < n; i++)
+	{
+		order[i] = shardLock(tokens[i]);
+	}
+	qsort(order, n, sizeof(int), compareInt);
+	int ret = 0;
+	for (int i = 0; i < n && ret == 0; i++)
+	{
+		// Users whose shards share a byte share its lock
+		if (i == 0 || order[i] != order[i - 1])
+		{
+			ret = lockRange(fd, F_WRLCK, order[i], 1);
+		}
+	}
+	free(order);
+	return ret;
+}
+
+int compareInt(const void *a, const void *b)
+{
+	int x = *(int *)a;
+	int y = *(int *)b;
+	return x < y ? -1 : x > y;
+}
+
+int beginJournal(struct journal *log)
+{
+	log->fd = open(JOURNAL_FILE, O_RDWR | O_APPEND | O_CREAT, 0644);
+	if (log->fd == -1)
+	{
+		return -1;
+	}
+	if (flock(log->fd, LOCK_SH) != 0)
+	{
+		close(log->fd);
+		return -1;
+	}
+	log->end = 0;
+	return 0;
+}
+
+int logJournal(struct journal *log, struct journalEntry *entry)
+{
+	return logJournalEntries(log, entry, 1);
+}
+
+int logJournalEntries(struct journal *log, struct journalEntry *entries, int n)
+{
+	for (int i = 0; i < n; i++)
+	{
+		entries[i].magic = JOURNAL_MAGIC;
+		entries[i].checksum = 0;
+		entries[i].checksum = hashBytes(&entries[i], sizeof(entries[i]));
+	}
+	// The append is in flight while we wait for the commit lock
+	struct ioRequest append = {.op = IO_WRITE, .fd = log->fd, .buffer = entries, .size = n * sizeof(struct journalEntry), .offset = -1};
+	struct ioBatch batch;
+	startIO(&batch, &append, 1);
+	// Group commit: the sync file remembers how far the journal is already durable
+	// A caller whose entry was covered by somebody else's fsync while it waited for the lock returns straight away
+	int sfd = open(JOURNAL_SYNC_FILE, O_RDWR | O_CREAT, 0644);
+	int locked = sfd != -1 && flock(sfd, LOCK_EX) == 0;
+	if (finishIO(&batch) != 0 || !locked)
+	{
+		if (sfd != -1)
+		{
+			close(sfd);
+		}
+		return batch.failed ? -1 : fdatasync(log->fd);
+	}
+	log->end = lseek(log->fd, 0, SEEK_CUR);
+	off_t durable = 0;
+	if (pread(sfd, &durable, sizeof(durable), 0) != sizeof(durable))
+	{
+		durable = 0;
+	}
+	int ret = 0;
+	if (durable < log->end)
+	{
+		// The new mark is linked behind the sync, so it is only written once everything up to it is durable
+		struct stat st;
+		fstat(log->fd, &st);
+		durable = st.st_size;
+		struct ioRequest commit[2] = {{.op = IO_SYNC, .fd = log->fd, .linked = 1}, {.op = IO_WRITE, .fd = sfd, .buffer = &durable, .size = sizeof(durable), .offset = 0}};
+		runIO(commit, 2);
+		ret = commit[0].result == 0 ? 0 : -1;
+	}
+	flock(sfd, LOCK_UN);
+	close(sfd);
+	return ret;
+}
+
+void endJournal(struct journal *log)
+{
+	flock(log->fd, LOCK_UN);
+	close(log->fd);
+	if (log->end > JOURNAL_CHECKPOINT_SIZE)
+	{
+		checkpointJournal();
+	}
+	// A process that serves snapshots publishes its own writes, so its readers never find the catalog newer than their version
+	if (atomic_load(&CATALOG_VERSION) != NULL)
+	{
+		refreshCatalog(0);
+	}
+}
+
+int issueBooks(char *token, char **ids, int n, time_t time, int *statuses)
+{
+	int forwarded;
+	if (forwardCall(OP_ISSUE_BOOKS, &forwarded, "sivl>b", token, n, ids, n, (long)time, statuses, sizeof(int) * n))
+	{
+		return forwarded;
+	}
+	int lock = openLockFile();
+	if (lock == -1 || lockRange(lock, F_WRLCK, shardLock(token), 1) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		return -1;
+	}
+	struct resultSet held;
+	initResultSet(&held);
+	if (readIssuedBooks(token, &held) == -1)
+	{
+		close(lock);
+		return -1;
+	}
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		freeResultSet(&held);
+		close(lock);
+		return -1;
+	}
+	struct journalEntry *entries = (struct journalEntry *)calloc(n > 0 ? n : 1, sizeof(struct journalEntry));
+	int *records = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	int *positions = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	int *rets = (int *)malloc((n > 0 ? n : 1) * sizeof(int));
+	char **lookups = (char **)malloc((n > 0 ? n : 1) * sizeof(char *));
+	int found = 0;
+	for (int i = 0; i < n; i++)
+	{
+		statuses[i] = 0;
+		for (struct bookInfoList *list = firstResult(&held); list != NULL && statuses[i] == 0; list = nextResult(list))
+		{
+			if (strcmp(list->book.id, ids[i]) == 0)
+			{
+				statuses[i] = 2;
+			}
+		}
+		for (int j = 0; j < i && statuses[i] == 0; j++)
+		{
+			if (strcmp(ids[j], ids[i]) == 0)
+			{
+				statuses[i] = 2;
+			}
+		}
+		if (statuses[i] != 0)
+		{
+			continue;
+		}
+		lookups[found] = ids[i];
+		positions[found++] = i;
+	}
+	freeResultSet(&held);
+	// Every book of the batch is looked up and read together, rather than one chain of reads after the other
+	findBookRecords(&cat, lookups, found, records, rets);
+	int looked = found;
+	found = 0;
+	for (int k = 0; k < looked; k++)
+	{
+		if (rets[k] != 0)
+		{
+			statuses[positions[k]] = rets[k] == -1 ? -1 : 1;
+			continue;
+		}
+		records[found] = records[k];
+		positions[found++] = positions[k];
+	}
+	// The counts are only read once the records are locked, so a concurrent issue can not hand out the same last copy
+	int ret = lockBookRecords(&cat, records, found);
+	struct bookRecord *recs = (struct bookRecord *)malloc((found > 0 ? found : 1) * sizeof(struct bookRecord));
+	if (ret == 0 && readBookRecords(&cat, records, found, recs) != 0)
+	{
+		for (int k = 0; k < found; k++)
+		{
+			statuses[positions[k]] = -1;
+		}
+		found = 0;
+	}
+	int accepted = 0;
+	for (int k = 0; k < found && ret == 0; k++)
+	{
+		struct bookRecord rec = recs[k];
+		int i = positions[k];
+		if (rec.quantity <= rec.issued)
+		{
+			statuses[i] = 1;
+			continue;
+		}
+		records[accepted] = records[k];
+		struct journalEntry *entry = &entries[accepted++];
+		entry->type = JOURNAL_ISSUE;
+		entry->issued = rec.issued + 1;
+		entry->time = time;
+		strncpy(entry->token, token, sizeof(entry->token) - 1);
+		entry->book = rec;
+	}
+	free(positions);
+	free(lookups);
+	free(recs);
+	ret = ret == 0 ? accepted : -1;
+	struct journal log;
+	if (accepted > 0)
+	{
+		if (beginJournal(&log) != 0)
+		{
+			ret = -1;
+		}
+		else if (logJournalEntries(&log, entries, accepted) != 0)
+		{
+			endJournal(&log);
+			ret = -1;
+		}
+	}
+	if (ret > 0)
+	{
+		// Every loan goes into the shard with one append and every count is set through the one open catalog
+		struct bookInfo *books = (struct bookInfo *)malloc(accepted * sizeof(struct bookInfo));
+		for (int i = 0; i < accepted; i++)
+		{
+			snprintf(books[i].id, sizeof(books[i].id), "%s", entries[i].book.id);
+			snprintf(books[i].bookTitle, sizeof(books[i].bookTitle), "%s", entries[i].book.bookTitle);
+			snprintf(books[i].author, sizeof(books[i].author), "%s", entries[i].book.author);
+		}
+		if (addIssuedBooks(token, books, accepted, time) != 0)
+		{
+			ret = -2;
+		}
+		int *counts = (int *)malloc(accepted * sizeof(int));
+		for (int i = 0; i < accepted; i++)
+		{
+			counts[i] = entries[i].issued;
+		}
+		if (ret != -2 && writeBookCounters(&cat, records, accepted, BOOK_ISSUED_OFFSET, counts) != 0)
+		{
+			ret = -2;
+		}
+		free(counts);
+		free(books);
+		endJournal(&log);
+	}
+	if (ret == -1)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			statuses[i] = statuses[i] == 0 ? -1 : statuses[i];
+		}
+	}
+	free(entries);
+	free(records);
+	free(rets);
+	closeCatalog(&cat);
+	close(lock);
+	return ret;
+}
+
+int returnBooks(char **tokens, char **ids, int n, int *statuses)
+{
+	int forwarded;
+	if (forwardCall(OP_RETURN_BOOKS, &forwarded, "ivv>b", n, tokens, n, ids, n, statuses, sizeof(int) * n))
+	{
+		return forwarded;
+	}
+	if (n <= 0)
+	{
+		return 0;
+	}
+	// Pairs sorted by token and then id, so that the pairs of every user form one run
+	struct returnPair *pairs = (struct returnPair *)malloc(n * sizeof(struct returnPair));
+	for (int i = 0; i < n; i++)
+	{
+		pairs[i].token = tokens[i];
+		pairs[i].id = ids[i];
+		pairs[i].position = i;
+		statuses[i] = 1;
+	}
+	qsort(pairs, n, sizeof(struct returnPair), compareReturn);
+	// Every shard of the batch stays locked from the check of its loans until they are gone from it
+	int lock = openLockFile();
+	if (lock == -1 || lockShards(lock, tokens, n) != 0)
+	{
+		if (lock != -1)
+		{
+			close(lock);
+		}
+		for (int i = 0; i < n; i++)
+		{
+			statuses[i] = -1;
+		}
+		free(pairs);
+		return -1;
+	}
+	struct journalEntry *entries = (struct journalEntry *)calloc(n, sizeof(struct journalEntry));
+	int accepted = 0;
+	for (int start = 0, end; start < n; start = end)
+	{
+		end = start + 1;
+		while (end < n && strcmp(pairs[end].token, pairs[start].token) == 0)
+		{
+			end++;
+		}
+		struct resultSet held;
+		initResultSet(&held);
+		if (validateToken(pairs[start].token) == 0 && readIssuedBooks(pairs[start].token, &held) != -1)
+		{
+			// Each loan held can take back one pair of the run
+			for (struct bookInfoList *list = firstResult(&held); list != NULL; list = nextResult(list))
+			{
+				for (int i = start; i < end; i++)
+				{
+					if (statuses[pairs[i].position] == 1 && strcmp(pairs[i].id, list->book.id) == 0)
+					{
+						statuses[pairs[i].position] = 0;
+						break;
+					}
+				}
+			}
+		}
+		freeResultSet(&held);
+		for (int i = start; i < end; i++)
+		{
+			if (statuses[pairs[i].position] == 0)
+			{
+				struct journalEntry *entry = &entries[accepted++];
+				entry->type = JOURNAL_RETURN;
+				strncpy(entry->token, pairs[i].token, sizeof(entry->token) - 1);
+				strncpy(entry->book.id, pairs[i].id, sizeof(entry->book.id) - 1);
+			}
+		}
+	}
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		free(entries);
+		free(pairs);
+		close(lock);
+		return -1;
+	}
+	// The accepted returns sorted by id and then log position put every book in one run
+	// Each entry logs the count left after it, so a replay stopped halfway through a run is still right
+	struct returnPair *books = (struct returnPair *)malloc((accepted > 0 ? accepted : 1) * sizeof(struct returnPair));
+	for (int i = 0; i < accepted; i++)
+	{
+		books[i].token = "";
+		books[i].id = entries[i].book.id;
+		books[i].position = i;
+	}
+	qsort(books, accepted, sizeof(struct returnPair), compareReturn);
+	// records holds the record of the book of every run, counts its lookup result and then the count it is left with
+	int *records = (int *)malloc((accepted > 0 ? accepted : 1) * sizeof(int));
+	int *counts = (int *)malloc((accepted > 0 ? accepted : 1) * sizeof(int));
+	char **runIds = (char **)malloc((accepted > 0 ? accepted : 1) * sizeof(char *));
+	int runCount = 0;
+	int ret = accepted;
+	for (int start = 0, end; start < accepted; start = end)
+	{
+		runIds[runCount++] = books[start].id;
+		for (end = start; end < accepted && strcmp(books[end].id, books[start].id) == 0; end++)
+		{
+		}
+	}
+	// The books of every run are looked up in one batch and, once all of them are locked, read in another
+	if (findBookRecords(&cat, runIds, runCount, records, counts) != 0)
+	{
+		ret = -1;
+	}
+	for (int r = 0; r < runCount; r++)
+	{
+		ret = counts[r] != 0 ? -1 : ret;
+	}
+	if (ret != -1 && lockBookRecords(&cat, records, runCount) != 0)
+	{
+		ret = -1;
+	}
+	struct bookRecord *recs = (struct bookRecord *)malloc((runCount > 0 ? runCount : 1) * sizeof(struct bookRecord));
+	if (ret != -1 && readBookRecords(&cat, records, runCount, recs) != 0)
+	{
+		ret = -1;
+	}
+	for (int start = 0, end, r = 0; start < accepted && ret != -1; start = end, r++)
+	{
+		end = start;
+		while (end < accepted && strcmp(books[end].id, books[start].id) == 0)
+		{
+			entries[books[end].position].issued = recs[r].issued - (end - start + 1);
+			end++;
+		}
+		counts[r] = entries[books[end - 1].position].issued;
+	}
+	free(recs);
+	free(runIds);
+	struct journal log;
+	if (ret > 0)
+	{
+		if (beginJournal(&log) != 0)
+		{
+			ret = -1;
+		}
+		else if (logJournalEntries(&log, entries, accepted) != 0)
+		{
+			endJournal(&log);
+			ret = -1;
+		}
+	}
+	if (ret > 0)
+	{
+		// One rewrite of the shard of every user and one counter write for every book
+		char **group = (char **)malloc(accepted * sizeof(char *));
+		for (int start = 0, end; start < accepted; start = end)
+		{
+			for (end = start; end < accepted && strcmp(entries[end].token, entries[start].token) == 0; end++)
+			{
+				group[end - start] = entries[end].book.id;
+			}
+			if (removeIssuedBooks(entries[start].token, group, end - start) != end - start)
+			{
+				ret = -2;
+			}
+		}
+		free(group);
+		if (writeBookCounters(&cat, records, runCount, BOOK_ISSUED_OFFSET, counts) != 0)
+		{
+			ret = -2;
+		}
+		endJournal(&log);
+	}
+	if (ret == -1)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			statuses[i] = statuses[i] == 0 ? -1 : statuses[i];
+		}
+	}
+	free(records);
+	free(counts);
+	free(books);
+	free(entries);
+	free(pairs);
+	closeCatalog(&cat);
+	close(lock);
+	return ret;
+}
+
+int runJournalEntry(struct journalEntry *entry)
+{
+	struct journal log;
+	if (beginJournal(&log) != 0)
+	{
+		return -1;
+	}
+	if (logJournal(&log, entry) != 0)
+	{
+		endJournal(&log);
+		return -1;
+	}
+	int ret = applyJournalEntry(entry);
+	endJournal(&log);
+	return ret == 0 ? 0 : -2;
+}
+
+int applyJournalEntry(struct journalEntry *entry)
+{
+	if (entry->type == JOURNAL_PURCHASE)
+	{
+		struct catalog cat;
+		if (openCatalog(&cat) != 0)
+		{
+			return -1;
+		}
+		struct bookRecord rec;
+		int ret = findBookRecord(&cat, entry->book.id, &rec, NULL);
+		if (ret == 1)
+		{
+			ret = appendBookRecord(&cat, &entry->book);
+		}
+		closeCatalog(&cat);
+		return ret;
+	}
+	int held = findIssuedBook(entry->token, entry->book.id);
+	if (held == -1)
+	{
+		return -1;
+	}
+	if (entry->type == JOURNAL_ISSUE && held == 1)
+	{
+		struct bookInfo book;
+		strcpy(book.id, entry->book.id);
+		strncpy(book.bookTitle, entry->book.bookTitle, sizeof(book.bookTitle) - 1);
+		book.bookTitle[sizeof(book.bookTitle) - 1] = '\0';
+		strncpy(book.author, entry->book.author, sizeof(book.author) - 1);
+		book.author[sizeof(book.author) - 1] = '\0';
+		if (addIssuedBook(entry->token, book, entry->time) != 0)
+		{
+			return -1;
+		}
+	}
+	else if (entry->type == JOURNAL_RETURN && held == 0)
+	{
+		if (removeIssuedBook(entry->token, entry->book.id) == -1)
+		{
+			return -1;
+		}
+	}
+	return setIssuedCount(entry->book.id, entry->issued) == -1 ? -1 : 0;
+}
+
+int issuedShardPath(char *token, char *path)
+{
+	if (validateToken(token) != 0 || splitIssuedBooks() != 0)
+	{
+		return -1;
+	}
+	sprintf(path, "%s/%s.txt", ISSUED_DIR, token);
+	return 0;
+}
+
+int splitIssuedBooks()
+{
+	struct stat st;
+	if (stat(ISSUED_DIR, &st) == 0)
+	{
+		return 0;
+	}
+	// The shards are written to a private directory which is renamed into place, so readers never see half of them
+	char tmp[] = ISSUED_DIR ".XXXXXX";
+	if (mkdtemp(tmp) == NULL)
+	{
+		return -1;
+	}
+	FILE *fp;
+	fp = fopen("Server/issuedBooks.txt", "r");
+	int failed = 0;
+	if (fp != NULL)
+	{
+		FILE *out = NULL;
+		int skip = 0;
+		char line[50];
+		char path[150];
+		while (fgets(line, 50, fp))
+		{
+			if (line[0] == '\n')
+			{
+				if (out != NULL)
+				{
+					failed = fclose(out) != 0;
+					out = NULL;
+				}
+				skip = 0;
+				if (failed)
+				{
+					break;
+				}
+				continue;
+			}
+			// The book lines of a block whose token is not valid go with it, they must never be read as tokens
+			if (skip)
+			{
+				continue;
+			}
+			if (out == NULL)
+			{
+				stripNewline(line);
+				if (validateToken(line) != 0)
+				{
+					skip = 1;
+					continue;
+				}
+				sprintf(path, "%s/%s.txt", tmp, line);
+				out = fopen(path, "a");
+				if (out == NULL)
+				{
+					failed = 1;
+					break;
+				}
+				continue;
+			}
+			fputs(line, out);
+		}
+		if (out != NULL && fclose(out) != 0)
+		{
+			failed = 1;
+		}
+		fclose(fp);
+	}
+	if (failed)
+	{
+		removeShardDirectory(tmp);
+		return -1;
+	}
+	if (rename(tmp, ISSUED_DIR) != 0)
+	{
+		// Another process finished the split first
+		removeShardDirectory(tmp);
+		return stat(ISSUED_DIR, &st) == 0 ? 0 : -1;
+	}
+	return 0;
+}
+
+void removeShardDirectory(char *path)
+{
+	DIR *dir = opendir(path);
+	struct dirent *ent;
+	char file[300];
+	while (dir != NULL && (ent = readdir(dir)) != NULL)
+	{
+		snprintf(file, sizeof(file), "%s/%s", path, ent->d_name);
+		unlink(file);
+	}
+	if (dir != NULL)
+	{
+		closedir(dir);
+	}
+	rmdir(path);
+}
+
+// fsyncs a Server file so that a checkpoint can drop the journal entries that produced it
+int syncFile(char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd == -1)
+	{
+		return errno == ENOENT ? 0 : -1;
+	}
+	int ret = fsync(fd);
+	close(fd);
+	return ret;
+}
+
+int checkpointJournal()
+{
+	int fd = open(JOURNAL_FILE, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	// The exclusive lock waits for every operation between beginJournal and endJournal
+	flock(fd, LOCK_EX);
+	// Only the shards named by the journal can hold changes that are not yet durable
+	int ret = 0;
+	struct journalEntry entry;
+	char path[100];
+	for (off_t offset = 0; ret == 0 && pread(fd, &entry, sizeof(entry), offset) == sizeof(entry); offset += sizeof(entry))
+	{
+		if (entry.type != JOURNAL_PURCHASE && issuedShardPath(entry.token, path) == 0)
+		{
+			ret = syncFile(path);
+		}
+	}
+	if (ret == 0 && (syncFile(ISSUED_DIR) != 0 || syncFile(CATALOG_FILE) != 0 || syncFile(CATALOG_INDEX_FILE) != 0))
+	{
+		ret = -1;
+	}
+	if (ret == 0)
+	{
+		ret = ftruncate(fd, 0);
+		if (ret == 0)
+		{
+			fsync(fd);
+			int sfd = open(JOURNAL_SYNC_FILE, O_RDWR | O_CREAT, 0644);
+			if (sfd != -1)
+			{
+				off_t durable = 0;
+				pwrite(sfd, &durable, sizeof(durable), 0);
+				close(sfd);
+			}
+		}
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	return ret;
+}
+
+int recoverJournal()
+{
+	int fd = open(JOURNAL_FILE, O_RDWR | O_CREAT, 0644);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	flock(fd, LOCK_EX);
+	struct journalEntry entry;
+	int replayed = 0;
+	off_t offset = 0;
+	while (pread(fd, &entry, sizeof(entry), offset) == sizeof(entry))
+	{
+		unsigned int checksum = entry.checksum;
+		entry.checksum = 0;
+		if (entry.magic != JOURNAL_MAGIC || hashBytes(&entry, sizeof(entry)) != checksum)
+		{
+			// A torn tail is an operation that never became durable, so it was never applied either
+			break;
+		}
+		entry.checksum = checksum;
+		if (applyJournalEntry(&entry) != 0)
+		{
+			flock(fd, LOCK_UN);
+			close(fd);
+			return -1;
+		}
+		replayed++;
+		offset += sizeof(entry);
+	}
+	// Every writer is kept out by the journal lock, so issues still pending on the due heap belong to processes that died
+	// Loans made before the heap existed are picked up here as well, instead of by the first issue after an upgrade
+	if (rebuildDueHeap(0, 1) != 0)
+	{
+		flock(fd, LOCK_UN);
+		close(fd);
+		return -1;
+	}
+	flock(fd, LOCK_UN);
+	close(fd);
+	if (checkpointJournal() != 0)
+	{
+		return -1;
+	}
+	return replayed;
+}
+
+// Packs three case folded characters into a non zero key
+unsigned int trigramKey(char *s)
+{
+	return (1u << 24) | ((unsigned int)(unsigned char)tolower(s[0]) << 16) | ((unsigned int)(unsigned char)tolower(s[1]) << 8) | (unsigned int)(unsigned char)tolower(s[2]);
+}
+
+// Finds the posting list of a trigram, adding an empty one if create is set
+struct postingList *findPostingList(struct trigramIndex *index, unsigned int key, int create)
+{
+	if (create && (index->used + 1) * 2 > index->capacity)
+	{
+		unsigned int capacity = index->capacity == 0 ? 4096 : index->capacity * 2;
+		unsigned int *keys = (unsigned int *)calloc(capacity, sizeof(unsigned int));
+		struct postingList *lists = (struct postingList *)calloc(capacity, sizeof(struct postingList));
+		for (unsigned int i = 0; i < index->capacity; i++)
+		{
+			if (index->keys[i] != 0)
+			{
+				unsigned int slot = hashBytes(&index->keys[i], sizeof(unsigned int)) & (capacity - 1);
+				while (keys[slot] != 0)
+				{
+					slot = (slot + 1) & (capacity - 1);
+				}
+				keys[slot] = index->keys[i];
+				lists[slot] = index->lists[i];
+			}
+		}
+		free(index->keys);
+		free(index->lists);
+		index->keys = keys;
+		index->lists = lists;
+		index->capacity = capacity;
+	}
+	if (index->capacity == 0)
+	{
+		return NULL;
+	}
+	unsigned int slot = hashBytes(&key, sizeof(key)) & (index->capacity - 1);
+	while (index->keys[slot] != 0)
+	{
+		if (index->keys[slot] == key)
+		{
+			return &index->lists[slot];
+		}
+		slot = (slot + 1) & (index->capacity - 1);
+	}
+	if (!create)
+	{
+		return NULL;
+	}
+	index->keys[slot] = key;
+	index->used++;
+	return &index->lists[slot];
+}
+
+void indexTextTrigrams(int record, int shard, char *text)
+{
+	int tlen = strlen(text);
+	for (int i = 0; i + 3 <= tlen; i++)
+	{
+		struct postingList *list = findPostingList(&TRIGRAMS, shardKey(trigramKey(&text[i]), shard), 1);
+		// Records are indexed in order, so a repeat of a trigram within one record is always the last posting
+		if (list->size > 0 && list->records[list->size - 1] == (unsigned int)record)
+		{
+			continue;
+		}
+		if (list->size == list->capacity)
+		{
+			list->capacity = list->capacity == 0 ? 4 : list->capacity * 2;
+			list->records = (unsigned int *)realloc(list->records, list->capacity * sizeof(unsigned int));
+		}
+		list->records[list->size++] = record;
+	}
+}
+
+void indexBookTrigrams(int record, struct bookRecord *rec)
+{
+	int shard = bookShard(rec->id);
+	indexTextTrigrams(record, shard, rec->id);
+	indexTextTrigrams(record, shard, rec->bookTitle);
+	indexTextTrigrams(record, shard, rec->author);
+}
+
+int bookShard(char *id)
+{
+	return hashString(id) % SEARCH_SHARDS;
+}
+
+unsigned int shardKey(unsigned int key, int shard)
+{
+	// Trigram keys take 25 bits, the shard goes above them
+	return key | (unsigned int)shard << 25;
+}
+
+int updateTrigramIndex(struct catalog *cat)
+{
+	if (cat->count < TRIGRAMS.indexed)
+	{
+		// The catalog was replaced underneath us, start over
+		for (unsigned int i = 0; i < TRIGRAMS.capacity; i++)
+		{
+			free(TRIGRAMS.lists[i].records);
+		}
+		free(TRIGRAMS.keys);
+		free(TRIGRAMS.lists);
+		memset(&TRIGRAMS, 0, sizeof(TRIGRAMS));
+	}
+	struct recordStream stream;
+	struct bookRecord *recs;
+	int n;
+	openRecordStream(&stream, cat, TRIGRAMS.indexed, cat->count);
+	while ((n = nextRecords(&stream, &recs)) > 0)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			indexBookTrigrams(TRIGRAMS.indexed + i, &recs[i]);
+		}
+		TRIGRAMS.indexed += n;
+	}
+	closeRecordStream(&stream);
+	return n == -1 ? -1 : 0;
+}
+
+int bookCandidates(struct catalogVersion *version, int shard, char *query, unsigned int **records)
+{
+	int n = trigramCandidates(&version->text->trigrams, shard, query, records);
+	if (n == -1)
+	{
+		// Queries shorter than a trigram match too much for the index to help, so the text column is scanned instead
+		struct textColumn *column = &version->text->column;
+		int first = (long)column->count * shard / SEARCH_SHARDS;
+		int last = (long)column->count * (shard + 1) / SEARCH_SHARDS;
+		n = scanTextColumnRange(column, first, last, query, records);
+	}
+	return n;
+}
+
+int scoreBook(char *pool, struct compactBook *row, char *query, int qlen, struct searchWeights *weights)
+{
+	unsigned int fields[3] = {row->id, row->bookTitle, row->author};
+	int score = 0;
+	// Every field starts with the empty string, it would give each book the prefix score
+	if (qlen == 0)
+	{
+		return 0;
+	}
+	for (int f = 0; f < 3; f++)
+	{
+		char *text = pool + fields[f];
+		if (strcmp(text, query) == 0)
+		{
+			score += weights->exact[f];
+		}
+		else if (strncmp(text, query, qlen) == 0)
+		{
+			score += weights->prefix[f];
+		}
+		else if (strstr(text, query) != NULL)
+		{
+			score += weights->substring[f];
+		}
+	}
+	return score;
+}
+
+int rankedBelow(struct rankedBook *a, struct rankedBook *b)
+{
+	return a->score < b->score || (a->score == b->score && a->record > b->record);
+}
+
+void siftRankedDown(struct rankedBook *heap, int size, int i)
+{
+	for (;;)
+	{
+		int lowest = i;
+		int left = 2 * i + 1;
+		int right = left + 1;
+		if (left < size && rankedBelow(&heap[left], &heap[lowest]))
+		{
+			lowest = left;
+		}
+		if (right < size && rankedBelow(&heap[right], &heap[lowest]))
+		{
+			lowest = right;
+		}
+		if (lowest == i)
+		{
+			return;
+		}
+		struct rankedBook tmp = heap[i];
+		heap[i] = heap[lowest];
+		heap[lowest] = tmp;
+		i = lowest;
+	}
+}
+
+void keepRanked(struct rankedBook *heap, int *size, int k, struct rankedBook hit)
+{
+	if (*size < k)
+	{
+		int j = (*size)++;
+		while (j > 0 && rankedBelow(&hit, &heap[(j - 1) / 2]))
+		{
+			heap[j] = heap[(j - 1) / 2];
+			j = (j - 1) / 2;
+		}
+		heap[j] = hit;
+	}
+	else if (k > 0 && rankedBelow(&heap[0], &hit))
+	{
+		heap[0] = hit;
+		siftRankedDown(heap, *size, 0);
+	}
+}
+
+void sortRanked(struct rankedBook *heap, int size)
+{
+	// Popping the weakest first fills the heap array from the back, leaving it sorted best first
+	for (int end = size - 1; end > 0; end--)
+	{
+		struct rankedBook weakest = heap[0];
+		heap[0] = heap[end];
+		heap[end] = weakest;
+		siftRankedDown(heap, end, 0);
+	}
+}
+
+int splitWords(char *text, char words[][50], int max)
+{
+	int n = 0;
+	while (*text != '\0' && n < max)
+	{
+		while (*text != '\0' && !isalnum((unsigned char)*text))
+		{
+			text++;
+		}
+		int len = 0;
+		while (isalnum((unsigned char)*text))
+		{
+			if (len < 49)
+			{
+				words[n][len++] = tolower((unsigned char)*text);
+			}
+			text++;
+		}
+		if (len > 0)
+		{
+			words[n++][len] = '\0';
+		}
+	}
+	return n;
+}
+
+int allowedEdits(int len)
+{
+	return len <= 3 ? 0 : len <= 6 ? 1 : 2;
+}
+
+int editDistance(char *a, int alen, char *b, int blen, int bound)
+{
+	if (abs(alen - blen) > bound)
+	{
+		return bound + 1;
+	}
+	int rows[3][50];
+	int *before = rows[0];
+	int *previous = rows[1];
+	int *row = rows[2];
+	for (int j = 0; j <= blen; j++)
+	{
+		previous[j] = j;
+	}
+	for (int i = 1; i <= alen; i++)
+	{
+		row[0] = i;
+		int lowest = i;
+		for (int j = 1; j <= blen; j++)
+		{
+			int cost = previous[j - 1] + (a[i - 1] != b[j - 1]);
+			if (previous[j] + 1 < cost)
+			{
+				cost = previous[j] + 1;
+			}
+			if (row[j - 1] + 1 < cost)
+			{
+				cost = row[j - 1] + 1;
+			}
+			if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1] && before[j - 2] + 1 < cost)
+			{
+				cost = before[j - 2] + 1;
+			}
+			row[j] = cost;
+			if (cost < lowest)
+			{
+				lowest = cost;
+			}
+		}
+		// A swap reaches back two rows, so the row before also has to be past the bound
+		if (lowest > bound && i > 1)
+		{
+			int lowestBefore = previous[0];
+			for (int j = 1; j <= blen; j++)
+			{
+				if (previous[j] < lowestBefore)
+				{
+					lowestBefore = previous[j];
+				}
+			}
+			if (lowestBefore > bound)
+			{
+				return bound + 1;
+			}
+		}
+		int *spare = before;
+		before = previous;
+		previous = row;
+		row = spare;
+	}
+	return previous[blen] > bound ? bound + 1 : previous[blen];
+}
+
+int fuzzyCandidates(struct shardSearch *search, int limit, struct rankedBook **candidates)
+{
+	unsigned int keys[FUZZY_MAX_WORDS * 48];
+	int nkeys = 0;
+	// Each edit breaks at most three of the distinct trigrams of a word, and shared counts distinct trigrams,
+	// so a match still shares every distinct trigram the edits allowed for the words can not reach
+	int breakable = 0;
+	for (int w = 0; w < search->nwords; w++)
+	{
+		char *word = search->words[w];
+		int wlen = strlen(word);
+		int wordKeys = 0;
+		for (int i = 0; i + 3 <= wlen; i++)
+		{
+			unsigned int key = trigramKey(&word[i]);
+			int repeat = 0;
+			for (int r = 0; r < i && !repeat; r++)
+			{
+				repeat = trigramKey(&word[r]) == key;
+			}
+			wordKeys += !repeat;
+			int seen = 0;
+			for (int j = 0; j < nkeys && !seen; j++)
+			{
+				seen = keys[j] == key;
+			}
+			if (!seen)
+			{
+				keys[nkeys++] = key;
+			}
+		}
+		breakable += wordKeys < 3 * allowedEdits(wlen) ? wordKeys : 3 * allowedEdits(wlen);
+	}
+	int needed = nkeys - breakable;
+	int count = search->version->count;
+	if (nkeys == 0)
+	{
+		// Only words shorter than a trigram, every book has to be checked
+		*candidates = (struct rankedBook *)malloc((count + 1) * sizeof(struct rankedBook));
+		for (int i = 0; i < count; i++)
+		{
+			(*candidates)[i].score = 0;
+			(*candidates)[i].record = i;
+		}
+		return count;
+	}
+	// A record belongs to one shard only, so the shards count into one array without getting in each other's way
+	search->keys = keys;
+	search->nkeys = nkeys;
+	search->needed = needed > 0 ? needed : 1;
+	search->k = limit;
+	search->shared = (unsigned short *)calloc(count + 1, sizeof(unsigned short));
+	runShards(fuzzyShard, search);
+	free(search->shared);
+	search->shared = NULL;
+	search->keys = NULL;
+	return mergeShardHits(search, limit, candidates);
+}
+
+int fuzzyDistance(char *pool, struct compactBook *row, char words[][50], int nwords, int *unmatched)
+{
+	char bookWords[FUZZY_MAX_BOOK_WORDS][50];
+	int nbook = 0;
+	unsigned int fields[3] = {row->id, row->bookTitle, row->author};
+	for (int f = 0; f < 3; f++)
+	{
+		nbook += splitWords(pool + fields[f], bookWords + nbook, FUZZY_MAX_BOOK_WORDS - nbook);
+	}
+	unsigned long long matched = 0;
+	int total = 0;
+	for (int w = 0; w < nwords; w++)
+	{
+		int wlen = strlen(words[w]);
+		int bound = allowedEdits(wlen);
+		int best = bound + 1;
+		int bestWord = -1;
+		for (int b = 0; b < nbook && best > 0; b++)
+		{
+			// A word typed only in part still counts as a match
+			int d = strstr(bookWords[b], words[w]) != NULL ? 0 : editDistance(words[w], wlen, bookWords[b], strlen(bookWords[b]), bound);
+			if (d < best)
+			{
+				best = d;
+				bestWord = b;
+			}
+		}
+		if (best > bound)
+		{
+			return -1;
+		}
+		matched |= 1ull << bestWord;
+		total += best;
+	}
+	*unmatched = nbook - __builtin_popcountll(matched);
+	return total;
+}
+
+void updatePrefixIndex(int field)
+{
+	struct prefixIndex *index = &PREFIXES[field];
+	if (index->count > BOOKS.count)
+	{
+		// The compact catalog was reloaded from a replaced catalog, start over
+		index->count = 0;
+	}
+	if (index->count == BOOKS.count)
+	{
+		return;
+	}
+	if (BOOKS.count > index->capacity)
+	{
+		index->capacity = BOOKS.count * 2;
+		index->entries = (struct prefixEntry *)realloc(index->entries, index->capacity * sizeof(struct prefixEntry));
+	}
+	// The new records are sorted on their own, then merged from the back into the sorted old ones
+	int old = index->count;
+	int added = BOOKS.count - old;
+	struct prefixEntry *fresh = (struct prefixEntry *)malloc(added * sizeof(struct prefixEntry));
+	for (int i = 0; i < added; i++)
+	{
+		struct compactBook *row = &BOOKS.books[old + i];
+		fresh[i].text = field == BOOK_FIELD_ID ? row->id : field == BOOK_FIELD_TITLE ? row->bookTitle : row->author;
+		fresh[i].record = old + i;
+	}
+	qsort(fresh, added, sizeof(struct prefixEntry), comparePrefixEntry);
+	int i = old - 1;
+	int j = added - 1;
+	for (int k = BOOKS.count - 1; j >= 0; k--)
+	{
+		if (i >= 0 && comparePrefixEntry(&index->entries[i], &fresh[j]) > 0)
+		{
+			index->entries[k] = index->entries[i--];
+		}
+		else
+		{
+			index->entries[k] = fresh[j--];
+		}
+	}
+	free(fresh);
+	index->count = BOOKS.count;
+}
+
+int comparePrefixEntry(const void *a, const void *b)
+{
+	struct prefixEntry *x = (struct prefixEntry *)a;
+	struct prefixEntry *y = (struct prefixEntry *)b;
+	int c = strcasecmp(BOOKS.pool.data + x->text, BOOKS.pool.data + y->text);
+	if (c == 0)
+	{
+		c = strcmp(BOOKS.pool.data + x->text, BOOKS.pool.data + y->text);
+	}
+	if (c == 0)
+	{
+		c = x->record < y->record ? -1 : x->record > y->record;
+	}
+	return c;
+}
+
+int findPrefixStart(char *pool, struct prefixIndex *index, char *prefix)
+{
+	int low = 0;
+	int high = index->count;
+	while (low < high)
+	{
+		int mid = low + (high - low) / 2;
+		if (strcasecmp(pool + index->entries[mid].text, prefix) < 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	return low;
+}
+
+int updateCompactCatalog(struct catalog *cat)
+{
+	long stamp = fileStamp(cat->fd);
+	// The count is read after the stamp, so records appended in between can only make the stamp look stale
+	struct catalogHeader header;
+	if (pread(cat->fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		return -1;
+	}
+	cat->count = header.count;
+	if (cat->count < BOOKS.count)
+	{
+		// The catalog was replaced underneath us, start over
+		clearCompactCatalog();
+	}
+	if (stamp == BOOKS.stamp && BOOKS.count == cat->count)
+	{
+		return 0;
+	}
+	// Text never changes once a record is written, so only appended records need reading unless counts moved
+	int from = stamp == BOOKS.stamp ? BOOKS.count : 0;
+	struct recordStream stream;
+	struct bookRecord *recs;
+	int n;
+	openRecordStream(&stream, cat, from, cat->count);
+	for (int record = from; (n = nextRecords(&stream, &recs)) > 0;)
+	{
+		for (int i = 0; i < n; i++, record++)
+		{
+			if (record < BOOKS.count)
+			{
+				setCompactCounts(&BOOKS.books[record], recs[i].quantity, recs[i].issued);
+			}
+			else
+			{
+				addCompactBook(&recs[i]);
+			}
+		}
+	}
+	closeRecordStream(&stream);
+	if (n == -1)
+	{
+		return -1;
+	}
+	BOOKS.stamp = stamp;
+	return 0;
+}
+
+void addCompactBook(struct bookRecord *rec)
+{
+	if (BOOKS.count == BOOKS.capacity)
+	{
+		BOOKS.capacity = BOOKS.capacity == 0 ? 1024 : BOOKS.capacity * 2;
+		BOOKS.books = (struct compactBook *)realloc(BOOKS.books, BOOKS.capacity * sizeof(struct compactBook));
+	}
+	struct compactBook *book = &BOOKS.books[BOOKS.count++];
+	book->id = appendString(&BOOKS.pool, rec->id);
+	book->bookTitle = internString(&BOOKS.pool, rec->bookTitle);
+	book->author = internString(&BOOKS.pool, rec->author);
+	setCompactCounts(book, rec->quantity, rec->issued);
+}
+
+void setCompactCounts(struct compactBook *book, int quantity, int issued)
+{
+	book->quantity = quantity < 0 || quantity > COMPACT_COUNT_MAX ? COMPACT_COUNT_MAX : quantity;
+	book->issued = issued < 0 || issued > COMPACT_COUNT_MAX ? COMPACT_COUNT_MAX : issued;
+}
+
+int readCompactBook(struct catalogVersion *version, int record, struct bookClass *book)
+{
+	struct compactBook *row = snapshotBook(version, record);
+	char *pool = version->text->pool;
+	strcpy(book->id, pool + row->id);
+	strcpy(book->bookTitle, pool + row->bookTitle);
+	strcpy(book->author, pool + row->author);
+	book->quantity = row->quantity;
+	book->issued = row->issued;
+	if (row->quantity == COMPACT_COUNT_MAX || row->issued == COMPACT_COUNT_MAX)
+	{
+		struct catalog cat;
+		struct bookRecord rec;
+		if (openCatalog(&cat) != 0)
+		{
+			return -1;
+		}
+		int ret = readBookRecord(&cat, record, &rec);
+		closeCatalog(&cat);
+		if (ret != 0)
+		{
+			return -1;
+		}
+		book->quantity = rec.quantity;
+		book->issued = rec.issued;
+	}
+	return 0;
+}
+
+void clearCompactCatalog()
+{
+	for (int f = BOOK_FIELD_ID; f <= BOOK_FIELD_AUTHOR; f++)
+	{
+		PREFIXES[f].count = 0;
+	}
+	free(BOOKS.books);
+	free(BOOKS.pool.data);
+	free(BOOKS.pool.slots);
+	memset(&BOOKS, 0, sizeof(BOOKS));
+	CATALOG_GENERATION++;
+}
+
+struct catalogVersion *openSnapshot(int parts)
+{
+	if (READER_SLOT == -1)
+	{
+		int slot = atomic_fetch_add(&READER_SLOTS, 1);
+		READER_SLOT = slot < SNAPSHOT_READERS ? slot : SNAPSHOT_READERS;
+	}
+	if (READER_SLOT == SNAPSHOT_READERS)
+	{
+		pthread_mutex_lock(&SHARED_SLOT_LOCK);
+	}
+	long stamp = pathStamp(CATALOG_FILE);
+	for (int refreshed = 0;; refreshed = 1)
+	{
+		// The epoch is stored before the version is loaded, a writer that swaps the version after that keeps what it retires
+		atomic_store(&READER_EPOCHS[READER_SLOT], atomic_load(&CATALOG_EPOCH));
+		struct catalogVersion *version = atomic_load(&CATALOG_VERSION);
+		// Once refreshed the new version is taken as it is, some other process may still be writing
+		if (version != NULL && (version->text->parts & parts) == parts && (version->stamp == stamp || refreshed))
+		{
+			return version;
+		}
+		atomic_store(&READER_EPOCHS[READER_SLOT], 0);
+		if (refreshed || refreshCatalog(parts) != 0)
+		{
+			if (READER_SLOT == SNAPSHOT_READERS)
+			{
+				pthread_mutex_unlock(&SHARED_SLOT_LOCK);
+			}
+			return NULL;
+		}
+	}
+}
+
+void closeSnapshot()
+{
+	atomic_store(&READER_EPOCHS[READER_SLOT], 0);
+	if (READER_SLOT == SNAPSHOT_READERS)
+	{
+		pthread_mutex_unlock(&SHARED_SLOT_LOCK);
+	}
+}
+
+struct compactBook *snapshotBook(struct catalogVersion *version, int record)
+{
+	return &version->chunks[record / SNAPSHOT_CHUNK][record % SNAPSHOT_CHUNK];
+}
+
+int findSnapshotBook(struct catalogVersion *version, char *id)
+{
+	struct catalogText *text = version->text;
+	unsigned int slot = hashString(id) & (text->idSlots - 1);
+	while (text->ids[slot] != 0)
+	{
+		int record = text->ids[slot] - 1;
+		if (strcmp(text->pool + snapshotBook(version, record)->id, id) == 0)
+		{
+			return record;
+		}
+		slot = (slot + 1) & (text->idSlots - 1);
+	}
+	return -1;
+}
+
+int refreshCatalog(int parts)
+{
+	struct catalog cat;
+	if (openCatalog(&cat) != 0)
+	{
+		return -1;
+	}
+	int ret = -1;
+	pthread_mutex_lock(&CATALOG_LOCK);
+	struct catalogVersion *old = atomic_load(&CATALOG_VERSION);
+	if (old != NULL)
+	{
+		parts |= old->text->parts;
+	}
+	if (updateCompactCatalog(&cat) == 0 && (!(parts & SNAPSHOT_TRIGRAMS) || updateTrigramIndex(&cat) == 0) && (!(parts & SNAPSHOT_COLUMN) || updateBookColumn(&cat) == 0))
+	{
+		if (parts & SNAPSHOT_PREFIXES)
+		{
+			for (int f = BOOK_FIELD_ID; f <= BOOK_FIELD_AUTHOR; f++)
+			{
+				updatePrefixIndex(f);
+			}
+		}
+		publishCatalogVersion(parts);
+		ret = 0;
+	}
+	pthread_mutex_unlock(&CATALOG_LOCK);
+	closeCatalog(&cat);
+	return ret;
+}
+
+void publishCatalogVersion(int parts)
+{
+	struct catalogVersion *old = atomic_load(&CATALOG_VERSION);
+	int chunks = (BOOKS.count + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+	int oldChunks = old == NULL ? 0 : (old->count + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK;
+	// Text never changes once a record is written, so the text of the old version holds as long as nothing was appended
+	struct catalogText *text = NULL;
+	if (old != NULL && old->count == BOOKS.count && old->text->generation == CATALOG_GENERATION && old->text->parts == parts)
+	{
+		text = old->text;
+	}
+	struct compactBook **rows = (struct compactBook **)malloc((chunks > 0 ? chunks : 1) * sizeof(struct compactBook *));
+	int changed = text == NULL || old->stamp != BOOKS.stamp;
+	for (int c = 0; c < chunks; c++)
+	{
+		int first = c * SNAPSHOT_CHUNK;
+		int n = BOOKS.count - first < SNAPSHOT_CHUNK ? BOOKS.count - first : SNAPSHOT_CHUNK;
+		if (c < oldChunks && old->count >= first + n && memcmp(old->chunks[c], &BOOKS.books[first], n * sizeof(struct compactBook)) == 0)
+		{
+			rows[c] = old->chunks[c];
+			continue;
+		}
+		rows[c] = (struct compactBook *)malloc(SNAPSHOT_CHUNK * sizeof(struct compactBook));
+		memcpy(rows[c], &BOOKS.books[first], n * sizeof(struct compactBook));
+		changed = 1;
+	}
+	if (!changed)
+	{
+		free(rows);
+		return;
+	}
+	struct catalogVersion *version = (struct catalogVersion *)malloc(sizeof(struct catalogVersion));
+	version->chunks = rows;
+	version->count = BOOKS.count;
+	version->stamp = BOOKS.stamp;
+	version->text = text != NULL ? text : buildCatalogText(parts);
+	atomic_store(&CATALOG_VERSION, version);
+	if (old != NULL)
+	{
+		// Readers that entered before this bump may still hold the old version, later ones can only see the new one
+		unsigned long epoch = atomic_fetch_add(&CATALOG_EPOCH, 1);
+		for (int c = 0; c < oldChunks; c++)
+		{
+			if (c >= chunks || rows[c] != old->chunks[c])
+			{
+				retireCatalogPiece(epoch, old->chunks[c], free);
+			}
+		}
+		if (text == NULL)
+		{
+			retireCatalogPiece(epoch, old->text, freeCatalogText);
+		}
+		retireCatalogPiece(epoch, old->chunks, free);
+		retireCatalogPiece(epoch, old, free);
+	}
+	reclaimCatalogPieces();
+}
+
+struct catalogText *buildCatalogText(int parts)
+{
+	struct catalogText *text = (struct catalogText *)calloc(1, sizeof(struct catalogText));
+	text->generation = CATALOG_GENERATION;
+	text->parts = parts;
+	text->pool = (char *)malloc(BOOKS.pool.size > 0 ? BOOKS.pool.size : 1);
+	memcpy(text->pool, BOOKS.pool.data, BOOKS.pool.size);
+	if (parts & SNAPSHOT_TRIGRAMS)
+	{
+		// Every posting list is cut to its size and packed into one block
+		struct trigramIndex *trigrams = &text->trigrams;
+		trigrams->indexed = TRIGRAMS.indexed;
+		trigrams->capacity = TRIGRAMS.capacity;
+		trigrams->used = TRIGRAMS.used;
+		trigrams->keys = (unsigned int *)malloc((TRIGRAMS.capacity > 0 ? TRIGRAMS.capacity : 1) * sizeof(unsigned int));
+		trigrams->lists = (struct postingList *)calloc(TRIGRAMS.capacity > 0 ? TRIGRAMS.capacity : 1, sizeof(struct postingList));
+		memcpy(trigrams->keys, TRIGRAMS.keys, TRIGRAMS.capacity * sizeof(unsigned int));
+		long postings = 0;
+		for (unsigned int i = 0; i < TRIGRAMS.capacity; i++)
+		{
+			postings += TRIGRAMS.lists[i].size;
+		}
+		text->postings = (unsigned int *)malloc((postings > 0 ? postings : 1) * sizeof(unsigned int));
+		postings = 0;
+		for (unsigned int i = 0; i < TRIGRAMS.capacity; i++)
+		{
+			struct postingList *list = &TRIGRAMS.lists[i];
+			trigrams->lists[i].records = text->postings + postings;
+			trigrams->lists[i].size = list->size;
+			trigrams->lists[i].capacity = list->size;
+			if (list->size > 0)
+			{
+				memcpy(text->postings + postings, list->records, list->size * sizeof(unsigned int));
+			}
+			postings += list->size;
+		}
+	}
+	if (parts & SNAPSHOT_COLUMN)
+	{
+		// The copy keeps the zeroed slack the SIMD kernels read past the end of the column
+		struct textColumn *column = &text->column;
+		column->size = BOOKTEXT.size;
+		column->capacity = BOOKTEXT.size + 64;
+		column->data = (char *)calloc(column->capacity, 1);
+		memcpy(column->data, BOOKTEXT.data, BOOKTEXT.size);
+		column->count = BOOKTEXT.count;
+		column->slots = BOOKTEXT.count + 1;
+		column->offsets = (unsigned int *)malloc(column->slots * sizeof(unsigned int));
+		column->offsets[0] = 0;
+		if (BOOKTEXT.count > 0)
+		{
+			memcpy(column->offsets, BOOKTEXT.offsets, column->slots * sizeof(unsigned int));
+		}
+	}
+	if (parts & SNAPSHOT_PREFIXES)
+	{
+		for (int f = BOOK_FIELD_ID; f <= BOOK_FIELD_AUTHOR; f++)
+		{
+			struct prefixIndex *index = &text->prefixes[f];
+			index->count = PREFIXES[f].count;
+			index->capacity = PREFIXES[f].count;
+			index->entries = (struct prefixEntry *)malloc((index->count > 0 ? index->count : 1) * sizeof(struct prefixEntry));
+			memcpy(index->entries, PREFIXES[f].entries, index->count * sizeof(struct prefixEntry));
+		}
+	}
+	text->idSlots = 1024;
+	while (text->idSlots < (unsigned int)BOOKS.count * 2)
+	{
+		text->idSlots *= 2;
+	}
+	text->ids = (unsigned int *)calloc(text->idSlots, sizeof(unsigned int));
+	for (int i = 0; i < BOOKS.count; i++)
+	{
+		unsigned int slot = hashString(BOOKS.pool.data + BOOKS.books[i].id) & (text->idSlots - 1);
+		while (text->ids[slot] != 0)
+		{
+			slot = (slot + 1) & (text->idSlots - 1);
+		}
+		text->ids[slot] = i + 1;
+	}
+	return text;
+}
+
+void freeCatalogText(void *data)
+{
+	struct catalogText *text = (struct catalogText *)data;
+	free(text->pool);
+	free(text->trigrams.keys);
+	free(text->trigrams.lists);
+	free(text->postings);
+	free(text->column.data);
+	free(text->column.offsets);
+	for (int f = BOOK_FIELD_ID; f <= BOOK_FIELD_AUTHOR; f++)
+	{
+		free(text->prefixes[f].entries);
+	}
+	free(text->ids);
+	free(text);
+}
+
+void retireCatalogPiece(unsigned long epoch, void *data, void (*release)(void *data))
+{
+	struct retiredPiece *piece = (struct retiredPiece *)malloc(sizeof(struct retiredPiece));
+	piece->epoch = epoch;
+	piece->data = data;
+	piece->release = release;
+	piece->next = RETIRED;
+	RETIRED = piece;
+}
+
+void reclaimCatalogPieces()
+{
+	unsigned long oldest = ~0ul;
+	for (int i = 0; i <= SNAPSHOT_READERS; i++)
+	{
+		unsigned long epoch = atomic_load(&READER_EPOCHS[i]);
+		if (epoch != 0 && epoch < oldest)
+		{
+			oldest = epoch;
+		}
+	}
+	struct retiredPiece **link = &RETIRED;
+	while (*link != NULL)
+	{
+		struct retiredPiece *piece = *link;
+		if (piece->epoch < oldest)
+		{
+			*link = piece->next;
+			piece->release(piece->data);
+			free(piece);
+		}
+		else
+		{
+			link = &piece->next;
+		}
+	}
+}
+
+unsigned int internString(struct stringPool *pool, char *s)
+{
+	if ((pool->used + 1) * 2 > pool->slotCount)
+	{
+		unsigned int slotCount = pool->slotCount == 0 ? 1024 : pool->slotCount * 2;
+		unsigned int *slots = (unsigned int *)calloc(slotCount, sizeof(unsigned int));
+		for (unsigned int i = 0; i < pool->slotCount; i++)
+		{
+			if (pool->slots[i] != 0)
+			{
+				unsigned int slot = hashString(pool->data + pool->slots[i] - 1) & (slotCount - 1);
+				while (slots[slot] != 0)
+				{
+					slot = (slot + 1) & (slotCount - 1);
+				}
+				slots[slot] = pool->slots[i];
+			}
+		}
+		free(pool->slots);
+		pool->slots = slots;
+		pool->slotCount = slotCount;
+	}
+	unsigned int slot = hashString(s) & (pool->slotCount - 1);
+	while (pool->slots[slot] != 0)
+	{
+		if (strcmp(pool->data + pool->slots[slot] - 1, s) == 0)
+		{
+			return pool->slots[slot] - 1;
+		}
+		slot = (slot + 1) & (pool->slotCount - 1);
+	}
+	unsigned int offset = appendString(pool, s);
+	pool->slots[slot] = offset + 1;
+	pool->used++;
+	return offset;
+}
+
+unsigned int appendString(struct stringPool *pool, char *s)
+{
+	unsigned int len = strlen(s) + 1;
+	if (pool->size + len > pool->capacity)
+	{
+		unsigned int capacity = pool->capacity == 0 ? 4096 : pool->capacity;
+		while (pool->size + len > capacity)
+		{
+			capacity *= 2;
+		}
+		pool->data = (char *)realloc(pool->data, capacity);
+		pool->capacity = capacity;
+	}
+	unsigned int offset = pool->size;
+	memcpy(pool->data + offset, s, len);
+	pool->size += len;
+	return offset;
+}
+
+void appendColumnEntry(struct textColumn *column, char **fields, int n)
+{
+	unsigned int need = 0;
+	for (int i = 0; i < n; i++)
+	{
+		need += strlen(fields[i]) + 1;
+	}
+	// The SIMD kernels read up to 64 bytes past the end, so the buffer always keeps that much zeroed slack
+	if (column->size + need + 64 > column->capacity)
+	{
+		unsigned int capacity = column->capacity == 0 ? 4096 : column->capacity;
+		while (column->size + need + 64 > capacity)
+		{
+			capacity *= 2;
+		}
+		column->data = (char *)realloc(column->data, capacity);
+		memset(column->data + column->size, 0, capacity - column->size);
+		column->capacity = capacity;
+	}
+	if (column->count + 2 > column->slots)
+	{
+		column->slots = column->slots == 0 ? 1024 : column->slots * 2;
+		column->offsets = (unsigned int *)realloc(column->offsets, column->slots * sizeof(unsigned int));
+	}
+	column->offsets[column->count] = column->size;
+	for (int i = 0; i < n; i++)
+	{
+		int flen = strlen(fields[i]);
+		memcpy(column->data + column->size, fields[i], flen + 1);
+		column->size += flen + 1;
+	}
+	column->count++;
+	column->offsets[column->count] = column->size;
+}
+
+void clearTextColumn(struct textColumn *column)
+{
+	free(column->data);
+	free(column->offsets);
+	memset(column, 0, sizeof(*column));
+}
+
+int updateBookColumn(struct catalog *cat)
+{
+	if (cat->count < BOOKTEXT.count)
+	{
+		clearTextColumn(&BOOKTEXT);
+	}
+	struct recordStream stream;
+	struct bookRecord *recs;
+	int n;
+	openRecordStream(&stream, cat, BOOKTEXT.count, cat->count);
+	while ((n = nextRecords(&stream, &recs)) > 0)
+	{
+		for (int i = 0; i < n; i++)
+		{
+			char *fields[3] = {recs[i].id, recs[i].bookTitle, recs[i].author};
+			appendColumnEntry(&BOOKTEXT, fields, 3);
+		}
+	}
+	closeRecordStream(&stream);
+	return n == -1 ? -1 : 0;
+}
+
+int updateUserColumn()
+{
+	long stamp = pathStamp("Server/tokenStore.txt");
+	if (stamp == -1)
+	{
+		return -1;
+	}
+	if (USERTEXT.data != NULL && USERTEXT.stamp == stamp)
+	{
+		return 0;
+	}
+	FILE *fp;
+	fp = fopen("Server/tokenStore.txt", "r");
+	if (fp == NULL)
+	{
+		return -1;
+	}
+	clearTextColumn(&USERTEXT);
+	char line[50];
+	int linenum = 0;
+	while (fgets(line, 50, fp))
+	{
+		if ((linenum % 3) == 0)
+		{
+			stripNewline(line);
+			char *fields[1] = {line};
+			appendColumnEntry(&USERTEXT, fields, 1);
+		}
+		linenum++;
+	}
+	fclose(fp);
+	USERTEXT.stamp = stamp;
+	return 0;
+}
+
+int scanTextColumn(struct textColumn *column, char *query, unsigned int **entries)
+{
+	return scanTextColumnRange(column, 0, column->count, query, entries);
+}
+
+int scanTextColumnRange(struct textColumn *column, int first, int last, char *query, unsigned int **entries)
+{
+	*entries = (unsigned int *)malloc((last - first + 1) * sizeof(unsigned int));
+	int qlen = strlen(query);
+	int size = 0;
+	if (qlen == 0)
+	{
+		for (int i = first; i < last; i++)
+		{
+			(*entries)[size++] = i;
+		}
+		return size;
+	}
+	if (first == last)
+	{
+		return 0;
+	}
+	int entry = first;
+	long pos = column->offsets[first];
+	while ((pos = findSubstring(column->data, column->offsets[last], query, qlen, pos)) != -1)
+	{
+		while (column->offsets[entry + 1] <= pos)
+		{
+			entry++;
+		}
+		(*entries)[size++] = entry;
+		// One hit is enough for an entry, carry on from the next one
+		pos = column->offsets[entry + 1];
+	}
+	return size;
+}
+
+long findSubstring(char *data, long size, char *needle, int nlen, long from)
+{
+	// Shards scan the column from several threads at once, so the kernel is picked exactly once
+	pthread_once(&FIND_SUBSTRING_ONCE, pickSubstringKernel);
+	return FIND_SUBSTRING(data, size, needle, nlen, from);
+}
+
+void pickSubstringKernel()
+{
+	FIND_SUBSTRING = findSubstringScalar;
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		FIND_SUBSTRING = findSubstringAVX2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		FIND_SUBSTRING = findSubstringSSE2;
+	}
+#endif
+}
+
+long findSubstringScalar(char *data, long size, char *needle, int nlen, long from)
+{
+	for (long i = from; i + nlen <= size; i++)
+	{
+		char *hit = (char *)memchr(data + i, needle[0], size - nlen + 1 - i);
+		if (hit == NULL)
+		{
+			return -1;
+		}
+		i = hit - data;
+		if (memcmp(hit, needle, nlen) == 0)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// First and last byte filter: a block of positions is kept only where both the first and the last byte of the needle line up,
+// and just those positions are compared in full
+__attribute__((target("sse2"))) long findSubstringSSE2(char *data, long size, char *needle, int nlen, long from)
+{
+	__m128i first = _mm_set1_epi8(needle[0]);
+	__m128i last = _mm_set1_epi8(needle[nlen - 1]);
+	for (long i = from; i + nlen <= size; i += 16)
+	{
+		__m128i a = _mm_loadu_si128((__m128i *)(data + i));
+		__m128i b = _mm_loadu_si128((__m128i *)(data + i + nlen - 1));
+		unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+		while (mask != 0)
+		{
+			int bit = __builtin_ctz(mask);
+			if (i + bit + nlen > size)
+			{
+				return -1;
+			}
+			if (nlen <= 2 || memcmp(data + i + bit + 1, needle + 1, nlen - 2) == 0)
+			{
+				return i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return -1;
+}
+
+__attribute__((target("avx2"))) long findSubstringAVX2(char *data, long size, char *needle, int nlen, long from)
+{
+	__m256i first = _mm256_set1_epi8(needle[0]);
+	__m256i last = _mm256_set1_epi8(needle[nlen - 1]);
+	for (long i = from; i + nlen <= size; i += 32)
+	{
+		__m256i a = _mm256_loadu_si256((__m256i *)(data + i));
+		__m256i b = _mm256_loadu_si256((__m256i *)(data + i + nlen - 1));
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+		while (mask != 0)
+		{
+			int bit = __builtin_ctz(mask);
+			if (i + bit + nlen > size)
+			{
+				return -1;
+			}
+			if (nlen <= 2 || memcmp(data + i + bit + 1, needle + 1, nlen - 2) == 0)
+			{
+				return i + bit;
+			}
+			mask &= mask - 1;
+		}
+	}
+	return -1;
+}
+#else
+long findSubstringSSE2(char *data, long size, char *needle, int nlen, long from)
+{
+	return findSubstringScalar(data, size, needle, nlen, from);
+}
+
+long findSubstringAVX2(char *data, long size, char *needle, int nlen, long from)
+{
+	return findSubstringScalar(data, size, needle, nlen, from);
+}
+#endif
+
+int comparePostingSize(const void *a, const void *b)
+{
+	return (*(struct postingList **)a)->size - (*(struct postingList **)b)->size;
+}
+
+int trigramCandidates(struct trigramIndex *index, int shard, char *query, unsigned int **records)
+{
+	int qlen = strlen(query);
+	if (qlen < 3)
+	{
+		return -1;
+	}
+	*records = NULL;
+	int n = qlen - 2;
+	struct postingList **lists = (struct postingList **)malloc(n * sizeof(struct postingList *));
+	for (int i = 0; i < n; i++)
+	{
+		lists[i] = findPostingList(index, shardKey(trigramKey(&query[i]), shard), 0);
+		if (lists[i] == NULL)
+		{
+			free(lists);
+			return 0;
+		}
+	}
+	// Intersecting from the shortest list keeps every step bounded by the rarest trigram
+	qsort(lists, n, sizeof(struct postingList *), comparePostingSize);
+	unsigned int *result = (unsigned int *)malloc((lists[0]->size + 1) * sizeof(unsigned int));
+	memcpy(result, lists[0]->records, lists[0]->size * sizeof(unsigned int));
+	int size = lists[0]->size;
+	for (int i = 1; i < n && size > 0; i++)
+	{
+		if (lists[i] == lists[i - 1])
+		{
+			continue;
+		}
+		int kept = 0;
+		int j = 0;
+		for (int k = 0; k < size; k++)
+		{
+			while (j < lists[i]->size && lists[i]->records[j] < result[k])
+			{
+				j++;
+			}
+			if (j == lists[i]->size)
+			{
+				break;
+			}
+			if (lists[i]->records[j] == result[k])
+			{
+				result[kept++] = result[k];
+			}
+		}
+		size = kept;
+	}
+	free(lists);
+	*records = result;
+	return size;
+}
+
+void runShards(void (*task)(void *arg, int shard), void *arg)
+{
+	pthread_once(&SEARCH_THREADS_ONCE, startSearchThreads);
+	if (SEARCH_THREADS == 0)
+	{
+		for (int shard = 0; shard < SEARCH_SHARDS; shard++)
+		{
+			task(arg, shard);
+		}
+		return;
+	}
+	struct shardJob job = {task, arg, 0, 0, NULL};
+	pthread_mutex_lock(&SHARD_LOCK);
+	struct shardJob **tail = &SHARD_QUEUE;
+	while (*tail != NULL)
+	{
+		tail = &(*tail)->queued;
+	}
+	*tail = &job;
+	pthread_cond_broadcast(&SHARD_QUEUED);
+	// The caller takes shards of its own job as well, so the job finishes even when every search thread is busy elsewhere
+	while (job.done < SEARCH_SHARDS)
+	{
+		if (job.next < SEARCH_SHARDS)
+		{
+			int shard = takeShard(&job);
+			pthread_mutex_unlock(&SHARD_LOCK);
+			task(arg, shard);
+			pthread_mutex_lock(&SHARD_LOCK);
+			job.done++;
+		}
+		else
+		{
+			pthread_cond_wait(&SHARD_DONE, &SHARD_LOCK);
+		}
+	}
+	pthread_mutex_unlock(&SHARD_LOCK);
+}
+
+void startSearchThreads()
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	int threads = (cpus < SEARCH_SHARDS ? cpus : SEARCH_SHARDS) - 1;
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, searchThread, NULL) != 0)
+		{
+			break;
+		}
+		pthread_detach(thread);
+		SEARCH_THREADS++;
+	}
+}
+
+void *searchThread(void *arg)
+{
+	pthread_mutex_lock(&SHARD_LOCK);
+	for (;;)
+	{
+		if (SHARD_QUEUE == NULL)
+		{
+			pthread_cond_wait(&SHARD_QUEUED, &SHARD_LOCK);
+			continue;
+		}
+		struct shardJob *job = SHARD_QUEUE;
+		int shard = takeShard(job);
+		pthread_mutex_unlock(&SHARD_LOCK);
+		job->task(job->arg, shard);
+		pthread_mutex_lock(&SHARD_LOCK);
+		// The job lives on the stack of its caller, which only returns once done is counted up under the lock
+		if (++job->done == SEARCH_SHARDS)
+		{
+			pthread_cond_broadcast(&SHARD_DONE);
+		}
+	}
+	return NULL;
+}
+
+int takeShard(struct shardJob *job)
+{
+	int shard = job->next++;
+	if (job->next == SEARCH_SHARDS)
+	{
+		struct shardJob **link = &SHARD_QUEUE;
+		while (*link != job)
+		{
+			link = &(*link)->queued;
+		}
+		*link = job->queued;
+	}
+	return shard;
+}
+
+void matchShard(void *arg, int shard)
+{
+	struct shardSearch *search = (struct shardSearch *)arg;
+	unsigned int *candidates;
+	int n = bookCandidates(search->version, shard, search->query, &candidates);
+	char *pool = search->version->text->pool;
+	int size = 0;
+	for (int i = 0; i < n; i++)
+	{
+		struct compactBook *row = snapshotBook(search->version, candidates[i]);
+		if (strstr(pool + row->id, search->query) || strstr(pool + row->bookTitle, search->query) || strstr(pool + row->author, search->query))
+		{
+			candidates[size++] = candidates[i];
+		}
+	}
+	search->records[shard] = candidates;
+	search->sizes[shard] = size;
+}
+
+void rankShard(void *arg, int shard)
+{
+	struct shardSearch *search = (struct shardSearch *)arg;
+	unsigned int *candidates;
+	int n = bookCandidates(search->version, shard, search->query, &candidates);
+	struct rankedBook *heap = (struct rankedBook *)malloc((search->k > 0 ? search->k : 1) * sizeof(struct rankedBook));
+	int size = 0;
+	for (int i = 0; i < n; i++)
+	{
+		struct rankedBook hit = {scoreBook(search->version->text->pool, snapshotBook(search->version, candidates[i]), search->query, search->qlen, search->weights), candidates[i]};
+		if (hit.score != 0)
+		{
+			keepRanked(heap, &size, search->k, hit);
+		}
+	}
+	free(candidates);
+	search->hits[shard] = heap;
+	search->sizes[shard] = size;
+}
+
+void fuzzyShard(void *arg, int shard)
+{
+	struct shardSearch *search = (struct shardSearch *)arg;
+	unsigned int *touched = NULL;
+	int ntouched = 0;
+	int capacity = 0;
+	for (int i = 0; i < search->nkeys; i++)
+	{
+		struct postingList *list = findPostingList(&search->version->text->trigrams, shardKey(search->keys[i], shard), 0);
+		if (list == NULL)
+		{
+			continue;
+		}
+		for (int j = 0; j < list->size; j++)
+		{
+			unsigned int record = list->records[j];
+			if (search->shared[record]++ == 0)
+			{
+				if (ntouched == capacity)
+				{
+					capacity = capacity == 0 ? 1024 : capacity * 2;
+					touched = (unsigned int *)realloc(touched, capacity * sizeof(unsigned int));
+				}
+				touched[ntouched++] = record;
+			}
+		}
+	}
+	struct rankedBook *heap = (struct rankedBook *)malloc(search->k * sizeof(struct rankedBook));
+	int size = 0;
+	for (int i = 0; i < ntouched; i++)
+	{
+		struct rankedBook hit = {search->shared[touched[i]], touched[i]};
+		if (hit.score >= search->needed)
+		{
+			keepRanked(heap, &size, search->k, hit);
+		}
+	}
+	free(touched);
+	search->hits[shard] = heap;
+	search->sizes[shard] = size;
+}
+
+void distanceShard(void *arg, int shard)
+{
+	struct shardSearch *search = (struct shardSearch *)arg;
+	struct rankedBook *heap = (struct rankedBook *)malloc(search->k * sizeof(struct rankedBook));
+	int size = 0;
+	// The candidates come best first, taking every SEARCH_SHARDS-th one spreads the long books evenly
+	for (int i = shard; i < search->ncandidates; i += SEARCH_SHARDS)
+	{
+		struct rankedBook *candidate = &search->candidates[i];
+		int unmatched;
+		int distance = fuzzyDistance(search->version->text->pool, snapshotBook(search->version, candidate->record), search->words, search->nwords, &unmatched);
+		if (distance == -1)
+		{
+			continue;
+		}
+		// Fewer edits rank first, then more shared trigrams, then fewer words the query did not ask for
+		struct rankedBook hit = {candidate->score * 64 - unmatched - distance * 65536, candidate->record};
+		keepRanked(heap, &size, search->k, hit);
+	}
+	search->hits[shard] = heap;
+	search->sizes[shard] = size;
+}
+
+int mergeShardHits(struct shardSearch *search, int k, struct rankedBook **heap)
+{
+	// Ranks never tie, so the best k of the best k of every shard are the best k overall
+	*heap = (struct rankedBook *)malloc((k > 0 ? k : 1) * sizeof(struct rankedBook));
+	int size = 0;
+	for (int s = 0; s < SEARCH_SHARDS; s++)
+	{
+		for (int i = 0; i < search->sizes[s]; i++)
+		{
+			keepRanked(*heap, &size, k, search->hits[s][i]);
+		}
+		free(search->hits[s]);
+		search->hits[s] = NULL;
+		search->sizes[s] = 0;
+	}
+	sortRanked(*heap, size);
+	return size;
+}
+
+void startIO(struct ioBatch *batch, struct ioRequest *requests, int n)
+{
+	pthread_once(&IO_ONCE, setupIO);
+	batch->requests = requests;
+	batch->count = n;
+	batch->submitted = 0;
+	batch->pending = n;
+	batch->failed = 0;
+	for (int i = 0; i < n; i++)
+	{
+		requests[i].batch = batch;
+		requests[i].result = 0;
+	}
+	struct ioRing *ring = threadRing();
+	if (ring->fd != -1)
+	{
+		submitRing(ring, batch);
+	}
+	else
+	{
+		queueIO(batch);
+	}
+}
+
+int finishIO(struct ioBatch *batch)
+{
+	struct ioRing *ring = threadRing();
+	if (ring->fd != -1)
+	{
+		while (batch->pending > 0)
+		{
+			submitRing(ring, batch);
+			reapRing(ring, 1);
+		}
+	}
+	else
+	{
+		pthread_mutex_lock(&IO_LOCK);
+		while (batch->pending > 0)
+		{
+			// The caller runs queued chains itself rather than sleep until an I/O thread gets to them
+			if (IO_QUEUE != NULL)
+			{
+				struct ioRequest *chain = IO_QUEUE;
+				IO_QUEUE = chain->queued;
+				pthread_mutex_unlock(&IO_LOCK);
+				runChain(chain);
+				pthread_mutex_lock(&IO_LOCK);
+				pthread_cond_broadcast(&IO_DONE);
+				continue;
+			}
+			pthread_cond_wait(&IO_DONE, &IO_LOCK);
+		}
+		pthread_mutex_unlock(&IO_LOCK);
+	}
+	return batch->failed ? -1 : 0;
+}
+
+int runIO(struct ioRequest *requests, int n)
+{
+	struct ioBatch batch;
+	startIO(&batch, requests, n);
+	return finishIO(&batch);
+}
+
+void *reserveIOBuffer(unsigned int size)
+{
+	struct ioRing *ring = threadRing();
+	size = (size + 63) & ~63u;
+	if (ring->arena == NULL || size > IO_ARENA_SIZE - ring->arenaUsed)
+	{
+		return NULL;
+	}
+	void *buffer = ring->arena + ring->arenaUsed;
+	ring->arenaUsed += size;
+	return buffer;
+}
+
+void releaseIOBuffer(void *buffer)
+{
+	struct ioRing *ring = threadRing();
+	ring->arenaUsed = (char *)buffer - ring->arena;
+}
+
+void setupIO()
+{
+	pthread_key_create(&IO_RING_KEY, freeThreadRing);
+	pthread_atfork(NULL, NULL, forgetIO);
+	struct ioRing probe;
+	IO_URING = openIORing(&probe) == 0;
+	if (IO_URING)
+	{
+		closeIORing(&probe);
+	}
+}
+
+struct ioRing *threadRing()
+{
+	if (IO_RING != NULL)
+	{
+		return IO_RING;
+	}
+	pthread_once(&IO_ONCE, setupIO);
+	struct ioRing *ring = (struct ioRing *)calloc(1, sizeof(struct ioRing));
+	ring->fd = -1;
+	if (!IO_URING || openIORing(ring) != 0)
+	{
+		memset(ring, 0, sizeof(*ring));
+		ring->fd = -1;
+		if (posix_memalign((void **)&ring->arena, 4096, IO_ARENA_SIZE) != 0)
+		{
+			ring->arena = NULL;
+		}
+	}
+	IO_RING = ring;
+	pthread_setspecific(IO_RING_KEY, ring);
+	return ring;
+}
+
+void freeThreadRing(void *ring)
+{
+	closeIORing((struct ioRing *)ring);
+	free(ring);
+}
+
+void forgetIO()
+{
+	if (IO_RING != NULL)
+	{
+		freeThreadRing(IO_RING);
+		IO_RING = NULL;
+		pthread_setspecific(IO_RING_KEY, NULL);
+	}
+	pthread_mutex_init(&IO_LOCK, NULL);
+	IO_QUEUE = NULL;
+	IO_THREAD_COUNT = 0;
+}
+
+#ifdef LIBRARYMAN_IO_URING
+int openIORing(struct ioRing *ring)
+{
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = syscall(__NR_io_uring_setup, IO_RING_ENTRIES, &params);
+	if (ring->fd == -1)
+	{
+		return -1;
+	}
+	// Requests at offset -1 need the file position support of 5.6, which also brought IORING_OP_READ and IORING_OP_WRITE
+	if ((params.features & IORING_FEAT_RW_CUR_POS) == 0)
+	{
+		close(ring->fd);
+		ring->fd = -1;
+		return -1;
+	}
+	ring->sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	ring->cqSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		ring->sqSize = ring->cqSize > ring->sqSize ? ring->cqSize : ring->sqSize;
+		ring->cqSize = ring->sqSize;
+	}
+	ring->sqeSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqMap = mmap(NULL, ring->sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	ring->cqMap = ring->sqMap;
+	if (ring->sqMap != MAP_FAILED && (params.features & IORING_FEAT_SINGLE_MMAP) == 0)
+	{
+		ring->cqMap = mmap(NULL, ring->cqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+	}
+	ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqMap == MAP_FAILED || ring->cqMap == MAP_FAILED || ring->sqes == MAP_FAILED)
+	{
+		closeIORing(ring);
+		ring->fd = -1;
+		return -1;
+	}
+	char *sq = (char *)ring->sqMap;
+	char *cq = (char *)ring->cqMap;
+	ring->sqHead = (unsigned int *)(sq + params.sq_off.head);
+	ring->sqTail = (unsigned int *)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned int *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned int *)(sq + params.sq_off.array);
+	ring->cqHead = (unsigned int *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned int *)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned int *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	// The arena still serves as plain memory if the kernel will not pin it, requests into it then go in unregistered
+	if (posix_memalign((void **)&ring->arena, 4096, IO_ARENA_SIZE) != 0)
+	{
+		ring->arena = NULL;
+	}
+	else
+	{
+		struct iovec iov = {ring->arena, IO_ARENA_SIZE};
+		ring->registered = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_BUFFERS, &iov, 1) == 0;
+	}
+	return 0;
+}
+
+void closeIORing(struct ioRing *ring)
+{
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+	{
+		munmap(ring->sqes, ring->sqeSize);
+	}
+	if (ring->cqMap != NULL && ring->cqMap != MAP_FAILED && ring->cqMap != ring->sqMap)
+	{
+		munmap(ring->cqMap, ring->cqSize);
+	}
+	if (ring->sqMap != NULL && ring->sqMap != MAP_FAILED)
+	{
+		munmap(ring->sqMap, ring->sqSize);
+	}
+	if (ring->fd != -1)
+	{
+		close(ring->fd);
+	}
+	free(ring->arena);
+	ring->arena = NULL;
+}
+
+void submitRing(struct ioRing *ring, struct ioBatch *batch)
+{
+	unsigned int tail = *ring->sqTail;
+	unsigned int pushed = 0;
+	while (batch->submitted < batch->count)
+	{
+		// A chain goes in whole or waits, the kernel only links requests entered together
+		int length = chainLength(batch, batch->submitted);
+		if (ring->inFlight + pushed + length > IO_RING_ENTRIES)
+		{
+			break;
+		}
+		for (int i = 0; i < length; i++)
+		{
+			struct ioRequest *request = &batch->requests[batch->submitted++];
+			unsigned int index = (tail + pushed++) & *ring->sqMask;
+			struct io_uring_sqe *sqe = &ring->sqes[index];
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->fd = request->fd;
+			sqe->user_data = (unsigned long long)(uintptr_t)request;
+			if (request->op == IO_SYNC)
+			{
+				sqe->opcode = IORING_OP_FSYNC;
+				sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+			}
+			else
+			{
+				int fixed = ring->registered && request->offset != -1 && (char *)request->buffer >= ring->arena && (char *)request->buffer + request->size <= ring->arena + IO_ARENA_SIZE;
+				if (request->op == IO_READ)
+				{
+					sqe->opcode = fixed ? IORING_OP_READ_FIXED : IORING_OP_READ;
+				}
+				else
+				{
+					sqe->opcode = fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+				}
+				sqe->addr = (unsigned long long)(uintptr_t)request->buffer;
+				sqe->len = request->size;
+				sqe->off = (unsigned long long)request->offset;
+				sqe->buf_index = 0;
+			}
+			if (i < length - 1)
+			{
+				sqe->flags = IOSQE_IO_LINK;
+			}
+			ring->sqArray[index] = index;
+		}
+	}
+	if (pushed == 0)
+	{
+		return;
+	}
+	__atomic_store_n(ring->sqTail, tail + pushed, __ATOMIC_RELEASE);
+	ring->inFlight += pushed;
+	while (pushed > 0)
+	{
+		long entered = syscall(__NR_io_uring_enter, ring->fd, pushed, 0, 0, NULL, 0);
+		if (entered > 0)
+		{
+			pushed -= entered;
+			continue;
+		}
+		if (entered == -1 && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+		{
+			reapRing(ring, ring->inFlight > pushed);
+			continue;
+		}
+		// The kernel took none of what is left, so those requests are taken back off the ring and failed
+		unsigned int left = pushed;
+		int error = errno;
+		__atomic_store_n(ring->sqTail, *ring->sqTail - left, __ATOMIC_RELEASE);
+		ring->inFlight -= left;
+		for (unsigned int i = 0; i < left; i++)
+		{
+			struct io_uring_sqe *sqe = &ring->sqes[(*ring->sqTail + i) & *ring->sqMask];
+			completeRequest((struct ioRequest *)(uintptr_t)sqe->user_data, -error);
+		}
+		break;
+	}
+}
+
+void reapRing(struct ioRing *ring, int wait)
+{
+	unsigned int head = *ring->cqHead;
+	if (wait && head == __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE) && ring->inFlight > 0)
+	{
+		syscall(__NR_io_uring_enter, ring->fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+	}
+	unsigned int tail = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+	while (head != tail)
+	{
+		struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+		completeRequest((struct ioRequest *)(uintptr_t)cqe->user_data, cqe->res);
+		ring->inFlight--;
+		head++;
+	}
+	__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+}
+#else
+int openIORing(struct ioRing *ring)
+{
+	memset(ring, 0, sizeof(*ring));
+	ring->fd = -1;
+	return -1;
+}
+
+void closeIORing(struct ioRing *ring)
+{
+	free(ring->arena);
+	ring->arena = NULL;
+}
+
+void submitRing(struct ioRing *ring, struct ioBatch *batch)
+{
+}
+
+void reapRing(struct ioRing *ring, int wait)
+{
+}
+#endif
+
+void completeRequest(struct ioRequest *request, ssize_t result)
+{
+	request->result = result;
+	if (request->op == IO_SYNC ? result != 0 : result != (ssize_t)request->size)
+	{
+		request->batch->failed = 1;
+	}
+	request->batch->pending--;
+}
+
+void queueIO(struct ioBatch *batch)
+{
+	pthread_once(&IO_THREADS_ONCE, startIOThreads);
+	if (IO_THREAD_COUNT == 0)
+	{
+		while (batch->submitted < batch->count)
+		{
+			batch->submitted += runChain(&batch->requests[batch->submitted]);
+		}
+		return;
+	}
+	pthread_mutex_lock(&IO_LOCK);
+	while (batch->submitted < batch->count)
+	{
+		struct ioRequest *chain = &batch->requests[batch->submitted];
+		batch->submitted += chainLength(batch, batch->submitted);
+		chain->queued = NULL;
+		if (IO_QUEUE == NULL)
+		{
+			IO_QUEUE = chain;
+		}
+		else
+		{
+			IO_QUEUE_TAIL->queued = chain;
+		}
+		IO_QUEUE_TAIL = chain;
+		pthread_cond_signal(&IO_QUEUED);
+	}
+	pthread_mutex_unlock(&IO_LOCK);
+}
+
+void startIOThreads()
+{
+	for (int i = 0; i < IO_THREADS; i++)
+	{
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, ioThread, NULL) != 0)
+		{
+			break;
+		}
+		pthread_detach(thread);
+		IO_THREAD_COUNT++;
+	}
+}
+
+void *ioThread(void *arg)
+{
+	pthread_mutex_lock(&IO_LOCK);
+	for (;;)
+	{
+		if (IO_QUEUE == NULL)
+		{
+			pthread_cond_wait(&IO_QUEUED, &IO_LOCK);
+			continue;
+		}
+		struct ioRequest *chain = IO_QUEUE;
+		IO_QUEUE = chain->queued;
+		pthread_mutex_unlock(&IO_LOCK);
+		runChain(chain);
+		pthread_mutex_lock(&IO_LOCK);
+		pthread_cond_broadcast(&IO_DONE);
+	}
+	return NULL;
+}
+
+int runChain(struct ioRequest *chain)
+{
+	struct ioBatch *batch = chain->batch;
+	int length = chainLength(batch, chain - batch->requests);
+	int ok = 1;
+	for (int i = 0; i < length; i++)
+	{
+		struct ioRequest *request = &chain[i];
+		ssize_t result = -ECANCELED;
+		if (ok && request->op == IO_SYNC)
+		{
+			result = fdatasync(request->fd) == 0 ? 0 : -errno;
+		}
+		else if (ok && request->op == IO_READ)
+		{
+			result = request->offset == -1 ? read(request->fd, request->buffer, request->size) : pread(request->fd, request->buffer, request->size, request->offset);
+		}
+		else if (ok)
+		{
+			result = request->offset == -1 ? write(request->fd, request->buffer, request->size) : pwrite(request->fd, request->buffer, request->size, request->offset);
+		}
+		request->result = result == -1 ? -errno : result;
+		ok = request->op == IO_SYNC ? request->result == 0 : request->result == (ssize_t)request->size;
+	}
+	// The batch is only touched under IO_LOCK, its owner may be waiting on it from another thread
+	if (IO_THREAD_COUNT > 0)
+	{
+		pthread_mutex_lock(&IO_LOCK);
+	}
+	for (int i = 0; i < length; i++)
+	{
+		completeRequest(&chain[i], chain[i].result);
+	}
+	if (IO_THREAD_COUNT > 0)
+	{
+		pthread_mutex_unlock(&IO_LOCK);
+	}
+	return length;
+}
+
+int chainLength(struct ioBatch *batch, int first)
+{
+	int last = first;
+	while (last < batch->count - 1 && batch->requests[last].linked)
+	{
+		last++;
+	}
+	return last - first + 1;
+}
+
+long fileStamp(int fd)
+{
+	struct stat st;
+	if (fstat(fd, &st) != 0)
+	{
+		return -1;
+	}
+	return ((long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) ^ st.st_size;
+}
+
+long pathStamp(char *path)
+{
+	struct stat st;
+	if (stat(path, &st) != 0)
+	{
+		return -1;
+	}
+	return ((long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec) ^ st.st_size;
+}
+
+int buildTextIndex(char *textPath, char *indexPath, int blockLines, int keyLine)
+{
+	FILE *fp;
+	fp = fopen(textPath, "r");
 	if (fp == NULL)
 	{
 		return -1;
 	}
+	long stamp = fileStamp(fileno(fp));
+	int capacity = 1024;
+	unsigned int *hashes = (unsigned int *)malloc(capacity * sizeof(unsigned int));
+	unsigned int *values = (unsigned int *)malloc(capacity * sizeof(unsigned int));
+	int n = 0;
 	char line[50];
+	long blockStart = 0;
 	int linenum = 0;
-	int equals = 0;
 	while (fgets(line, 50, fp))
 	{
-		if ((linenum % 3) == 0)
+		if ((linenum % blockLines) == 0)
 		{
-			if (ulen == (strlen(line) - 1))
-			{
-				for (int i = 0; i < ulen; i++)
-				{
-					if (username[i] == line[i])
-					{
-						equals = 1;
-					}
-					else
-					{
-						equals = 0;
-						break;
-					}
-				}
-			}
+			blockStart = ftell(fp) - strlen(line);
 		}
-		if (equals == 1)
+		if ((linenum % blockLines) == keyLine)
 		{
-			fgets(line, 50, fp);
-			int creds = 0;
-			if (hlen == (strlen(line) - 1))
-			{
-				for (int i = 0; i < hlen; i++)
-				{
-					if (ha[i] == line[i])
-					{
-						creds = 1;
-					}
-					else
-					{
-						creds = 0;
-						break;
-					}
-				}
-			}
-			if (creds == 0)
-			{
-				fclose(fp);
-				return 1;
-			}
-			else
+			stripNewline(line);
+			if (n == capacity)
 			{
-				fgets(line, 50, fp);
-				for (int i = 0; i < 50; i++)
-				{
-					if (line[i] == '\n')
-					{
-						token[i] = '\0';
-						break;
-					}
-					token[i] = line[i];
-				}
-				fclose(fp);
-				return 0;
+				capacity *= 2;
+				hashes = (unsigned int *)realloc(hashes, capacity * sizeof(unsigned int));
+				values = (unsigned int *)realloc(values, capacity * sizeof(unsigned int));
 			}
+			hashes[n] = hashString(line);
+			values[n] = blockStart;
+			n++;
 		}
 		linenum++;
 	}
 	fclose(fp);
-	return 1;
+	int ret = buildHashIndex(indexPath, hashes, values, n, stamp);
+	free(hashes);
+	free(values);
+	return ret;
 }
 
-int getBookByID(char *id, struct bookClass *book)
+int openTextIndex(char *textPath, char *indexPath, int blockLines, int keyLine, struct hashIndex *index)
+{
+	int fd = open(textPath, O_RDONLY);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	long stamp = fileStamp(fd);
+	close(fd);
+	if (openHashIndex(indexPath, index) == 0)
+	{
+		if (index->stamp == stamp)
+		{
+			return 0;
+		}
+		closeHashIndex(index);
+	}
+	if (buildTextIndex(textPath, indexPath, blockLines, keyLine) != 0)
+	{
+		return -1;
+	}
+	return openHashIndex(indexPath, index);
+}
+
+int findTextBlock(char *textPath, char *indexPath, int blockLines, int keyLine, char *key, char lines[][50])
 {
+	struct hashIndex index;
+	if (openTextIndex(textPath, indexPath, blockLines, keyLine, &index) != 0)
+	{
+		return -1;
+	}
 	FILE *fp;
-	fp = fopen("Server/bookStore.txt", "r");
+	fp = fopen(textPath, "r");
 	if (fp == NULL)
 	{
+		closeHashIndex(&index);
 		return -1;
 	}
-	char line[50];
-	int linenum = 0;
-	while (fgets(line, 50, fp))
+	struct hashProbe probe;
+	unsigned int offset;
+	int ret;
+	startHashProbe(&index, hashString(key), &probe);
+	while ((ret = probeHashIndex(&index, &probe, &offset)) == 0)
 	{
-		if ((linenum % 5) == 0)
+		fseek(fp, offset, SEEK_SET);
+		int i;
+		for (i = 0; i < blockLines; i++)
 		{
-			line[strlen(line) - 1] = '\0';
-			int cmp = strcmp(id, line);
-			if (cmp == 0)
+			if (!fgets(lines[i], 50, fp))
 			{
-				strcpy(book->id, line);
-				fgets(line, 50, fp);
-				line[strlen(line) - 1] = '\0';
-				strcpy(book->bookTitle, line);
-				fgets(line, 50, fp);
-				line[strlen(line) - 1] = '\0';
-				strcpy(book->author, line);
-				fgets(line, 50, fp);
-				line[strlen(line) - 1] = '\0';
-				book->quantity = atoi(line);
-				fgets(line, 50, fp);
-				line[strlen(line) - 1] = '\0';
-				book->issued = atoi(line);
-				fclose(fp);
-				return 0;
+				break;
 			}
+			stripNewline(lines[i]);
+		}
+		if (i == blockLines && strcmp(lines[keyLine], key) == 0)
+		{
+			break;
 		}
-		linenum++;
 	}
 	fclose(fp);
-	return 1;
+	closeHashIndex(&index);
+	return ret;
 }
 
-int search(char *book, struct bookList *books)
+int openHashIndex(char *path, struct hashIndex *index)
 {
-	return searchBooks(book, books);
+	index->fd = open(path, O_RDWR);
+	if (index->fd == -1)
+	{
+		return -1;
+	}
+	struct indexHeader header;
+	if (pread(index->fd, &header, sizeof(header), 0) != sizeof(header) || memcmp(header.magic, INDEX_MAGIC, 8) != 0 || header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0)
+	{
+		close(index->fd);
+		return -1;
+	}
+	index->capacity = header.capacity;
+	index->count = header.count;
+	index->stamp = header.stamp;
+	strncpy(index->path, path, sizeof(index->path) - 1);
+	index->path[sizeof(index->path) - 1] = '\0';
+	return 0;
 }
 
-int searchBooks(char *book, struct bookList *books)
+void closeHashIndex(struct hashIndex *index)
 {
-	int size = 0;
+	close(index->fd);
+}
+
+int buildHashIndex(char *path, unsigned int *hashes, unsigned int *values, unsigned int n, long stamp)
+{
+	unsigned int capacity = 64;
+	while (capacity < n * 2 + 2)
+	{
+		capacity *= 2;
+	}
+	struct indexSlot *slots = (struct indexSlot *)calloc(capacity, sizeof(struct indexSlot));
+	if (slots == NULL)
+	{
+		return -1;
+	}
+	for (unsigned int i = 0; i < n; i++)
+	{
+		unsigned int slot = hashes[i] & (capacity - 1);
+		while (slots[slot].value != 0)
+		{
+			slot = (slot + 1) & (capacity - 1);
+		}
+		slots[slot].hash = hashes[i];
+		slots[slot].value = values[i] + 1;
+	}
+	// Concurrent rebuilds each write their own file and the last rename wins
+	char tmp[110];
+	sprintf(tmp, "%s.XXXXXX", path);
+	int fd = mkstemp(tmp);
 	FILE *fp;
-	fp = fopen("Server/bookStore.txt", "r");
+	fp = fd == -1 ? NULL : fdopen(fd, "w");
 	if (fp == NULL)
 	{
+		if (fd != -1)
+		{
+			close(fd);
+			unlink(tmp);
+		}
+		free(slots);
 		return -1;
 	}
-	struct bookList *booklist = books;
-	int blen = strlen(book);
-	char line[50];
-	int blocknum = 0;
-	while (fgets(line, 50, fp))
+	fchmod(fd, 0644);
+	char page[INDEX_HEADER_SIZE];
+	memset(page, 0, sizeof(page));
+	struct indexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INDEX_MAGIC, 8);
+	header.capacity = capacity;
+	header.count = n;
+	header.stamp = stamp;
+	memcpy(page, &header, sizeof(header));
+	fwrite(page, sizeof(page), 1, fp);
+	fwrite(slots, sizeof(struct indexSlot), capacity, fp);
+	free(slots);
+	int failed = fflush(fp) != 0 || fsync(fileno(fp)) != 0;
+	fclose(fp);
+	if (failed || rename(tmp, path) != 0)
 	{
-	nextblock:
-		for (int i = 0; i < 5; i++)
+		unlink(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+// Doubles the capacity of an index once it is half full, or makes room for a batch of inserts
+// The old slots carry their hashes so no key has to be reread
+int growHashIndex(struct hashIndex *index, unsigned int *extraHashes, unsigned int *extraValues, unsigned int extra)
+{
+	unsigned int n = 0;
+	unsigned int *hashes = (unsigned int *)malloc((index->count + extra + 1) * sizeof(unsigned int));
+	unsigned int *values = (unsigned int *)malloc((index->count + extra + 1) * sizeof(unsigned int));
+	struct indexSlot slots[512];
+	for (unsigned int i = 0; i < index->capacity; i += 512)
+	{
+		unsigned int m = index->capacity - i < 512 ? index->capacity - i : 512;
+		ssize_t want = m * sizeof(struct indexSlot);
+		if (pread(index->fd, slots, want, INDEX_HEADER_SIZE + (off_t)i * sizeof(struct indexSlot)) != want)
 		{
-			int llen = strlen(line);
-			if (llen > blen)
+			free(hashes);
+			free(values);
+			return -1;
+		}
+		for (unsigned int j = 0; j < m && n < index->count; j++)
+		{
+			if (slots[j].value != 0)
 			{
-				for (int i = 0; i < llen - blen; i++)
-				{
-					int cmp = strncmp(book, &line[i], blen);
-					if (cmp == 0)
-					{
-						rewind(fp);
-						for (int j = 0; j <= blocknum * 5; j++)
-						{
-							fgets(line, 50, fp);
-						}
-						size++;
-						booklist->next = (struct bookList *)malloc(sizeof(struct bookList));
-						strcpy(booklist->book.id, line);
-						fgets(line, 50, fp);
-						line[strlen(line) - 1] = '\0';
-						strcpy(booklist->book.bookTitle, line);
-						fgets(line, 50, fp);
-						line[strlen(line) - 1] = '\0';
-						strcpy(booklist->book.author, line);
-						fgets(line, 50, fp);
-						line[strlen(line) - 1] = '\0';
-						booklist->book.quantity = atoi(line);
-						fgets(line, 50, fp);
-						line[strlen(line) - 1] = '\0';
-						booklist->book.issued = atoi(line);
-						booklist = booklist->next;
-						if (fgets(line, 50, fp))
-						{
-							blocknum++;
-							goto nextblock;
-						}
-						else
-						{
-							fclose(fp);
-							return size;
-						}
-					}
-				}
+				hashes[n] = slots[j].hash;
+				values[n] = slots[j].value - 1;
+				n++;
 			}
-			fgets(line, 20, fp);
 		}
-		blocknum++;
 	}
+	for (unsigned int i = 0; i < extra; i++, n++)
+	{
+		hashes[n] = extraHashes[i];
+		values[n] = extraValues[i];
+	}
+	int ret = buildHashIndex(index->path, hashes, values, n, index->stamp);
+	free(hashes);
+	free(values);
+	if (ret != 0)
+	{
+		return -1;
+	}
+	char path[100];
+	strcpy(path, index->path);
+	closeHashIndex(index);
+	return openHashIndex(path, index);
+}
+
+int insertHashIndex(struct hashIndex *index, unsigned int hash, unsigned int value)
+{
+	if ((index->count + 1) * 2 > index->capacity)
+	{
+		if (growHashIndex(index, NULL, NULL, 0) != 0)
+		{
+			return -1;
+		}
+	}
+	struct indexSlot slot;
+	unsigned int s = hash & (index->capacity - 1);
+	for (;;)
+	{
+		if (pread(index->fd, &slot, sizeof(slot), INDEX_HEADER_SIZE + (off_t)s * sizeof(slot)) != sizeof(slot))
+		{
+			return -1;
+		}
+		if (slot.value == 0)
+		{
+			break;
+		}
+		s = (s + 1) & (index->capacity - 1);
+	}
+	slot.hash = hash;
+	slot.value = value + 1;
+	if (pwrite(index->fd, &slot, sizeof(slot), INDEX_HEADER_SIZE + (off_t)s * sizeof(slot)) != sizeof(slot))
+	{
+		return -1;
+	}
+	index->count++;
+	struct indexHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, INDEX_MAGIC, 8);
+	header.capacity = index->capacity;
+	header.count = index->count;
+	header.stamp = index->stamp;
+	if (pwrite(index->fd, &header, sizeof(header), 0) != sizeof(header))
+	{
+		return -1;
+	}
+	return 0;
+}
 
-	fclose(fp);
-	return size;
+int insertHashIndexEntries(struct hashIndex *index, unsigned int *hashes, unsigned int *values, unsigned int n)
+{
+	// Every single insert costs a read and two writes, so past a few dozen one sequential rewrite is cheaper
+	if (n > 32 || (index->count + n) * 2 > index->capacity)
+	{
+		return growHashIndex(index, hashes, values, n);
+	}
+	for (unsigned int i = 0; i < n; i++)
+	{
+		if (insertHashIndex(index, hashes[i], values[i]) != 0)
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void startHashProbe(struct hashIndex *index, unsigned int hash, struct hashProbe *probe)
+{
+	probe->hash = hash;
+	probe->slot = hash & (index->capacity - 1);
+	probe->steps = 0;
+	probe->windowStart = 0;
+	probe->windowSize = 0;
+}
+
+int probeHashIndex(struct hashIndex *index, struct hashProbe *probe, unsigned int *value)
+{
+	for (;;)
+	{
+		int ret = stepHashProbe(index, probe, value);
+		if (ret != 2)
+		{
+			return ret;
+		}
+		struct ioRequest request;
+		hashWindowRequest(index, probe, &request);
+		if (pread(index->fd, request.buffer, request.size, request.offset) != request.size)
+		{
+			return -1;
+		}
+	}
+}
+
+void hashWindowRequest(struct hashIndex *index, struct hashProbe *probe, struct ioRequest *request)
+{
+	// One read fetches the home slot together with the slots that linear probing is likely to visit next
+	unsigned int m = index->capacity - probe->slot < 8 ? index->capacity - probe->slot : 8;
+	memset(request, 0, sizeof(*request));
+	request->op = IO_READ;
+	request->fd = index->fd;
+	request->buffer = probe->window;
+	request->size = m * sizeof(struct indexSlot);
+	request->offset = INDEX_HEADER_SIZE + (off_t)probe->slot * sizeof(struct indexSlot);
+	probe->windowStart = probe->slot;
+	probe->windowSize = m;
+}
+
+int stepHashProbe(struct hashIndex *index, struct hashProbe *probe, unsigned int *value)
+{
+	while (probe->steps < index->capacity)
+	{
+		if (probe->slot < probe->windowStart || probe->slot >= probe->windowStart + probe->windowSize)
+		{
+			return 2;
+		}
+		struct indexSlot *slot = &probe->window[probe->slot - probe->windowStart];
+		probe->slot = (probe->slot + 1) & (index->capacity - 1);
+		probe->steps++;
+		if (slot->value == 0)
+		{
+			return 1;
+		}
+		if (slot->hash == probe->hash)
+		{
+			*value = slot->value - 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+void initMessage(struct message *msg)
+{
+	msg->data = NULL;
+	msg->size = 0;
+	msg->capacity = 0;
+	msg->offset = 0;
+	msg->failed = 0;
+}
+
+void freeMessage(struct message *msg)
+{
+	free(msg->data);
+	initMessage(msg);
+}
+
+void putBytes(struct message *msg, void *data, unsigned int size)
+{
+	if (msg->size + size > msg->capacity)
+	{
+		msg->capacity = msg->capacity == 0 ? 256 : msg->capacity;
+		while (msg->size + size > msg->capacity)
+		{
+			msg->capacity *= 2;
+		}
+		msg->data = (char *)realloc(msg->data, msg->capacity);
+	}
+	memcpy(msg->data + msg->size, data, size);
+	msg->size += size;
+}
+
+void putInt(struct message *msg, int value)
+{
+	putBytes(msg, &value, sizeof(value));
+}
+
+void putLong(struct message *msg, long value)
+{
+	putBytes(msg, &value, sizeof(value));
+}
+
+void putString(struct message *msg, char *s)
+{
+	int length = strlen(s);
+	putInt(msg, length);
+	putBytes(msg, s, length);
+}
+
+void putResults(struct message *msg, struct resultSet *results, unsigned int nodeSize)
+{
+	putInt(msg, results->size);
+	putInt(msg, nodeSize);
+	for (struct resultNode *node = firstResult(results); node != NULL; node = nextResult(node))
+	{
+		putBytes(msg, (char *)node + sizeof(struct resultNode), nodeSize - sizeof(struct resultNode));
+	}
+}
+
+void getBytes(struct message *msg, void *data, unsigned int size)
+{
+	if (msg->failed || size > msg->size - msg->offset)
+	{
+		msg->failed = 1;
+		memset(data, 0, size);
+		return;
+	}
+	memcpy(data, msg->data + msg->offset, size);
+	msg->offset += size;
+}
+
+int getInt(struct message *msg)
+{
+	int value;
+	getBytes(msg, &value, sizeof(value));
+	return value;
+}
+
+long getLong(struct message *msg)
+{
+	long value;
+	getBytes(msg, &value, sizeof(value));
+	return value;
+}
+
+void getString(struct message *msg, char *s, int size)
+{
+	int length = getInt(msg);
+	if (msg->failed || length < 0 || (unsigned int)length > msg->size - msg->offset)
+	{
+		msg->failed = 1;
+		s[0] = '\0';
+		return;
+	}
+	int keep = length < size - 1 ? length : size - 1;
+	memcpy(s, msg->data + msg->offset, keep);
+	s[keep] = '\0';
+	msg->offset += length;
+}
+
+int getResults(struct message *msg, struct resultSet *results)
+{
+	int count = getInt(msg);
+	unsigned int nodeSize = getInt(msg);
+	if (msg->failed || nodeSize < sizeof(struct resultNode))
+	{
+		return 0;
+	}
+	int i;
+	for (i = 0; i < count && !msg->failed; i++)
+	{
+		char *node = appendResult(results, nodeSize);
+		getBytes(msg, node + sizeof(struct resultNode), nodeSize - sizeof(struct resultNode));
+	}
+	return i;
+}
+
+int readFully(int fd, void *data, size_t size)
+{
+	char *p = (char *)data;
+	while (size > 0)
+	{
+		ssize_t n = read(fd, p, size);
+		if (n <= 0)
+		{
+			if (n == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		size -= n;
+	}
+	return 0;
 }
 
-int getWishListInfo(char *token, struct bookInfoList *books)
+int writeFully(int fd, void *data, size_t size)
 {
-	FILE *fp;
-	fp = fopen("Server/wishList.txt", "r");
-	if (fp == NULL)
-	{
-		return -1;
-	}
-	int tokenline = 1;
-	char line[50];
-	while (fgets(line, 50, fp))
+	char *p = (char *)data;
+	while (size > 0)
 	{
-		if (tokenline == 1)
+		// A peer that hung up fails the send instead of killing the CLI with SIGPIPE
+		ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+		if (n <= 0)
 		{
-			line[strlen(line) - 1] = '\0';
-			int cmp = strcmp(token, line);
-			if (cmp == 0)
+			if (n == -1 && errno == EINTR)
 			{
-				int size = 0;
-				struct bookInfoList *booklist = books;
-				fgets(line, 50, fp);
-				while (1)
-				{
-					booklist->next = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.id, line);
-					fgets(line, 50, fp);
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.bookTitle, line);
-					fgets(line, 50, fp);
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.author, line);
-					size++;
-					booklist = booklist->next;
-					fgets(line, 50, fp);
-					if (strcmp(line, "\n") == 0)
-					{
-						fclose(fp);
-						return size;
-					}
-				}
+				continue;
 			}
+			return -1;
 		}
-		if (line[0] == '\n')
-		{
-			tokenline = 1;
-		}
-		else
-		{
-			tokenline = 0;
-		}
+		p += n;
+		size -= n;
 	}
-	fclose(fp);
 	return 0;
 }
 
-int getAllIssuedBooks(struct bookInfoList *books)
+int connectDaemon()
 {
-	char token[50];
-	int ret = getToken(token);
-	if (ret == -1)
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
 	{
 		return -1;
 	}
-	return getIssuedBookInfo(token, books);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+	return fd;
 }
 
-int getIssuedBookInfo(char *token, struct bookInfoList *books)
+int daemonRunning()
 {
-	FILE *fp;
-	fp = fopen("Server/issuedBooks.txt", "r");
-	if (fp == NULL)
+	int fd = connectDaemon();
+	if (fd == -1)
+	{
+		return 0;
+	}
+	close(fd);
+	return 1;
+}
+
+int callDaemon(int op, struct message *msg, int *ret)
+{
+	int fd = connectDaemon();
+	if (fd == -1)
 	{
+		// The daemon went away, this process carries on with the Server files itself
+		DAEMON_CLIENT = 0;
 		return -1;
 	}
-	int tokenline = 1;
-	char line[50];
-	while (fgets(line, 50, fp))
+	struct requestHeader request;
+	request.magic = DAEMON_MAGIC;
+	request.op = op;
+	request.length = msg->size;
+	struct replyHeader reply;
+	int failed = writeFully(fd, &request, sizeof(request)) != 0 || writeFully(fd, msg->data, msg->size) != 0 || readFully(fd, &reply, sizeof(reply)) != 0 || reply.length > DAEMON_MESSAGE_MAX;
+	freeMessage(msg);
+	if (!failed && reply.length > 0)
+	{
+		msg->data = (char *)malloc(reply.length);
+		msg->size = reply.length;
+		msg->capacity = reply.length;
+		failed = readFully(fd, msg->data, reply.length) != 0;
+	}
+	close(fd);
+	// Once delivered a request may have been carried out, so it is not retried locally
+	*ret = failed ? -1 : reply.ret;
+	msg->failed = failed;
+	return 0;
+}
+
+int forwardCall(int op, int *ret, char *format, ...)
+{
+	if (!DAEMON_CLIENT)
 	{
-		if (tokenline == 1)
+		return 0;
+	}
+	struct message msg;
+	initMessage(&msg);
+	va_list args;
+	va_start(args, format);
+	char *f = format;
+	for (; *f != '\0' && *f != '>'; f++)
+	{
+		if (*f == 'i')
 		{
-			line[strlen(line) - 1] = '\0';
-			int cmp = strcmp(token, line);
-			if (cmp == 0)
+			putInt(&msg, va_arg(args, int));
+		}
+		else if (*f == 'l')
+		{
+			putLong(&msg, va_arg(args, long));
+		}
+		else if (*f == 's')
+		{
+			putString(&msg, va_arg(args, char *));
+		}
+		else if (*f == 'b')
+		{
+			void *data = va_arg(args, void *);
+			size_t size = va_arg(args, size_t);
+			if (size > 0)
 			{
-				int size = 0;
-				struct bookInfoList *booklist = books;
-				fgets(line, 50, fp);
-				while (1)
-				{
-					booklist->next = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.id, line);
-					fgets(line, 50, fp);
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.bookTitle, line);
-					fgets(line, 50, fp);
-					line[strlen(line) - 1] = '\0';
-					strcpy(booklist->book.author, line);
-					fgets(line, 50, fp);
-					line[strlen(line) - 1] = '\0';
-					booklist->time = atoi(line);
-					size++;
-					booklist = booklist->next;
-					fgets(line, 50, fp);
-					if (strcmp(line, "\n") == 0)
-					{
-						fclose(fp);
-						return size;
-					}
-				}
+				putBytes(&msg, data, size);
 			}
 		}
-		if (line[0] == '\n')
+		else if (*f == 'v')
 		{
-			tokenline = 1;
+			char **strings = va_arg(args, char **);
+			int n = va_arg(args, int);
+			for (int i = 0; i < n; i++)
+			{
+				putString(&msg, strings[i]);
+			}
 		}
-		else
+	}
+	if (callDaemon(op, &msg, ret) != 0)
+	{
+		va_end(args);
+		freeMessage(&msg);
+		return 0;
+	}
+	for (; *f != '\0'; f++)
+	{
+		if (*f == 'r')
 		{
-			tokenline = 0;
+			getResults(&msg, va_arg(args, struct resultSet *));
+		}
+		else if (*f == 's')
+		{
+			char *s = va_arg(args, char *);
+			getString(&msg, s, va_arg(args, int));
+		}
+		else if (*f == 'b')
+		{
+			void *data = va_arg(args, void *);
+			getBytes(&msg, data, va_arg(args, size_t));
 		}
 	}
-	fclose(fp);
-	return 0;
+	va_end(args);
+	freeMessage(&msg);
+	return 1;
 }
 
-int issueBookByID(char *id)
+int runDaemon()
 {
-	char token[20];
-	int ret = getToken(token);
-	if (ret == -1)
+	// A second daemon would unlink the socket of the first one
+	if (daemonRunning())
+	{
+		return -1;
+	}
+	signal(SIGPIPE, SIG_IGN);
+	if (recoverJournal() == -1)
+	{
+		return -1;
+	}
+	// Everything the searches keep in memory is loaded here, once, instead of by every call of every CLI
+	refreshCatalog(SNAPSHOT_ALL);
+	pthread_mutex_lock(&USERTEXT_LOCK);
+	updateUserColumn();
+	pthread_mutex_unlock(&USERTEXT_LOCK);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd == -1)
+	{
+		return -1;
+	}
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, DAEMON_SOCKET, sizeof(addr.sun_path) - 1);
+	unlink(DAEMON_SOCKET);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0)
 	{
+		close(fd);
 		return -1;
 	}
-	struct bookInfoList *books = (struct bookInfoList *)malloc(sizeof(struct bookInfoList));
-	struct bookInfoList *list = books;
-	int s = getIssuedBookInfo(token, books);
-	for (int i = 0; i < s; i++)
+	pthread_t sweeper;
+	pthread_create(&sweeper, NULL, daemonSweeper, NULL);
+	pthread_t workers[DAEMON_WORKERS];
+	for (int i = 0; i < DAEMON_WORKERS; i++)
+	{
+		pthread_create(&workers[i], NULL, daemonWorker, &fd);
+	}
+	for (int i = 0; i < DAEMON_WORKERS; i++)
+	{
+		pthread_join(workers[i], NULL);
+	}
+	return -1;
+}
+
+void *daemonWorker(void *arg)
+{
+	int listener = *(int *)arg;
+	for (;;)
 	{
-		if (strcmp(books->book.id, id) == 0)
+		int fd = accept(listener, NULL, NULL);
+		if (fd == -1)
 		{
-			for (int i = 0; i < s; i++)
+			if (errno == EINTR || errno == ECONNABORTED)
 			{
-				free(list);
-				list = list->next;
+				continue;
 			}
-			return 2;
+			return NULL;
 		}
-		books = books->next;
-	}
-	for (int i = 0; i < s; i++)
-	{
-		free(list);
-		list = list->next;
+		serveConnection(fd);
+		close(fd);
 	}
-	time_t t = time(NULL);
-	struct bookClass *book = (struct bookClass *)malloc(sizeof(struct bookClass));
-	int r = getBookByID(id, book);
-	struct bookInfo booki;
-	strcpy(booki.id, book->id);
-	strcpy(booki.bookTitle, book->bookTitle);
-	strcpy(booki.author, book->author);
-	free(book);
-	return issueBook(token, booki, t);
 }
 
-int issueBook(char *token, struct bookInfo book, time_t time)
+void *daemonSweeper(void *arg)
 {
-	FILE *fp;
-	fp = fopen("Server/issuedBooks.txt", "r");
-	if (fp == NULL)
+	for (;;)
 	{
-		return -1;
+		sweepNotifications(time(NULL));
+		sleep(60);
 	}
-	int exists = 0;
-	char line[50];
-	int filesi = 0;
-	struct txtFile *original = (struct txtFile *)malloc(sizeof(struct txtFile));
-	struct txtFile *txtfile = original;
-	struct txtFile *last = txtfile;
-	while (fgets(line, 50, fp))
-	{
-		filesi++;
-		last->next = (struct txtFile *)malloc(sizeof(struct txtFile));
-		strcpy(last->line, line);
-		last = last->next;
-	}
-	last->next = NULL;
-	fp = freopen("Server/issuedBooks.txt", "w", fp);
-	for (int i = 0; i < filesi; i++)
-	{
-		fputs(txtfile->line, fp);
-		txtfile->line[strlen(txtfile->line) - 1] = '\0';
-		if (strcmp(txtfile->line, token) == 0)
-		{
-			exists = 1;
-			fputs(book.id, fp);
-			fputs("\n", fp);
-			fputs(book.bookTitle, fp);
-			fputs("\n", fp);
-			fputs(book.author, fp);
-			fputs("\n", fp);
-			char timeS[50];
-			sprintf(timeS, "%ld", time);
-			fputs(timeS, fp);
-			fputs("\n", fp);
-		}
-		txtfile = txtfile->next;
-	}
-	if (exists == 0)
-	{
-		fputs(token, fp);
-		fputs("\n", fp);
-		fputs(book.id, fp);
-		fputs("\n", fp);
-		fputs(book.bookTitle, fp);
-		fputs("\n", fp);
-		fputs(book.author, fp);
-		fputs("\n", fp);
-		char timeS[50];
-		sprintf(timeS, "%ld", time);
-		fputs(timeS, fp);
-		fputs("\n", fp);
-		fputs("\n", fp);
-	}
-	for (int i = 0; i < filesi; i++)
-	{
-		free(original);
-		original = original->next;
-	}
-	fp = freopen("Server/bookStore.txt", "r", fp);
-	if (fp == NULL)
+}
+
+void serveConnection(int fd)
+{
+	struct requestHeader header;
+	if (readFully(fd, &header, sizeof(header)) != 0 || header.magic != DAEMON_MAGIC || header.length > DAEMON_MESSAGE_MAX)
 	{
-		return -2;
+		return;
 	}
-	int filesize = 0;
-	struct txtFile *originals = (struct txtFile *)malloc(sizeof(struct txtFile));
-	struct txtFile *txtfiles = originals;
-	struct txtFile *lasts = txtfiles;
-	while (fgets(line, 50, fp))
+	struct message request;
+	initMessage(&request);
+	if (header.length > 0)
 	{
-		lasts->next = (struct txtFile *)malloc(sizeof(struct txtFile));
-		strcpy(lasts->line, line);
-		lasts = lasts->next;
-		filesize++;
-	}
-	fp = freopen("Server/bookStore.txt", "w", fp);
-	fputs(txtfiles->line, fp);
-	for (int i = 0; i < filesize; i++)
-	{
-
-		if ((i % 5) == 0)
-		{
-			txtfiles->line[strlen(txtfiles->line) - 1] = '\0';
-			if (strcmp(txtfiles->line, book.id) == 0)
-			{
-				txtfiles = txtfiles->next;
-				fputs(txtfiles->line, fp);
-				txtfiles = txtfiles->next;
-				fputs(txtfiles->line, fp);
-				txtfiles = txtfiles->next;
-				fputs(txtfiles->line, fp);
-				txtfiles = txtfiles->next;
-				int issued = atoi(txtfiles->line);
-				issued++;
-				sprintf(txtfiles->line, "%d\n", issued);
-				fputs(txtfiles->line, fp);
-				for (int j = i; j < (filesize - 5); j++)
-				{
-					txtfiles = txtfiles->next;
-					fputs(txtfiles->line, fp);
-				}
-				goto ending;
-			}
+		request.data = (char *)malloc(header.length);
+		request.size = header.length;
+		request.capacity = header.length;
+		if (readFully(fd, request.data, header.length) != 0)
+		{
+			freeMessage(&request);
+			return;
 		}
-		txtfiles = txtfiles->next;
-		fputs(txtfiles->line, fp);
 	}
-ending:
-	for (int i = 0; i < filesize; i++)
+	struct message reply;
+	initMessage(&reply);
+	// Every call runs on its worker alongside the others: the Server files carry the same locks that keep CLIs apart,
+	// catalog reads work on a snapshot, and the username column has a lock of its own
+	int ret = dispatchRequest(header.op, &request, &reply);
+	struct replyHeader answer;
+	answer.ret = ret;
+	answer.length = reply.size;
+	if (writeFully(fd, &answer, sizeof(answer)) == 0)
 	{
-		free(originals);
-		originals = originals->next;
+		writeFully(fd, reply.data, reply.size);
 	}
-	fclose(fp);
-	return 0;
+	freeMessage(&request);
+	freeMessage(&reply);
 }
 
-int returnBook(char *token, char *id)
+int dispatchRequest(int op, struct message *request, struct message *reply)
 {
-	FILE *fp;
-	fp = fopen("Server/issuedBooks.txt", "r");
-	if (fp == NULL)
+	char s[150], t[150];
+	int ret = -1;
+	struct resultSet results;
+	initResultSet(&results);
+	switch (op)
+	{
+	case OP_VERIFY_CREDENTIALS:
+	case OP_VERIFY_ADMIN:
+	{
+		getString(request, s, 50);
+		int64 hash = getLong(request);
+		memset(t, 0, sizeof(t));
+		if (request->failed)
+		{
+			break;
+		}
+		ret = op == OP_VERIFY_CREDENTIALS ? verifyCredentials(s, hash, t) : verifyCredentialsForAdmin(s, hash, t);
+		putString(reply, t);
+		break;
+	}
+	case OP_CREATE_TOKEN:
 	{
-		return -1;
+		getString(request, s, 50);
+		int64 hash = getLong(request);
+		if (!request->failed)
+		{
+			ret = createNewToken(s, hash);
+		}
+		break;
 	}
-	int match = 1;
-	int success = 0;
-	int exists = 0;
-	int try = 0;
-	char line[50];
-	int filesi = 0;
-	struct txtFile *original = (struct txtFile *)malloc(sizeof(struct txtFile));
-	struct txtFile *txtfile = original;
-	struct txtFile *last = txtfile;
-	while (fgets(line, 50, fp))
+	case OP_DELETE_TOKEN:
+		getString(request, s, 50);
+		if (!request->failed)
+		{
+			ret = deleteTokenPermanently(s);
+		}
+		break;
+	case OP_VIEW_USERS:
+		ret = viewUsers(&results);
+		putResults(reply, &results, sizeof(struct users));
+		break;
+	case OP_SEARCH_USERS:
+		getString(request, s, 50);
+		if (!request->failed)
+		{
+			ret = searchUsers(s, &results);
+			putResults(reply, &results, sizeof(struct users));
+		}
+		break;
+	case OP_VERIFY_TOKEN:
 	{
-		filesi++;
-		last->next = (struct txtFile *)malloc(sizeof(struct txtFile));
-		strcpy(last->line, line);
-		last = last->next;
+		getString(request, s, 50);
+		if (request->failed)
+		{
+			break;
+		}
+		// verifyToken frees the token it is given
+		char *token = (char *)malloc(50);
+		strcpy(token, s);
+		memset(t, 0, sizeof(t));
+		ret = verifyToken(token, t);
+		putString(reply, t);
+		break;
+	}
+	case OP_SEARCH_BOOKS:
+		getString(request, s, 150);
+		if (!request->failed)
+		{
+			ret = searchBooks(s, &results);
+			putResults(reply, &results, sizeof(struct bookList));
+		}
+		break;
+	case OP_SEARCH_RANKED:
+	{
+		getString(request, s, 150);
+		int k = getInt(request);
+		int weighted = getInt(request);
+		struct searchWeights weights;
+		if (weighted)
+		{
+			getBytes(request, &weights, sizeof(weights));
+		}
+		if (!request->failed)
+		{
+			ret = searchBooksRanked(s, k, weighted ? &weights : NULL, &results);
+			putResults(reply, &results, sizeof(struct bookList));
+		}
+		break;
 	}
-	fp = freopen("Server/issuedBooks.txt", "w", fp);
-	for (int i = 0; i < filesi; i++)
+	case OP_SEARCH_FUZZY:
 	{
-	returnL:
-		fputs(txtfile->line, fp);
-		if (strncmp(txtfile->line, token, strlen(token)) == 0)
+		getString(request, s, 150);
+		int k = getInt(request);
+		if (!request->failed)
 		{
-		returnLoop:
-			txtfile = txtfile->next;
-			if (txtfile->line[0] != '\n')
-			{
-				try++;
-				txtfile->line[strlen(txtfile->line) - 1] = '\0';
-				if (strcmp(txtfile->line, id) == 0)
-				{
-					match = 0;
-					for (int j = 0; j < 4; j++)
-					{
-						txtfile = txtfile->next;
-						i++;
-					}
-					i++;
-					success = 1;
-					if ((txtfile->line[0] == '\n') && (try == 1))
-					{
-						exists = 1;
-					}
-					goto returnL;
-				}
-				else
-				{
-
-					fputs(txtfile->line, fp);
-					fputs("\n", fp);
-					i++;
-					goto returnLoop;
-				}
-			}
-			else
-			{
-				goto returnL;
-			}
+			ret = searchBooksFuzzy(s, k, &results);
+			putResults(reply, &results, sizeof(struct bookList));
 		}
-		txtfile = txtfile->next;
+		break;
 	}
-	for (int i = 0; i < filesi; i++)
+	case OP_COMPLETE_BOOKS:
 	{
-		free(original);
-		original = original->next;
+		int field = getInt(request);
+		getString(request, s, 150);
+		int n = getInt(request);
+		if (!request->failed)
+		{
+			ret = completeBooks(field, s, n, &results);
+			putResults(reply, &results, sizeof(struct completionList));
+		}
+		break;
 	}
-	if (exists == 1)
+	case OP_GET_BOOK:
 	{
-		fp = freopen("Server/issuedBooks.txt", "r", fp);
-		original = (struct txtFile *)malloc(sizeof(struct txtFile));
-		txtfile = original;
-		last = txtfile;
-		int filesize = 0;
-		while (fgets(line, 50, fp))
+		getString(request, s, 150);
+		if (request->failed)
 		{
-			filesize++;
-			last->next = (struct txtFile *)malloc(sizeof(struct txtFile));
-			strcpy(last->line, line);
-			last = last->next;
+			break;
 		}
-		fp = freopen("Server/issuedBooks.txt", "w", fp);
-		for (int i = 0; i < filesize - 2; i++)
+		struct bookClass book;
+		memset(&book, 0, sizeof(book));
+		ret = getBookByID(s, &book);
+		putBytes(reply, &book, sizeof(book));
+		break;
+	}
+	case OP_WISH_LIST:
+	case OP_ISSUED_BOOKS:
+		getString(request, s, 50);
+		if (!request->failed)
 		{
-			if (strncmp(txtfile->line, token, strlen(token)) == 0)
-			{
-				txtfile = txtfile->next;
-				i++;
-				txtfile = txtfile->next;
-				i++;
-			}
-			fputs(txtfile->line, fp);
-			txtfile = txtfile->next;
+			ret = op == OP_WISH_LIST ? getWishListInfo(s, &results) : getIssuedBookInfo(s, &results);
+			putResults(reply, &results, sizeof(struct bookInfoList));
 		}
-		for (int i = 0; i < filesize; i++)
+		break;
+	case OP_OVERDUE_LOANS:
+	{
+		time_t time = getLong(request);
+		if (!request->failed)
 		{
-			free(original);
-			original = original->next;
+			ret = viewOverdueLoans(time, &results);
+			putResults(reply, &results, sizeof(struct loanList));
 		}
+		break;
 	}
-	fclose(fp);
-	if (success == 1)
+	case OP_NOTIFICATIONS:
+		getString(request, s, 50);
+		if (!request->failed)
+		{
+			ret = getNotifications(s, &results);
+			putResults(reply, &results, sizeof(struct notificationList));
+		}
+		break;
+	case OP_SWEEP:
 	{
-		fp = fopen("Server/bookStore.txt", "r");
-		if (fp == NULL)
+		time_t time = getLong(request);
+		if (!request->failed)
 		{
-			return -2;
+			ret = sweepNotifications(time);
 		}
-		int fils = 0;
-		original = (struct txtFile *)malloc(sizeof(struct txtFile));
-		txtfile = original;
-		last = txtfile;
-		while (fgets(line, 50, fp))
+		break;
+	}
+	case OP_ISSUE_BOOK:
+	{
+		getString(request, s, 50);
+		struct bookInfo book;
+		getBytes(request, &book, sizeof(book));
+		time_t time = getLong(request);
+		if (!request->failed)
+		{
+			ret = issueBook(s, book, time);
+		}
+		break;
+	}
+	case OP_ISSUE_BOOKS:
+	case OP_RETURN_BOOKS:
+	case OP_IMPORT_BOOKS:
+	{
+		if (op == OP_ISSUE_BOOKS)
+		{
+			getString(request, s, 50);
+		}
+		int n = getInt(request);
+		if (request->failed || n < 0 || (unsigned int)n > request->size / sizeof(int))
+		{
+			break;
+		}
+		// Every batch arrives as columns of strings, a token or market id column first and then the issue number column
+		char *first = (char *)malloc((size_t)(n > 0 ? n : 1) * 150);
+		char *second = (char *)malloc((size_t)(n > 0 ? n : 1) * 150);
+		char **firsts = (char **)malloc(sizeof(char *) * (n > 0 ? n : 1));
+		char **seconds = (char **)malloc(sizeof(char *) * (n > 0 ? n : 1));
+		int *numbers = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+		int *statuses = (int *)malloc(sizeof(int) * (n > 0 ? n : 1));
+		for (int i = 0; i < n; i++)
+		{
+			firsts[i] = first + (size_t)i * 150;
+			seconds[i] = second + (size_t)i * 150;
+		}
+		for (int i = 0; i < n && op != OP_ISSUE_BOOKS; i++)
+		{
+			getString(request, firsts[i], 150);
+		}
+		for (int i = 0; i < n; i++)
+		{
+			getString(request, seconds[i], 150);
+		}
+		if (op == OP_IMPORT_BOOKS)
 		{
-			fils++;
-			last->next = (struct txtFile *)malloc(sizeof(struct txtFile));
-			strcpy(last->line, line);
-			last = last->next;
+			getBytes(request, numbers, sizeof(int) * n);
 		}
-		fp = freopen("Server/bookStore.txt", "w", fp);
-		fputs(txtfile->line, fp);
-		for (int i = 0; i < fils; i++)
+		time_t time = op == OP_ISSUE_BOOKS ? getLong(request) : 0;
+		if (!request->failed)
 		{
-			if ((i % 5) == 0)
+			if (op == OP_ISSUE_BOOKS)
 			{
-				txtfile->line[strlen(txtfile->line) - 1] = '\0';
-				if (strcmp(txtfile->line, id) == 0)
-				{
-					txtfile = txtfile->next;
-					fputs(txtfile->line, fp);
-					txtfile = txtfile->next;
-					fputs(txtfile->line, fp);
-					txtfile = txtfile->next;
-					fputs(txtfile->line, fp);
-					txtfile = txtfile->next;
-					int issued = atoi(txtfile->line);
-					issued--;
-					sprintf(txtfile->line, "%d\n", issued);
-					fputs(txtfile->line, fp);
-					for (int j = i; j < (fils - 5); j++)
-					{
-						txtfile = txtfile->next;
-						fputs(txtfile->line, fp);
-					}
-					goto ending;
-				}
+				ret = issueBooks(s, seconds, n, time, statuses);
+			}
+			else if (op == OP_RETURN_BOOKS)
+			{
+				ret = returnBooks(firsts, seconds, n, statuses);
+			}
+			else
+			{
+				ret = importBooksFromMarket(firsts, seconds, numbers, n, statuses);
 			}
-			txtfile = txtfile->next;
-			fputs(txtfile->line, fp);
+			putBytes(reply, statuses, sizeof(int) * n);
 		}
-	ending:
-		for (int i = 0; i < fils; i++)
+		free(first);
+		free(second);
+		free(firsts);
+		free(seconds);
+		free(numbers);
+		free(statuses);
+		break;
+	}
+	case OP_RETURN_BOOK:
+		getString(request, s, 50);
+		getString(request, t, 150);
+		if (!request->failed)
 		{
-			free(original);
-			original = original->next;
+			ret = returnBook(s, t);
 		}
-		fclose(fp);
+		break;
+	case OP_BUY_BOOK:
+	{
+		getString(request, s, 150);
+		getString(request, t, 150);
+		int quantity = getInt(request);
+		if (!request->failed)
+		{
+			ret = buyBooksFromMarket(s, t, quantity);
+		}
+		break;
+	}
+	case OP_MARKET:
+		ret = viewBooksFromMarket(&results);
+		putResults(reply, &results, sizeof(struct bookVendorList));
+		break;
+	case OP_MARKET_BOOK:
+	{
+		getString(request, s, 150);
+		if (request->failed)
+		{
+			break;
+		}
+		struct bookVendors book;
+		memset(&book, 0, sizeof(book));
+		ret = viewBookFromMarketByID(s, &book);
+		putBytes(reply, &book, sizeof(book));
+		break;
+	}
+	case OP_BOOK_PAGE:
+	{
+		int offset = getInt(request);
+		int limit = getInt(request);
+		if (!request->failed)
+		{
+			ret = viewBookPage(offset, limit, &results);
+			putResults(reply, &results, sizeof(struct bookList));
+		}
+		break;
 	}
-	return match;
+	}
+	freeResultSet(&results);
+	return ret;
 }